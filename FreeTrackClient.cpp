@@ -0,0 +1,144 @@
+#include "FreeTrackClient.hpp"
+#include "logging.hpp"
+#include "pipeline.hpp"
+#include "config.hpp"
+#include "util.hpp"
+#include "path.hpp"
+#include "profiler.hpp"
+#include "timing.hpp"
+#include "thread.hpp"
+
+#include <string>
+#include <memory>
+#include <fstream>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+
+/* FreeTrackClient.dll emulation. Instead of reading FT_SharedMem written by a tracker,
+ * FTGetData() makes the pose itself from the same devices, mapping and config (NPClient.json) as NPClient.dll.
+ */
+
+std::string get_log_path()
+{
+  std::string logPath;
+  if (auto envLogPath = std::getenv("JOY2TIR_FREETRACK_LOG"))
+  {
+    logPath = envLogPath;
+  }
+  else
+  {
+    logPath = get_dir_to_module();
+    append_to_path(logPath, "FreeTrackClient.log");
+  }
+  return logPath;
+}
+
+class Client
+{
+public:
+  void get_data(FTData & data);
+
+  Client();
+
+private:
+  std::unique_ptr<PoseSource> spPoseSource_;
+  std::uint32_t dataID_;
+};
+
+void Client::get_data(FTData & data)
+{
+  spPoseSource_->update();
+  auto const pose = spPoseSource_->get_pose();
+  /* The data ID stops while the pose server is gone, so the game sees tracking is lost */
+  if (spPoseSource_->is_live())
+    ++dataID_;
+  std::memset(&data, 0, sizeof(data));
+  pose_to_ftdata(pose, dataID_, data);
+}
+
+Client::Client() : spPoseSource_(), dataID_(0)
+{
+  PROFILE_ZONE("Client::Client");
+  auto & timer = startup_timer();
+  timer.start();
+
+  auto spLogFileSteam = std::make_shared<std::fstream>(get_log_path(), std::ios::out|std::ios::trunc);
+  auto streamHolder = [spLogFileSteam]() -> std::fstream& { return *spLogFileSteam; };
+  logging::root_logger().add_printer(std::make_shared<logging::StreamLogPrinter>(logging::format_message, streamHolder));
+
+  auto const configPath = get_config_path();
+  logging::log("init", logging::LogLevel::info, "Loading config from: ", configPath);
+  auto const config = load_config(configPath);
+  auto const logLevelName = get_d<std::string>(config, "logLevel", "INFO");
+  logging::root_logger().set_level(logging::n2ll(logLevelName));
+
+  spPoseSource_.reset(new PoseSource(config));
+  logging::log("init", logging::LogLevel::info, "Started in ", timer.get_total_ms(), " ms");
+  timer.set_enabled(false);
+}
+
+/* Returns NULL if the client could not be created; creation is not retried */
+Client * get_client()
+{
+  static bool created = false;
+  static std::unique_ptr<Client> spClient;
+  if (!created)
+  {
+    created = true;
+    try {
+      spClient.reset(new Client());
+    } catch (std::exception & e)
+    {
+      logging::log("main", logging::LogLevel::error, "Failed to create client object: ", e.what());
+    }
+  }
+  return spClient.get();
+}
+
+/* The FreeTrack API has no shutdown call, so device threads are never stopped explicitly.
+ * They keep the DLL loaded after FreeLibrary() (see Thread), and static destructors, which run after this under the loader lock, do not wait for them.
+ * For the same reason a PROFILE=1 build writes no profile here.
+ */
+extern "C" BOOL WINAPI DllMain(HINSTANCE hInstance, DWORD reason, LPVOID pReserved)
+{
+  if (reason == DLL_PROCESS_DETACH)
+    Thread::set_process_detaching();
+  return TRUE;
+}
+
+/* Exported Dll functions. */
+BOOL __stdcall FTGetData(FTData *data)
+{
+  PROFILE_ZONE("FTGetData");
+  auto const pClient = get_client();
+  if (pClient == NULL || data == NULL)
+    return FALSE;
+  try {
+    pClient->get_data(*data);
+  } catch (std::exception & e)
+  {
+    logging::log("main", logging::LogLevel::error, "Exception in main loop: ", e.what());
+    return FALSE;
+  }
+  return TRUE;
+}
+
+void __stdcall FTReportName(int name)
+{
+  logging::log("wrapper", logging::LogLevel::debug, "FTReportName, name: ", name);
+}
+
+char const * __stdcall FTGetDllVersion()
+{
+  logging::log("wrapper", logging::LogLevel::debug, "FTGetDllVersion");
+
+  return "1.0.0.0";
+}
+
+char const * __stdcall FTProvider()
+{
+  logging::log("wrapper", logging::LogLevel::debug, "FTProvider");
+
+  return "joy2tir";
+}
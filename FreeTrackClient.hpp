@@ -0,0 +1,9 @@
+#include "freetrack.hpp"
+
+#include <windows.h>
+
+/* FreeTrackClient.dll exports, as called by games using the FreeTrack protocol */
+extern "C" BOOL __declspec(dllexport) __stdcall FTGetData(FTData *data);
+extern "C" void __declspec(dllexport) __stdcall FTReportName(int name);
+extern "C" char const * __declspec(dllexport) __stdcall FTGetDllVersion();
+extern "C" char const * __declspec(dllexport) __stdcall FTProvider();
@@ -1,9 +1,19 @@
 #include "NPClient.hpp"
 #include "logging.hpp"
-#include "joystick.hpp"
+#include "pose.hpp"
+#include "pipeline.hpp"
+#include "config.hpp"
 #include "util.hpp"
-#include "guid.hpp"
 #include "path.hpp"
+#include "profiler.hpp"
+#include "timing.hpp"
+#include "alloc_count.hpp"
+#include "clock.hpp"
+#include "simd.hpp"
+#include "seqlock.hpp"
+#include "control.hpp"
+#include "rcu.hpp"
+#include "thread.hpp"
 
 #include "nlohmann/json.hpp"
 
@@ -16,18 +26,10 @@
 
 #include <time.h>
 #include <cstdint>
+#include <atomic>
 #include <cstring> //memset
 #include <cstdlib> //getenv
 
-template <class R, class C, class K>
-R get_d(C const & config, K&& key, R&& dfault)
-try {
-  return config.at(key).template get<R>();
-} catch (nlohmann::json::out_of_range const & e)
-{
-  return dfault;
-}
-
 /* TrackIR */
 /*
 tir2joy-master/NPClient.h:55
@@ -137,121 +139,6 @@ int __stdcall NPCLIENT_NP_GetData(void *data)
 }
 */
 
-/* Pose */
-struct PoseMemberID
-{
-  enum type { yaw = 0, first = yaw, pitch, roll, x, y, z, num };
-
-  static type from_cstr(char const * name)
-  {
-    for (int i = 0; i < names_.size(); ++i)
-    {
-      if (strcmp(names_.at(i), name) == 0)
-        return static_cast<type>(i);
-    }
-    return num;
-  }
-
-  static char const * to_cstr(type id)
-  {
-    return (id < first || id > num) ? "unknown" : names_.at(id);
-  }
-
-private:
-  static std::array<char const *, num> names_;
-};
-
-decltype(PoseMemberID::names_) PoseMemberID::names_ = {"yaw", "pitch", "roll", "x", "y", "z"};
-
-struct Pose
-{
-  float yaw, pitch, roll, x, y, z;
-  Pose() =default;
-  Pose(float yaw, float pitch, float roll, float x, float y, float z)
-    : yaw(yaw), pitch(pitch), roll(roll), x(x), y(y), z(z)
-  {}
-  ~Pose() =default;
-};
-
-std::ostream & operator<<(std::ostream & os, Pose const & pose)
-{
-  return os << "yaw: " << pose.yaw << "; pitch: " << pose.pitch << "; roll: "<< pose.roll
-    << "; x: " << pose.x << "; y: " << pose.y << "; z: " << pose.z;
-}
-
-class PoseFactory
-{
-public:
-  virtual Pose make_pose() const =0;
-
-  virtual ~PoseFactory() =default;
-};
-
-class AxisPoseFactory : public PoseFactory
-{
-public:
-  using limits_t = std::pair<float, float>;
-
-  virtual Pose make_pose() const;
-
-  void set_mapping(PoseMemberID::type poseMemberID, std::shared_ptr<Axis> const & spAxis, limits_t const & limits);
-  void set_axis(PoseMemberID::type poseMemberID, std::shared_ptr<Axis> const & spAxis);
-  void set_limits(PoseMemberID::type poseMemberID, limits_t const & limits);
-
-  AxisPoseFactory();
-
-private:
-  struct AxisData { std::shared_ptr<Axis> spAxis; limits_t limits; };
-  std::array<AxisData, PoseMemberID::num> axes_;
-};
-
-Pose AxisPoseFactory::make_pose() const
-{
-  auto const num = PoseMemberID::num;
-  std::array<float, num> v;
-  for (size_t i = PoseMemberID::first; i < num; ++i)
-  {
-    auto const & d = this->axes_.at(i);
-    v.at(i) = d.spAxis ? lerp(d.spAxis->get_value(), -1.0f, 1.0f, d.limits.first, d.limits.second) : 0.0f;
-  }
-  return Pose (
-    v.at(PoseMemberID::yaw),
-    v.at(PoseMemberID::pitch),
-    v.at(PoseMemberID::roll),
-    v.at(PoseMemberID::x),
-    v.at(PoseMemberID::y),
-    v.at(PoseMemberID::z)
-  );
-}
-
-void AxisPoseFactory::set_mapping(PoseMemberID::type poseMemberID, std::shared_ptr<Axis> const & spAxis, AxisPoseFactory::limits_t const & limits)
-{
-  auto & d = this->axes_.at(poseMemberID);
-  d.spAxis = spAxis;
-  d.limits = limits;
-}
-
-void AxisPoseFactory::set_axis(PoseMemberID::type poseMemberID, std::shared_ptr<Axis> const & spAxis)
-{
-  auto & d = this->axes_.at(poseMemberID);
-  d.spAxis = spAxis;
-}
-
-void AxisPoseFactory::set_limits(PoseMemberID::type poseMemberID, AxisPoseFactory::limits_t const & limits)
-{
-  auto & d = this->axes_.at(poseMemberID);
-  d.limits = limits;
-}
-
-AxisPoseFactory::AxisPoseFactory()
-{
-  for (auto & d : this->axes_)
-  {
-    d.spAxis = nullptr;
-    d.limits = limits_t(-1.0f, 1.0f);
-  }
-}
-
 /* tir_data setter */
 struct TIRData
 {
@@ -331,68 +218,150 @@ decltype(TIRData::cstr2value_) TIRData::cstr2value_ = {
   D{ "smoothz", TIRData::NPSmoothZ }
 };
 
+/* publish() is called by one thread at a time; any number of threads may call set_trackir_data() concurrently with it and each other */
 class TIRDataSetter
 {
 public:
-  /* pose yaw, pitch, roll are +/- 180.0f degrees; pose x, y, z, are +/- 256.0f centimeters */
-  void set_trackir_data(tir_data* tir, Pose const & pose)
+  /* pose yaw, pitch, roll are +/- 180.0f degrees; pose x, y, z, are +/- 256.0f centimeters.
+   * A pose that is not live (the pose server is gone) is still returned, but the frame number stops, so the game sees tracking is lost.
+   * The frame number is assigned here, so every reader of a sample reports the same frame and deltas.
+   */
+  void publish(Pose const & pose, bool live)
   {
+    Sample sample;
+    sample.pose = pose;
+    sample.frame = live ? frame_.fetch_add(1, std::memory_order_relaxed) : last_.frame;
+    /* Deltas are between published poses, so that concurrent readers do not consume each other's */
+    float const pc[3] = { pose.x, pose.y, pose.z };
+    for (int i = 0; i < 3; ++i)
+      sample.delta[i] = convert_delta_(pc[i] * scale_[rawFirst_ + i] + bias_[rawFirst_ + i], rawOld_[i]);
+    /* Written to the slot readers are not directed to, then published */
+    auto const next = current_.load(std::memory_order_relaxed) ^ 1;
+    samples_[next].write(sample);
+    current_.store(next, std::memory_order_release);
+    last_ = sample;
+  }
+
+  /* Publishes the last pose again as not live, e.g. when stopped */
+  void publish_stale()
+  {
+    publish(last_.pose, false);
+  }
+
+  /* Bounded time: returns false and leaves tir unchanged if both samples were being rewritten throughout (the reader was preempted over several publishes) */
+  bool set_trackir_data(tir_data* tir)
+  {
+    Sample sample;
+    /* If the current sample is being overwritten, the other one was completed by the same publish */
+    auto const current = current_.load(std::memory_order_acquire);
+    if (!samples_[current].read(sample) && !samples_[current ^ 1].read(sample))
+      return false;
+    auto const & pose = sample.pose;
+    auto const data = data_.load(std::memory_order_relaxed);
     if (erase_)
       memset(tir, 0, sizeof(*tir));
     //TODO What about other members of tir (checksum)?
     tir->status = 0;
-    tir->frame = frame_++;
-    if (data_ & TIRData::NPYaw) tir->yaw = convert_angle_(-pose.yaw);
-    if (data_ & TIRData::NPPitch) tir->pitch = convert_angle_(-pose.pitch);
-    if (data_ & TIRData::NPRoll) tir->roll = convert_angle_(-pose.roll);
-
-    if (data_ & TIRData::NPX) tir->tx = convert_t_(-pose.x);
-    if (data_ & TIRData::NPY) tir->ty = convert_t_(pose.y);
-    if (data_ & TIRData::NPZ) tir->tz = convert_t_(pose.z);
-
-    if (data_ & TIRData::NPRawX) tir->rawx = convert_raw_(-pose.x);
-    if (data_ & TIRData::NPRawY) tir->rawy = convert_raw_(pose.y);
-    if (data_ & TIRData::NPRawZ) tir->rawz = convert_raw_(pose.z);
-
-    if (data_ & TIRData::NPDeltaX) tir->deltax = convert_delta_(-pose.x, rawx_);
-    if (data_ & TIRData::NPDeltaY) tir->deltay = convert_delta_(pose.y, rawy_);
-    if (data_ & TIRData::NPDeltaZ) tir->deltaz = convert_delta_(pose.z, rawz_);
-
-    if (data_ & TIRData::NPSmoothX) tir->smoothx = convert_smooth_(-pose.x);
-    if (data_ & TIRData::NPSmoothY) tir->smoothy = convert_smooth_(pose.y);
-    if (data_ & TIRData::NPSmoothZ) tir->smoothz = convert_smooth_(pose.z);
+    tir->frame = sample.frame;
+    /* All fields are converted in one pass, see scale_ */
+    float const in[numFields_] = {
+      pose.yaw, pose.pitch, pose.roll,
+      pose.x, pose.y, pose.z,
+      pose.x, pose.y, pose.z,
+      pose.x, pose.y, pose.z
+    };
+    float v[numFields_];
+    simd::scale_bias(in, scale_, bias_, v, numFields_);
+
+    if (data & TIRData::NPYaw) tir->yaw = v[0];
+    if (data & TIRData::NPPitch) tir->pitch = v[1];
+    if (data & TIRData::NPRoll) tir->roll = v[2];
+
+    if (data & TIRData::NPX) tir->tx = v[3];
+    if (data & TIRData::NPY) tir->ty = v[4];
+    if (data & TIRData::NPZ) tir->tz = v[5];
+
+    if (data & TIRData::NPRawX) tir->rawx = v[6];
+    if (data & TIRData::NPRawY) tir->rawy = v[7];
+    if (data & TIRData::NPRawZ) tir->rawz = v[8];
+
+    if (data & TIRData::NPDeltaX) tir->deltax = sample.delta[0];
+    if (data & TIRData::NPDeltaY) tir->deltay = sample.delta[1];
+    if (data & TIRData::NPDeltaZ) tir->deltaz = sample.delta[2];
+
+    if (data & TIRData::NPSmoothX) tir->smoothx = v[9];
+    if (data & TIRData::NPSmoothY) tir->smoothy = v[10];
+    if (data & TIRData::NPSmoothZ) tir->smoothz = v[11];
+    return true;
   }
 
-  void set_data(short data) { data_ = data; }
-  short get_data() const { return data_; }
+  void set_data(short data) { data_.store(data, std::memory_order_relaxed); }
+  short get_data() const { return data_.load(std::memory_order_relaxed); }
 
   void set_erase(bool erase) { erase_ = erase; }
   bool get_erase() const { return erase_; }
 
-  void set_frame(unsigned short frame) { frame_ = frame; }
-  unsigned short get_frame() const { return frame_; }
+  /* Before the first publish(): frame of the first live pose */
+  void set_frame(unsigned short frame)
+  {
+    frame_.store(frame, std::memory_order_relaxed);
+    last_.frame = frame - 1;
+  }
+  unsigned short get_frame() const { return frame_.load(std::memory_order_relaxed); }
+  std::uint32_t get_published() const { return (samples_[0].get_sequence() + samples_[1].get_sequence()) / 2; }
 
-  TIRDataSetter() {}
+  TIRDataSetter() : erase_(true), data_(0), frame_(0), rawOld_(), last_(), current_(0), samples_()
+  {
+    last_.pose = Pose(0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f);
+    last_.frame = static_cast<unsigned short>(-1);
+  }
 
 private:
-  float convert_angle_(float pa) const { return pa / 180.0f * 16384.0f; }
-  float convert_t_(float pc) const { return pc * 64.0f; }
-  float convert_raw_(float pc) const { return (pc + 256.0f) * 50.0f; }
-  float convert_delta_(float pc, float & rawOld)
+  struct Sample
+  {
+    Pose pose;
+    float delta[3];
+    unsigned short frame;
+  };
+
+  /* angle: -pa / 180 * 16384; t: pc * 64; raw: (pc + 256) * 50; smooth: (pc + 256) * 64; x, yaw, pitch and roll are negated */
+  static std::size_t const numFields_ = 12;
+  static std::size_t const rawFirst_ = 6;
+  static float const scale_[numFields_];
+  static float const bias_[numFields_];
+
+  float convert_delta_(float raw, float & rawOld)
   {
-    pc = convert_raw_(pc);
-    if (pc == rawOld)
+    if (raw == rawOld)
       return 0.0f;
-    auto const r = pc - rawOld;
-    rawOld = pc;
+    auto const r = raw - rawOld;
+    rawOld = raw;
     return r;
   }
-  float convert_smooth_(float pc) const { return (pc + 256.0f) * 64.0f; }
 
-  bool erase_ = true;
-  short data_ = 0;
-  unsigned short frame_ = 0;
-  float rawx_ = 0.0f, rawy_ = 0.0f, rawz_ = 0.0f;
+  bool erase_;
+  std::atomic<short> data_;
+  std::atomic<unsigned short> frame_;
+  /* Writer only */
+  float rawOld_[3];
+  Sample last_;
+  /* Double-buffered, so a reader finds a complete sample without spinning on the one being written */
+  std::atomic<unsigned> current_;
+  Seqlock<Sample> samples_[2];
+};
+
+float const TIRDataSetter::scale_[] = {
+  -16384.0f / 180.0f, -16384.0f / 180.0f, -16384.0f / 180.0f,
+  -64.0f, 64.0f, 64.0f,
+  -50.0f, 50.0f, 50.0f,
+  -64.0f, 64.0f, 64.0f
+};
+
+float const TIRDataSetter::bias_[] = {
+  0.0f, 0.0f, 0.0f,
+  0.0f, 0.0f, 0.0f,
+  256.0f * 50.0f, 256.0f * 50.0f, 256.0f * 50.0f,
+  256.0f * 64.0f, 256.0f * 64.0f, 256.0f * 64.0f
 };
 
 
@@ -417,170 +386,220 @@ class Main
 {
 public:
   void set_tir_data_fields(short dataFields);
-  void fill_tir_data(void * data);
+  /* Returns false if no complete sample could be read; data is then unchanged */
+  bool fill_tir_data(void * data);
   void update();
+  /* Explicit shutdown (NP_UnregisterWindowHandle): stops the background threads and releases the devices.
+   * The static destructor runs under the loader lock, where threads can not be waited for, so this is where they are stopped.
+   * Until start(), update() publishes nothing and NP_GetData returns the last pose with the frame stopped.
+   */
+  void stop();
+  /* Rereads the config and starts again after stop() (NP_RegisterWindowHandle); does nothing if running */
+  void start();
 
   Main();
   ~Main();
 
 private:
-  std::vector<std::shared_ptr<Updated> > updated_;
-  std::map<std::string, std::shared_ptr<Joystick> > joysticks_;
-  std::shared_ptr<PoseFactory> spPoseFactory_;
-  std::shared_ptr<DInput8JoystickManager> spDI8JoyManager_;
+  void start_(nlohmann::json const & config);
+  /* Waits for a concurrent update() and keeps other callers from updating meanwhile */
+  void lock_updates_();
+  void unlock_updates_();
+  void report_startup_timing_();
+  /* Log level and TIR data fields */
+  void apply_config_(nlohmann::json const & config);
+  /* Runs on the config watcher thread */
+  void reload_config_();
+  /* Runs on the control thread */
+  nlohmann::json handle_control_(nlohmann::json const & request);
+
+  std::string configPath_;
+  /* Replaced on config reload; the sampling path installs a new source between frames */
+  RcuSlot<PoseSource> poseSources_;
   TIRDataSetter tirDataSetter_;
+  /* Set while one NP_GetData caller updates the devices and publishes the pose */
+  std::atomic<bool> updating_;
+  std::atomic<std::uint32_t> skippedUpdates_;
+  /* Serializes start() and stop() */
+  CriticalSection lifecycleCS_;
+  bool running_;
+  /* Declared last, so their threads stop before the members they use are destroyed */
+  std::unique_ptr<ConfigWatcher> spConfigWatcher_;
+  std::unique_ptr<ControlServer> spControlServer_;
 };
 
-Main::Main()
+Main::Main() : configPath_(), poseSources_(), tirDataSetter_(), updating_(false), skippedUpdates_(0), lifecycleCS_(), running_(false), spConfigWatcher_(), spControlServer_()
 {
-  spDI8JoyManager_ = std::make_shared<DInput8JoystickManager>();
-  updated_.push_back(spDI8JoyManager_);
+  PROFILE_ZONE("Main::Main");
+  auto & timer = startup_timer();
+  timer.start();
 
-  std::string configPath;
-  if (auto envConfigPath = std::getenv("JOY2TIR_CONFIG"))
-  {
-    configPath = envConfigPath;
-  }
-  else
-  {
-    configPath = get_dir_to_module();
-    append_to_path(configPath, "NPClient.json");
-  }
+  configPath_ = get_config_path();
+  auto const & configPath = configPath_;
 
-  auto formatter = [](logging::LogMessage const & lm)
+  std::shared_ptr<std::fstream> spLogFileSteam;
   {
-    static char const fmt[] = "%H:%M:%S";
-    size_t const n = 128;
-    char timeCstr[n] = {0};
-    auto time = std::localtime(&lm.time);
-    std::strftime(timeCstr, n, fmt, time);
-    return stream_to_str("(", lm.source, ") <", timeCstr, "> [", lm.level, "] ", lm.msg);
-  };
-  auto spLogFileSteam = std::make_shared<std::fstream>(get_log_path(), std::ios::out|std::ios::trunc);
+    ScopedPhase phase (timer, "logFile");
+    spLogFileSteam = std::make_shared<std::fstream>(get_log_path(), std::ios::out|std::ios::trunc);
+  }
   auto streamHolder = [spLogFileSteam]() -> std::fstream& { return *spLogFileSteam; };
-  auto spLogPrinter = std::make_shared<logging::StreamLogPrinter>(formatter, streamHolder);
+  auto spLogPrinter = std::make_shared<logging::StreamLogPrinter>(logging::format_message, streamHolder);
   logging::root_logger().add_printer(spLogPrinter);
 
   logging::log("init", logging::LogLevel::info, "Loading config from: ", configPath);
-  std::ifstream configStream (configPath);
-  if (!configStream.is_open())
-    throw std::runtime_error(stream_to_str("Failed to load config from: ", configPath));
-  auto config = nlohmann::json::parse(configStream);
+  auto const config = load_config(configPath);
 
-  auto const logLevelName = get_d<std::string>(config, "logLevel", "INFO");
-  auto const logLevel = logging::n2ll(logLevelName);
-  logging::root_logger().set_level(logLevel);
-  logging::log("init", logging::LogLevel::info, "Setting log level to ", logLevelName);
+  tirDataSetter_.set_data(-1);
+  apply_config_(config);
+  logging::log("init", logging::LogLevel::info, "Using ", simd::Level::to_cstr(simd::get_level()), " kernels (", (sizeof(void *) * 8), "-bit)");
+
+  tirDataSetter_.set_erase(get_d(config, "tirEraseData", true));
+  tirDataSetter_.set_frame(get_d(config, "tirStartFrame", 0));
+
+  start_(config);
+  report_startup_timing_();
+}
+
+void Main::start_(nlohmann::json const & config)
+{
+  std::unique_ptr<PoseSource> spPoseSource (new PoseSource(config));
+  lock_updates_();
+  poseSources_.reset(std::move(spPoseSource));
+  unlock_updates_();
 
-  auto const printJoysticks = get_d<bool>(config, "printJoysticks", false);
-  if (printJoysticks)
+  /* Stopped by stop(), since the destructor runs under the loader lock */
+  if (get_d<bool>(config, "watchConfig", true))
   {
-    auto const mode = get_d<int>(config, "printJoysticksMode", 1);
-    logging::log("init", logging::LogLevel::info, "======Legacy joysticks======");
-    auto const legacyJoysticksInfo = get_legacy_joysticks_info();
-    for (decltype(legacyJoysticksInfo)::size_type joyID = 0; joyID < legacyJoysticksInfo.size(); ++joyID)
-    {
-      auto const & info = legacyJoysticksInfo.at(joyID);
-      logging::log("init", logging::LogLevel::info, "id: ", joyID, "; ", legacyjoystickinfo_to_str(info, mode));
-    }
-    logging::log("init", logging::LogLevel::info, "============================");
-    logging::log("init", logging::LogLevel::info, "===DirectInput8 joysticks===");
-    for (auto const & info : spDI8JoyManager_->get_joysticks_info())
+    try {
+      spConfigWatcher_.reset(new ConfigWatcher(configPath_, [this]() { reload_config_(); }, poseSources_.get_retired_handle(), [this]() { poseSources_.collect(); }));
+    } catch (std::runtime_error & e)
     {
-      logging::log("init", logging::LogLevel::info, di8deviceinfo_to_str(info, mode));
+      logging::log("init", logging::LogLevel::error, "Config reload is off (", e.what(), ")");
     }
-    logging::log("init", logging::LogLevel::info, "============================");
   }
 
-  auto const tirDataFieldsName = "tirDataFields";
-  short tirDataFields = -1;
-  if (config.contains(tirDataFieldsName))
+  auto const controlPipe = get_d<std::string>(config, "controlPipe", "");
+  if (!controlPipe.empty())
   {
-    nlohmann::json const tirDataFieldNames = config.at(tirDataFieldsName);
-    tirDataFields = 0;
-    for (auto const & n : tirDataFieldNames)
-      tirDataFields |= TIRData::from_cstr(n.get<std::string>().c_str());
-    logging::log("init", logging::LogLevel::info, "TIR data fields to be filled: ", tirDataFieldNames, " (", tirDataFields, ")");
-  }
-  tirDataSetter_.set_data(tirDataFields);
-
-  tirDataSetter_.set_erase(get_d(config, "tirEraseData", true));
-  tirDataSetter_.set_frame(get_d(config, "tirStartFrame", 0));
-
-  auto const & joysticks = config.at("joysticks");
-  for (auto const & j : joysticks.items())
-  {
-    auto const name = j.key();
-    auto const cfg = j.value();
     try {
-      auto const type = get_d<std::string>(cfg, "type", "");
-      if (type == "legacy")
-      {
-        auto const joyID = get_d<UINT>(cfg, "id", 0);
-        auto const spj = std::make_shared<LegacyJoystick>(joyID);
-        joysticks_[name] = spj;
-        updated_.push_back(spj);
-      }
-      else if (type == "di8")
-      {
-        assert(spDI8JoyManager_);
-        std::shared_ptr<Joystick> spj;
-        auto const joyNameStr = get_d<std::string>(cfg, "name", "");
-        if (joyNameStr.size())
-          spj = spDI8JoyManager_->make_joystick_by_name(joyNameStr.c_str());
-        else
-        {
-          auto const joyGuidStr = get_d<std::string>(cfg, "guid", "");
-          if (joyGuidStr.size())
-          {
-            spj = spDI8JoyManager_->make_joystick_by_guid(str2guid(joyGuidStr.c_str()));
-          }
-          else
-            throw std::runtime_error("Need to specify either name or guid");
-        }
-        joysticks_[name] = spj;
-      }
-      else
-        throw std::runtime_error(stream_to_str("Unknown joystick type: '", type, "'"));
+      spControlServer_.reset(new ControlServer(controlPipe, [this](nlohmann::json const & request) { return handle_control_(request); }));
     } catch (std::runtime_error & e)
     {
-      logging::log("init", logging::LogLevel::error, "Could not create joystick '", name, "' (", e.what(), ")");
+      logging::log("init", logging::LogLevel::error, "Control channel is off (", e.what(), ")");
     }
   }
+  running_ = true;
+}
+
+void Main::start()
+{
+  ScopedLock<CriticalSection> lock (lifecycleCS_);
+  if (running_)
+    return;
+  logging::log("main", logging::LogLevel::info, "Starting again, loading config from: ", configPath_);
+  auto const config = load_config(configPath_);
+  apply_config_(config);
+  start_(config);
+}
+
+void Main::stop()
+{
+  ScopedLock<CriticalSection> lock (lifecycleCS_);
+  if (!running_)
+    return;
+  /* Their threads use the pose source */
+  spControlServer_.reset();
+  spConfigWatcher_.reset();
+  lock_updates_();
+  /* Also a pending reload and a replaced source the watcher has not collected, so none is left for the static destructor */
+  poseSources_.clear();
+  /* NP_GetData keeps returning the last pose, but the frame stops, so the game does not take it for a live one */
+  tirDataSetter_.publish_stale();
+  unlock_updates_();
+  running_ = false;
+  logging::log("main", logging::LogLevel::info, "Stopped");
+#ifdef JOY2TIR_PROFILE
+  auto const tracePath = profiler::get_trace_path();
+  if (PROFILE_DUMP(tracePath))
+    logging::log("main", logging::LogLevel::info, "Wrote profile to ", tracePath);
+#endif
+}
+
+void Main::lock_updates_()
+{
+  while (updating_.exchange(true, std::memory_order_acquire))
+    Sleep(1);
+}
+
+void Main::unlock_updates_()
+{
+  updating_.store(false, std::memory_order_release);
+}
 
-  auto spPoseFactory = std::make_shared<AxisPoseFactory>();
-  auto & mappings = config.at("mapping");
-  for (auto & m : mappings)
+void Main::report_startup_timing_()
+{
+  auto & timer = startup_timer();
+  auto const totalMs = timer.get_total_ms();
+  timer.set_enabled(false);
+  std::stringstream ss;
+  ss << "Startup timing: total: " << totalMs << " ms";
+  for (auto const & p : timer.get_phases())
+    ss << "; " << p.name << ": " << p.ms << " ms";
+  logging::log("init", logging::LogLevel::info, ss.str());
+
+  if (!std::getenv("JOY2TIR_STARTUP_REPORT"))
+    return;
+  auto reportPath = get_dir_to_module();
+  append_to_path(reportPath, "NPClient.startup.json");
+  auto phases = nlohmann::json::array();
+  for (auto const & p : timer.get_phases())
+    phases.push_back({ {"name", p.name}, {"ms", p.ms} });
+  nlohmann::json const report = {
+    {"module", get_path_to_module()},
+    {"time", std::time(nullptr)},
+    {"totalMs", totalMs},
+    {"phases", phases}
+  };
+  std::ofstream reportStream (reportPath, std::ios::out|std::ios::trunc);
+  if (!reportStream.is_open())
   {
-    try {
-      auto const tirAxisName = m.at("tirAxis").get<std::string>();
-      auto poseMemberID = PoseMemberID::from_cstr(tirAxisName.c_str());
-      auto const joyName = m.at("joystick").get<std::string>();
-      auto axisID = AxisID::from_cstr(m.at("joyAxis").get<std::string>().c_str());
-      auto limits = AxisPoseFactory::limits_t(-1.0f, 1.0f);
-      if (m.contains("limits"))
-      {
-        auto const & l = m.at("limits");
-        limits.first = l[0].get<float>();
-        limits.second = l[1].get<float>();
-      }
+    logging::log("init", logging::LogLevel::error, "Failed to write startup report to: ", reportPath);
+    return;
+  }
+  reportStream << report.dump(2) << std::endl;
+  logging::log("init", logging::LogLevel::info, "Startup report written to: ", reportPath);
+}
 
-      auto itJoystick = joysticks_.find(joyName);
-      if (joysticks_.end() == itJoystick)
-      {
-        logging::log("init", logging::LogLevel::error, "Could not create mapping for TIR axis '", tirAxisName, "' (joystick '", joyName, "' was not created)");
-        continue;
-      }
+void Main::apply_config_(nlohmann::json const & config)
+{
+  auto const logLevelName = get_d<std::string>(config, "logLevel", "INFO");
+  auto const logLevel = logging::n2ll(logLevelName);
+  logging::root_logger().set_level(logLevel);
+  logging::log("init", logging::LogLevel::info, "Setting log level to ", logLevelName);
 
-      auto spAxis = std::make_shared<JoystickAxis>(itJoystick->second, axisID);
-      spPoseFactory->set_mapping(poseMemberID, spAxis, limits);
-    }
-    catch (std::exception & e)
-    {
-      logging::log("init", logging::LogLevel::error, "Could not create mapping ", m, " (", e.what(), ")");
-    }
+  /* Without the field, the fields the application requests are kept */
+  auto const tirDataFieldsName = "tirDataFields";
+  if (config.contains(tirDataFieldsName))
+  {
+    nlohmann::json const tirDataFieldNames = config.at(tirDataFieldsName);
+    short tirDataFields = 0;
+    for (auto const & n : tirDataFieldNames)
+      tirDataFields |= TIRData::from_cstr(n.get<std::string>().c_str());
+    logging::log("init", logging::LogLevel::info, "TIR data fields to be filled: ", tirDataFieldNames, " (", tirDataFields, ")");
+    tirDataSetter_.set_data(tirDataFields);
   }
-  spPoseFactory_ = spPoseFactory;
+}
+
+void Main::reload_config_()
+{
+  logging::log("main", logging::LogLevel::info, "Config changed, reloading from: ", configPath_);
+  auto const begin = get_qpc_ticks();
+  auto const config = load_config(configPath_);
+  apply_config_(config);
+  /* Only this thread collects retired sources, so the current one stays valid while the new one is built from it */
+  std::unique_ptr<PoseSource> spPoseSource (new PoseSource(config, poseSources_.get()));
+  poseSources_.offer(std::move(spPoseSource));
+  logging::log("main", logging::LogLevel::info, "Config reloaded in ", qpc_ticks_to_ms(get_qpc_ticks() - begin), " ms, switching on the next frame");
 }
 
 Main::~Main()
@@ -607,23 +626,54 @@ void Main::set_tir_data_fields(short dataFields)
 
 void Main::update()
 {
-  for (auto const & sp : updated_)
-    try
-    {
-      sp->update();
-    }
-    catch (std::runtime_error & e)
+  /* Devices and sinks are not thread-safe: a concurrent caller skips the update and gets the last published pose */
+  if (updating_.exchange(true, std::memory_order_acquire))
+  {
+    skippedUpdates_.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  try {
+    poseSources_.swap([](PoseSource & next, PoseSource const & current) { next.carry_state(current); });
+    /* Stopped */
+    if (poseSources_.get() == NULL)
     {
-      logging::log("main", logging::LogLevel::error, e.what());
+      unlock_updates_();
+      return;
     }
+    auto & poseSource = *poseSources_.get();
+    poseSource.update();
+    auto const pose = poseSource.get_pose();
+    //auto const pose = Pose(100.0f, 110.0f, 120.0f, 10.0f, 20.0f, 30.0f);
+    //logging::log("main", logging::LogLevel::debug, "Pose: ", pose);
+    tirDataSetter_.publish(pose, poseSource.is_live());
+  } catch (...)
+  {
+    unlock_updates_();
+    throw;
+  }
+  unlock_updates_();
+}
+
+nlohmann::json Main::handle_control_(nlohmann::json const & request)
+{
+  /* Keeps a replaced source from being destroyed while it is used here */
+  ScopedLock<CriticalSection> lock (poseSources_.get_reader_cs());
+  auto const pPipeline = poseSources_.get()->get_pipeline();
+  if (get_d<std::string>(request, "cmd", "") != "stats")
+    return handle_control_command(request, pPipeline);
+  if (pPipeline)
+    pPipeline->request_stats();
+  nlohmann::json reply = {
+    { "frame", tirDataSetter_.get_frame() },
+    { "published", tirDataSetter_.get_published() },
+    { "skippedUpdates", skippedUpdates_.load(std::memory_order_relaxed) }
+  };
+  return reply;
 }
 
-void Main::fill_tir_data(void * data)
+bool Main::fill_tir_data(void * data)
 {
-  auto const pose = spPoseFactory_->make_pose();
-  //auto const pose = Pose(100.0f, 110.0f, 120.0f, 10.0f, 20.0f, 30.0f);
-  //logging::log("main", logging::LogLevel::debug, "Pose: ", pose);
-  tirDataSetter_.set_trackir_data(reinterpret_cast<tir_data*>(data), pose);
+  return tirDataSetter_.set_trackir_data(reinterpret_cast<tir_data*>(data));
 }
 
 Main & get_main()
@@ -637,6 +687,38 @@ Main & get_main()
   }
 }
 
+#ifdef JOY2TIR_ALLOC_COUNT
+alloc_count::FrameMonitor & get_frame_monitor()
+{
+  static alloc_count::FrameMonitor monitor (10);
+  return monitor;
+}
+
+/* Reports allocations made by steady-state NP_GetData calls; aborts on them if JOY2TIR_ALLOC_ASSERT is set. */
+void check_frame_allocs(alloc_count::ScopedCounter const & counter)
+{
+  auto & monitor = get_frame_monitor();
+  static bool const abortOnAlloc = std::getenv("JOY2TIR_ALLOC_ASSERT") != nullptr;
+  std::uint64_t badFrame = 0;
+  auto const n = monitor.end_frame(counter, &badFrame);
+  if (badFrame == 0)
+    return;
+  //Logging allocates too, so only the first offending frame and then every power of two are reported
+  if ((badFrame & (badFrame - 1)) == 0)
+    logging::log("main", logging::LogLevel::error, "Steady-state NP_GetData made ", n, " allocation(s) (", badFrame, " frame(s) and ", monitor.get_bad_allocs(), " allocation(s) so far)");
+  if (abortOnAlloc)
+    std::abort();
+}
+#endif
+
+/* Static destructors run after this on DLL_PROCESS_DETACH, under the loader lock; see Main::stop() */
+extern "C" BOOL WINAPI DllMain(HINSTANCE hInstance, DWORD reason, LPVOID pReserved)
+{
+  if (reason == DLL_PROCESS_DETACH)
+    Thread::set_process_detaching();
+  return TRUE;
+}
+
 /* Exported Dll functions. */
 int __stdcall NP_GetSignature(struct sig_data *signature)
 {
@@ -671,6 +753,13 @@ int __stdcall NP_RegisterWindowHandle(void *handle)
 {
   logging::log("wrapper", logging::LogLevel::debug, "NP_RegisterWindowHandle, handle: ", handle);
 
+  try {
+    get_main().start();
+  } catch (std::exception & e)
+  {
+    logging::log("main", logging::LogLevel::error, "Failed to start: ", e.what());
+  }
+
   return 0;
 }
 
@@ -678,6 +767,8 @@ int __stdcall NP_UnregisterWindowHandle(void)
 {
   logging::log("wrapper", logging::LogLevel::debug, "NP_UnregisterWindowHandle");
 
+  get_main().stop();
+
   return 0;
 }
 
@@ -700,18 +791,39 @@ int __stdcall NP_RequestData(short dataFields)
 int __stdcall NP_GetData(void *data)
 {
   //logging::log("wrapper", logging::LogLevel::debug, "NP_GetData");
+  PROFILE_ZONE("NP_GetData");
+#ifdef JOY2TIR_ALLOC_COUNT
+  alloc_count::ScopedCounter allocCounter;
+#endif
 
   Main & main = get_main();
+  /* NP_OK and NP_ERR_NO_DATA of NPRESULT above */
+  int result = 0;
   try {
     main.update();
-    main.fill_tir_data(data);
+    if (!main.fill_tir_data(data))
+      result = 5;
   } catch (std::exception & e)
   {
     logging::log("main", logging::LogLevel::error, "Exception in main loop: ", e.what());
   }
 
+#ifdef JOY2TIR_ALLOC_COUNT
+  check_frame_allocs(allocCounter);
+#endif
+  return result;
+}
+
+#ifdef JOY2TIR_ALLOC_COUNT
+int __stdcall JOY2TIR_GetAllocStats(unsigned long long * frames, unsigned long long * badFrames, unsigned long long * badAllocs)
+{
+  auto const & monitor = get_frame_monitor();
+  *frames = monitor.get_frames();
+  *badFrames = monitor.get_bad_frames();
+  *badAllocs = monitor.get_bad_allocs();
   return 0;
 }
+#endif
 
 int __stdcall NP_StopCursor(void)
 {
@@ -23,3 +23,8 @@ extern "C" int __declspec(dllexport) __stdcall NP_StopCursor();
 extern "C" int __declspec(dllexport) __stdcall NP_StartCursor();
 extern "C" int __declspec(dllexport) __stdcall NP_StartDataTransmission();
 extern "C" int __declspec(dllexport) __stdcall NP_StopDataTransmission();
+
+/* Not part of the NaturalPoint API: only exported by builds with allocation accounting (make ALLOC_COUNT=1), for client_sim --alloc-check.
+ * Frames are NP_GetData calls; frames that allocated are counted after warm-up.
+ */
+extern "C" int __declspec(dllexport) __stdcall JOY2TIR_GetAllocStats(unsigned long long * frames, unsigned long long * badFrames, unsigned long long * badAllocs);
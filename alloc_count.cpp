@@ -0,0 +1,150 @@
+#include "alloc_count.hpp"
+
+#ifdef JOY2TIR_ALLOC_COUNT
+
+#include <atomic>
+#include <new>
+#include <cstdlib>
+
+#include <windows.h>
+
+extern "C" void * __real_malloc(size_t size);
+extern "C" void * __real_calloc(size_t num, size_t size);
+extern "C" void * __real_realloc(void * p, size_t size);
+
+namespace alloc_count
+{
+
+namespace
+{
+
+/* Zero-initialized before any dynamic initialization, so allocations made by static constructors are counted too. */
+std::atomic<std::uint64_t> g_totalCount (0);
+std::atomic<DWORD> g_tlsIndex (TLS_OUT_OF_INDEXES);
+
+/* Win32 TLS is used instead of thread_local because emulated TLS allocates on first access. */
+DWORD get_tls_index()
+{
+  auto index = g_tlsIndex.load();
+  if (index != TLS_OUT_OF_INDEXES)
+    return index;
+  auto const newIndex = TlsAlloc();
+  if (!g_tlsIndex.compare_exchange_strong(index, newIndex))
+  {
+    TlsFree(newIndex);
+    return index;
+  }
+  return newIndex;
+}
+
+std::uint64_t * get_thread_counter()
+{
+  auto const index = get_tls_index();
+  if (index == TLS_OUT_OF_INDEXES)
+    return nullptr;
+  auto pCounter = static_cast<std::uint64_t*>(TlsGetValue(index));
+  if (!pCounter)
+  {
+    pCounter = static_cast<std::uint64_t*>(HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(std::uint64_t)));
+    TlsSetValue(index, pCounter);
+  }
+  return pCounter;
+}
+
+void note_allocation()
+{
+  g_totalCount.fetch_add(1, std::memory_order_relaxed);
+  if (auto pCounter = get_thread_counter())
+    ++*pCounter;
+}
+
+} //anonymous
+
+std::uint64_t get_thread_count()
+{
+  auto pCounter = get_thread_counter();
+  return pCounter ? *pCounter : 0;
+}
+
+std::uint64_t get_total_count()
+{
+  return g_totalCount.load(std::memory_order_relaxed);
+}
+
+std::uint64_t FrameMonitor::end_frame(ScopedCounter const & counter, std::uint64_t * pBadFrame)
+{
+  auto const n = counter.get_count();
+  /* Decided by this frame's own number, not by a later load another thread may have advanced */
+  auto const frame = frames_.fetch_add(1, std::memory_order_relaxed) + 1;
+  std::uint64_t badFrame = 0;
+  if (frame > warmupFrames_ && n > 0)
+  {
+    badFrame = badFrames_.fetch_add(1, std::memory_order_relaxed) + 1;
+    badAllocs_.fetch_add(n, std::memory_order_relaxed);
+  }
+  if (pBadFrame)
+    *pBadFrame = badFrame;
+  return n;
+}
+
+FrameMonitor::FrameMonitor(std::uint64_t warmupFrames)
+  : warmupFrames_(warmupFrames), frames_(0), badFrames_(0), badAllocs_(0)
+{}
+
+} //alloc_count
+
+extern "C" void * __wrap_malloc(size_t size)
+{
+  alloc_count::note_allocation();
+  return __real_malloc(size);
+}
+
+extern "C" void * __wrap_calloc(size_t num, size_t size)
+{
+  alloc_count::note_allocation();
+  return __real_calloc(num, size);
+}
+
+extern "C" void * __wrap_realloc(void * p, size_t size)
+{
+  alloc_count::note_allocation();
+  return __real_realloc(p, size);
+}
+
+namespace
+{
+
+void * counted_new(size_t size)
+{
+  alloc_count::note_allocation();
+  if (size == 0)
+    size = 1;
+  if (auto p = __real_malloc(size))
+    return p;
+  throw std::bad_alloc();
+}
+
+} //anonymous
+
+void * operator new(size_t size) { return counted_new(size); }
+void * operator new[](size_t size) { return counted_new(size); }
+void * operator new(size_t size, std::nothrow_t const &) noexcept
+try {
+  return counted_new(size);
+} catch (...)
+{
+  return nullptr;
+}
+void * operator new[](size_t size, std::nothrow_t const &) noexcept
+try {
+  return counted_new(size);
+} catch (...)
+{
+  return nullptr;
+}
+void operator delete(void * p) noexcept { std::free(p); }
+void operator delete[](void * p) noexcept { std::free(p); }
+void operator delete(void * p, std::nothrow_t const &) noexcept { std::free(p); }
+void operator delete[](void * p, std::nothrow_t const &) noexcept { std::free(p); }
+
+#endif
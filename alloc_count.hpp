@@ -0,0 +1,64 @@
+#ifndef ALLOC_COUNT_HPP
+#define ALLOC_COUNT_HPP
+
+/* Allocation accounting.
+ * Compiled out unless JOY2TIR_ALLOC_COUNT is defined (make ALLOC_COUNT=1).
+ * Global operator new/new[] are replaced and malloc/calloc/realloc are intercepted with ld --wrap;
+ * every allocation is counted per thread and process-wide.
+ */
+#ifdef JOY2TIR_ALLOC_COUNT
+
+#include <atomic>
+#include <cstdint>
+
+namespace alloc_count
+{
+
+/* Allocations made by the calling thread so far */
+std::uint64_t get_thread_count();
+/* Allocations made by all threads so far */
+std::uint64_t get_total_count();
+
+/* Counts allocations of the calling thread between construction and get_count() */
+class ScopedCounter
+{
+public:
+  std::uint64_t get_count() const { return get_thread_count() - begin_; }
+
+  ScopedCounter() : begin_(get_thread_count()) {}
+
+private:
+  std::uint64_t begin_;
+};
+
+/* Tracks allocations per frame; frames after warm-up are expected to allocate nothing.
+ * Thread-safe: frames may end on several threads at once (concurrent NP_GetData callers), each counted with its own thread's ScopedCounter.
+ */
+class FrameMonitor
+{
+public:
+  /* Returns number of allocations made during the frame.
+   * pBadFrame gets the number of steady-state frames that allocated, counting this one, if this is one of them, else 0.
+   */
+  std::uint64_t end_frame(ScopedCounter const & counter, std::uint64_t * pBadFrame = nullptr);
+
+  /* Steady-state frames that allocated and allocations made by them */
+  std::uint64_t get_frames() const { return frames_.load(std::memory_order_relaxed); }
+  std::uint64_t get_bad_frames() const { return badFrames_.load(std::memory_order_relaxed); }
+  std::uint64_t get_bad_allocs() const { return badAllocs_.load(std::memory_order_relaxed); }
+  bool is_steady() const { return get_frames() > warmupFrames_; }
+
+  FrameMonitor(std::uint64_t warmupFrames);
+
+private:
+  std::uint64_t warmupFrames_;
+  std::atomic<std::uint64_t> frames_;
+  std::atomic<std::uint64_t> badFrames_;
+  std::atomic<std::uint64_t> badAllocs_;
+};
+
+} //alloc_count
+
+#endif
+
+#endif
@@ -0,0 +1,280 @@
+#include "NPClient.hpp"
+#include "clock.hpp"
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <iostream>
+#include <iomanip>
+#include <stdexcept>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+
+#include <windows.h>
+
+/* Drives the exported NPClient functions the way a game does and measures NP_GetData latency. */
+
+typedef int (__stdcall *NP_GetSignature_t)(struct sig_data *);
+typedef int (__stdcall *NP_QueryVersion_t)(short *);
+typedef int (__stdcall *NP_RegisterWindowHandle_t)(void *);
+typedef int (__stdcall *NP_RegisterProgramProfileID_t)(short);
+typedef int (__stdcall *NP_RequestData_t)(short);
+typedef int (__stdcall *NP_GetData_t)(void *);
+typedef int (__stdcall *NP_void_t)();
+typedef int (__stdcall *JOY2TIR_GetAllocStats_t)(unsigned long long *, unsigned long long *, unsigned long long *);
+
+struct NPClient
+{
+  NP_GetSignature_t getSignature;
+  NP_QueryVersion_t queryVersion;
+  NP_RegisterWindowHandle_t registerWindowHandle;
+  NP_void_t unregisterWindowHandle;
+  NP_RegisterProgramProfileID_t registerProgramProfileID;
+  NP_RequestData_t requestData;
+  NP_GetData_t getData;
+  NP_void_t stopCursor;
+  NP_void_t startCursor;
+  NP_void_t startDataTransmission;
+  NP_void_t stopDataTransmission;
+};
+
+template <class F>
+void load_function(HMODULE hm, char const * name, F & f)
+{
+  f = reinterpret_cast<F>(GetProcAddress(hm, name));
+  if (!f)
+    throw std::runtime_error(std::string("Failed to get address of ") + name);
+}
+
+NPClient load_npclient(HMODULE hm)
+{
+  NPClient c;
+  load_function(hm, "NP_GetSignature", c.getSignature);
+  load_function(hm, "NP_QueryVersion", c.queryVersion);
+  load_function(hm, "NP_RegisterWindowHandle", c.registerWindowHandle);
+  load_function(hm, "NP_UnregisterWindowHandle", c.unregisterWindowHandle);
+  load_function(hm, "NP_RegisterProgramProfileID", c.registerProgramProfileID);
+  load_function(hm, "NP_RequestData", c.requestData);
+  load_function(hm, "NP_GetData", c.getData);
+  load_function(hm, "NP_StopCursor", c.stopCursor);
+  load_function(hm, "NP_StartCursor", c.startCursor);
+  load_function(hm, "NP_StartDataTransmission", c.startDataTransmission);
+  load_function(hm, "NP_StopDataTransmission", c.stopDataTransmission);
+  return c;
+}
+
+struct WorkerData
+{
+  NPClient const * pClient;
+  double rate;
+  std::int64_t endTicks;
+  std::vector<std::int64_t> latencies;
+  unsigned errors;
+  unsigned staleFrames;
+};
+
+/* Sleeps until about 1 ms before the deadline, then spins. */
+void wait_until(std::int64_t deadline)
+{
+  auto const msTicks = get_qpc_frequency() / 1000;
+  while (true)
+  {
+    auto const now = get_qpc_ticks();
+    if (now >= deadline)
+      return;
+    if (deadline - now > 2 * msTicks)
+      Sleep(1);
+    else
+      SwitchToThread();
+  }
+}
+
+DWORD WINAPI worker(LPVOID pv)
+{
+  auto & d = *static_cast<WorkerData*>(pv);
+  auto const period = static_cast<std::int64_t>(get_qpc_frequency() / d.rate);
+  auto next = get_qpc_ticks();
+  short lastFrame = 0;
+  while (next < d.endTicks)
+  {
+    wait_until(next);
+    next += period;
+    tir_data data;
+    auto const begin = get_qpc_ticks();
+    auto const result = d.pClient->getData(&data);
+    auto const end = get_qpc_ticks();
+    d.latencies.push_back(end - begin);
+    if (result != 0)
+      ++d.errors;
+    if (data.frame == lastFrame)
+      ++d.staleFrames;
+    lastFrame = data.frame;
+  }
+  return 0;
+}
+
+std::int64_t filetime_to_100ns(FILETIME const & ft)
+{
+  return (static_cast<std::int64_t>(ft.dwHighDateTime) << 32) | ft.dwLowDateTime;
+}
+
+std::int64_t get_process_cpu_100ns()
+{
+  FILETIME creation, exit, kernel, user;
+  if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user))
+    return 0;
+  return filetime_to_100ns(kernel) + filetime_to_100ns(user);
+}
+
+double percentile_us(std::vector<std::int64_t> const & sorted, double p)
+{
+  if (sorted.empty())
+    return 0.0;
+  auto const i = static_cast<size_t>(p * (sorted.size() - 1));
+  return qpc_ticks_to_us(sorted.at(i));
+}
+
+/* Returns non-zero if steady-state NP_GetData calls allocated, or if the dll does not count allocations */
+int report_allocs(HMODULE hm)
+{
+  auto const getAllocStats = reinterpret_cast<JOY2TIR_GetAllocStats_t>(GetProcAddress(hm, "JOY2TIR_GetAllocStats"));
+  if (!getAllocStats)
+  {
+    std::cout << "Allocation check: the dll is not built with allocation counting (make ALLOC_COUNT=1)" << std::endl;
+    return 1;
+  }
+  unsigned long long frames = 0, badFrames = 0, badAllocs = 0;
+  getAllocStats(&frames, &badFrames, &badAllocs);
+  std::cout << "Allocation check: NP_GetData calls: " << frames << "; steady-state calls that allocated: " << badFrames
+    << "; allocations: " << badAllocs << std::endl;
+  return (frames > 0 && badFrames == 0) ? 0 : 1;
+}
+
+int run(char const * dllPath, double rate, double seconds, int numThreads, bool allocCheck)
+{
+  auto hm = LoadLibraryA(dllPath);
+  if (!hm)
+    throw std::runtime_error(std::string("Failed to load ") + dllPath);
+  auto const client = load_npclient(hm);
+
+  /* Canonical startup sequence */
+  auto const loadBegin = get_qpc_ticks();
+  sig_data sig;
+  client.getSignature(&sig);
+  short version = 0;
+  client.queryVersion(&version);
+  client.registerWindowHandle(NULL);
+  client.registerProgramProfileID(0);
+  short const dataFields = 1 | 2 | 4 | 16 | 32 | 64; //roll, pitch, yaw, x, y, z
+  client.requestData(dataFields);
+  client.stopCursor();
+  client.startDataTransmission();
+  tir_data first;
+  client.getData(&first);
+  auto const loadMs = qpc_ticks_to_ms(get_qpc_ticks() - loadBegin);
+  std::cout << "Version: 0x" << std::hex << version << std::dec << "; startup sequence (incl. first NP_GetData): " << loadMs << " ms" << std::endl;
+
+  auto const expected = static_cast<size_t>(rate * seconds) + 16;
+  std::vector<WorkerData> data (numThreads);
+  auto const endTicks = get_qpc_ticks() + static_cast<std::int64_t>(seconds * get_qpc_frequency());
+  for (auto & d : data)
+  {
+    d.pClient = &client;
+    d.rate = rate;
+    d.endTicks = endTicks;
+    d.latencies.reserve(expected);
+    d.errors = 0;
+    d.staleFrames = 0;
+  }
+
+  timeBeginPeriod(1);
+  auto const cpuBegin = get_process_cpu_100ns();
+  auto const wallBegin = get_qpc_ticks();
+  std::vector<HANDLE> threads;
+  for (auto & d : data)
+  {
+    auto h = CreateThread(NULL, 0, worker, &d, 0, NULL);
+    if (!h)
+      throw std::runtime_error("Failed to create thread");
+    threads.push_back(h);
+  }
+  WaitForMultipleObjects(threads.size(), threads.data(), TRUE, INFINITE);
+  auto const wallMs = qpc_ticks_to_ms(get_qpc_ticks() - wallBegin);
+  auto const cpuMs = (get_process_cpu_100ns() - cpuBegin) / 10000.0;
+  timeEndPeriod(1);
+  for (auto h : threads)
+    CloseHandle(h);
+
+  client.stopDataTransmission();
+  client.startCursor();
+  client.unregisterWindowHandle();
+
+  std::vector<std::int64_t> all;
+  unsigned errors = 0, staleFrames = 0;
+  for (auto const & d : data)
+  {
+    all.insert(all.end(), d.latencies.begin(), d.latencies.end());
+    errors += d.errors;
+    staleFrames += d.staleFrames;
+  }
+  std::sort(all.begin(), all.end());
+  SYSTEM_INFO si;
+  GetSystemInfo(&si);
+  std::cout << std::fixed << std::setprecision(2)
+    << "threads: " << numThreads << "; target rate: " << rate << " Hz per thread"
+    << "; calls: " << all.size() << "; achieved rate: " << all.size() * 1000.0 / wallMs << " Hz total"
+    << "; errors: " << errors << "; repeated frames: " << staleFrames << "\n"
+    << "NP_GetData latency (us): p50: " << percentile_us(all, 0.5)
+    << "; p90: " << percentile_us(all, 0.9)
+    << "; p99: " << percentile_us(all, 0.99)
+    << "; p99.9: " << percentile_us(all, 0.999)
+    << "; max: " << percentile_us(all, 1.0) << "\n"
+    << "CPU: " << cpuMs << " ms in " << wallMs << " ms (" << 100.0 * cpuMs / wallMs << "% of one core, "
+    << 100.0 * cpuMs / (wallMs * si.dwNumberOfProcessors) << "% of " << si.dwNumberOfProcessors << " cores)"
+    << std::endl;
+
+  auto const allocResult = allocCheck ? report_allocs(hm) : 0;
+  FreeLibrary(hm);
+  return (errors || allocResult) ? 1 : 0;
+}
+
+int main(int argc, char** argv)
+{
+  auto const allocCheck = argc > 1 && std::strcmp(argv[1], "--alloc-check") == 0;
+  if (allocCheck)
+  {
+    --argc;
+    ++argv;
+  }
+  if (argc == 1)
+  {
+    std::cout
+      << "Usage: " << argv[0] << " [--alloc-check] dll_path [rate_hz] [seconds] [threads]\n"
+      << "Loads dll_path, replays the game call sequence and calls NP_GetData at rate_hz (default 60) from each thread.\n"
+      << "Set JOY2TIR_CONFIG to a config with \"mock\" joysticks (e.g. client_sim.json) to run without devices.\n"
+      << "--alloc-check: fail if steady-state NP_GetData calls allocate; needs a dll built with make ALLOC_COUNT=1.\n"
+      << "  Uses client_sim.json from the working directory unless JOY2TIR_CONFIG is set.\n"
+      << "  With JOY2TIR_ALLOC_ASSERT set, the dll aborts on the first offending call instead.\n";
+    return 0;
+  }
+  auto const dllPath = argv[1];
+  auto const rate = (argc > 2) ? atof(argv[2]) : 60.0;
+  auto const seconds = (argc > 3) ? atof(argv[3]) : 10.0;
+  auto const numThreads = (argc > 4) ? atoi(argv[4]) : 1;
+  if (rate <= 0.0 || seconds <= 0.0 || numThreads <= 0)
+  {
+    std::cout << "Invalid parameters" << std::endl;
+    return 1;
+  }
+  try {
+    /* The dll shares the C runtime, so it sees this */
+    if (allocCheck && !std::getenv("JOY2TIR_CONFIG"))
+      _putenv("JOY2TIR_CONFIG=client_sim.json");
+    return run(dllPath, rate, seconds, numThreads, allocCheck);
+  } catch (std::exception & e)
+  {
+    std::cout << "Error: " << e.what() << std::endl;
+    return 1;
+  }
+}
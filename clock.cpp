@@ -0,0 +1,31 @@
+#include "clock.hpp"
+
+#include <windows.h>
+
+std::int64_t get_qpc_ticks()
+{
+  LARGE_INTEGER li;
+  QueryPerformanceCounter(&li);
+  return li.QuadPart;
+}
+
+std::int64_t get_qpc_frequency()
+{
+  static std::int64_t const frequency = []()
+  {
+    LARGE_INTEGER li;
+    QueryPerformanceFrequency(&li);
+    return static_cast<std::int64_t>(li.QuadPart);
+  }();
+  return frequency;
+}
+
+double qpc_ticks_to_us(std::int64_t ticks)
+{
+  return static_cast<double>(ticks) * 1e6 / static_cast<double>(get_qpc_frequency());
+}
+
+double qpc_ticks_to_ms(std::int64_t ticks)
+{
+  return static_cast<double>(ticks) * 1e3 / static_cast<double>(get_qpc_frequency());
+}
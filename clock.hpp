@@ -0,0 +1,12 @@
+#ifndef CLOCK_HPP
+#define CLOCK_HPP
+
+#include <cstdint>
+
+/* High resolution clock (QueryPerformanceCounter) helpers */
+std::int64_t get_qpc_ticks();
+std::int64_t get_qpc_frequency();
+double qpc_ticks_to_us(std::int64_t ticks);
+double qpc_ticks_to_ms(std::int64_t ticks);
+
+#endif
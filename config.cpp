@@ -0,0 +1,119 @@
+#include "config.hpp"
+#include "path.hpp"
+#include "util.hpp"
+#include "timing.hpp"
+#include "logging.hpp"
+
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <cstdlib>
+
+std::string get_config_path()
+{
+  std::string configPath;
+  if (auto envConfigPath = std::getenv("JOY2TIR_CONFIG"))
+  {
+    configPath = envConfigPath;
+  }
+  else
+  {
+    configPath = get_dir_to_module();
+    append_to_path(configPath, "NPClient.json");
+  }
+  return configPath;
+}
+
+nlohmann::json load_config(std::string const & path)
+{
+  auto & timer = startup_timer();
+  std::string configStr;
+  {
+    ScopedPhase phase (timer, "configRead");
+    std::ifstream configStream (path);
+    if (!configStream.is_open())
+      throw std::runtime_error(stream_to_str("Failed to load config from: ", path));
+    configStr.assign(std::istreambuf_iterator<char>(configStream), std::istreambuf_iterator<char>());
+  }
+  ScopedPhase phase (timer, "configParse");
+  return nlohmann::json::parse(configStr);
+}
+
+/* ConfigWatcher */
+ConfigWatcher::ConfigWatcher(std::string const & path, callback_t const & onChange, HANDLE hWake, callback_t const & onWake, DWORD settleMs)
+  : path_(path), onChange_(onChange), hWake_(hWake), onWake_(onWake), settleMs_(settleMs), hChange_(INVALID_HANDLE_VALUE), stamp_(0), stop_(), spThread_()
+{
+  auto const pos = path_.find_last_of("\\/");
+  auto const dir = (pos == std::string::npos) ? std::string(".") : path_.substr(0, pos);
+  hChange_ = FindFirstChangeNotificationA(dir.c_str(), FALSE, FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_FILE_NAME);
+  if (hChange_ == INVALID_HANDLE_VALUE)
+    throw std::runtime_error(stream_to_str("Failed to watch directory ", dir, ", error = ", GetLastError()));
+  stamp_ = get_stamp_();
+  spThread_.reset(new Thread([this]() { run_(); }));
+  spThread_->set_priority(THREAD_PRIORITY_BELOW_NORMAL);
+}
+
+ConfigWatcher::~ConfigWatcher()
+{
+  stop_.set();
+  spThread_.reset();
+  FindCloseChangeNotification(hChange_);
+}
+
+void ConfigWatcher::run_()
+{
+  HANDLE const handles[] = { stop_.get_handle(), hChange_, hWake_ };
+  DWORD const numHandles = (hWake_ != NULL) ? 3 : 2;
+  bool changed = false;
+  while (true)
+  {
+    auto const result = WaitForMultipleObjects(numHandles, handles, FALSE, changed ? settleMs_ : INFINITE);
+    if (result == WAIT_OBJECT_0)
+      return;
+    else if (result == WAIT_OBJECT_0 + 1)
+    {
+      changed = true;
+      if (!FindNextChangeNotification(hChange_))
+      {
+        logging::log("main", logging::LogLevel::error, "Stopped watching config ", path_, ", error = ", GetLastError());
+        return;
+      }
+    }
+    else if (result == WAIT_OBJECT_0 + 2)
+      onWake_();
+    else if (result == WAIT_TIMEOUT)
+    {
+      changed = false;
+      check_();
+    }
+    else
+    {
+      logging::log("main", logging::LogLevel::error, "Stopped watching config ", path_, ", error = ", GetLastError());
+      return;
+    }
+  }
+}
+
+void ConfigWatcher::check_()
+{
+  /* Notifications are for the whole directory */
+  auto const stamp = get_stamp_();
+  if (stamp == stamp_)
+    return;
+  stamp_ = stamp;
+  try {
+    onChange_();
+  } catch (std::exception & e)
+  {
+    logging::log("main", logging::LogLevel::error, "Failed to reload config from ", path_, " (", e.what(), ")");
+  }
+}
+
+std::uint64_t ConfigWatcher::get_stamp_() const
+{
+  WIN32_FILE_ATTRIBUTE_DATA data;
+  if (!GetFileAttributesExA(path_.c_str(), GetFileExInfoStandard, &data))
+    return 0;
+  auto const time = (static_cast<std::uint64_t>(data.ftLastWriteTime.dwHighDateTime) << 32) | data.ftLastWriteTime.dwLowDateTime;
+  return time ^ data.nFileSizeLow;
+}
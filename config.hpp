@@ -0,0 +1,64 @@
+#ifndef CONFIG_HPP
+#define CONFIG_HPP
+
+#include "thread.hpp"
+
+#include "nlohmann/json.hpp"
+
+#include <string>
+#include <memory>
+#include <cstdint>
+#include <functional>
+
+#include <windows.h>
+
+/* Config helpers */
+template <class R, class C, class K>
+R get_d(C const & config, K&& key, R&& dfault)
+try {
+  return config.at(key).template get<R>();
+} catch (nlohmann::json::out_of_range const & e)
+{
+  return dfault;
+}
+
+/* JOY2TIR_CONFIG if set, else NPClient.json next to the module */
+std::string get_config_path();
+
+/* Throws if the file can not be read or parsed */
+nlohmann::json load_config(std::string const & path);
+
+/* Watches a config file from a background thread (config "watchConfig").
+ * Directory change notifications are filtered by the file's last write time and size, and onChange is called on that thread
+ * once the file has been quiet for settleMs, since editors often save in several steps. Exceptions of onChange are logged.
+ * If hWake is given, onWake is also called on that thread each time it is signaled.
+ * The destructor waits for the thread, so in a DLL destroy it before unloading (Main::stop()), not from a static destructor.
+ */
+class ConfigWatcher
+{
+public:
+  using callback_t = std::function<void()>;
+
+  ConfigWatcher(std::string const & path, callback_t const & onChange, HANDLE hWake = NULL, callback_t const & onWake = callback_t(), DWORD settleMs = 200);
+  ConfigWatcher(ConfigWatcher const &) =delete;
+  ConfigWatcher & operator=(ConfigWatcher const &) =delete;
+  ~ConfigWatcher();
+
+private:
+  void run_();
+  void check_();
+  /* Last write time and size, 0 if the file can not be read */
+  std::uint64_t get_stamp_() const;
+
+  std::string path_;
+  callback_t onChange_;
+  HANDLE hWake_;
+  callback_t onWake_;
+  DWORD settleMs_;
+  HANDLE hChange_;
+  std::uint64_t stamp_;
+  Event stop_;
+  std::unique_ptr<Thread> spThread_;
+};
+
+#endif
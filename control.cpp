@@ -0,0 +1,199 @@
+#include "control.hpp"
+#include "pipeline.hpp"
+#include "config.hpp"
+#include "logging.hpp"
+#include "util.hpp"
+
+#include <vector>
+#include <stdexcept>
+#include <cstring>
+
+/* Vista and later; CreateNamedPipe fails on XP, which leaves the control channel off */
+#ifndef PIPE_REJECT_REMOTE_CLIENTS
+#define PIPE_REJECT_REMOTE_CLIENTS 0x00000008
+#endif
+
+/* ControlServer */
+ControlServer::ControlServer(std::string const & name, handler_t const & handler)
+  : path_("\\\\.\\pipe\\" + name), handler_(handler), hPipe_(INVALID_HANDLE_VALUE), overlapped_(), ioDone_(true, false), stop_(), spThread_()
+{
+  if (name.empty())
+    throw std::runtime_error("Control pipe name is empty");
+  hPipe_ = CreateNamedPipeA(
+    path_.c_str(),
+    PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED | FILE_FLAG_FIRST_PIPE_INSTANCE,
+    PIPE_TYPE_MESSAGE | PIPE_READMODE_MESSAGE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS,
+    1, bufferSize_, bufferSize_, 0, NULL
+  );
+  if (hPipe_ == INVALID_HANDLE_VALUE)
+    throw std::runtime_error(stream_to_str("Failed to create control pipe ", path_, ", error = ", GetLastError()));
+  std::memset(&overlapped_, 0, sizeof(overlapped_));
+  overlapped_.hEvent = ioDone_.get_handle();
+  spThread_.reset(new Thread([this]() { run_(); }));
+  logging::log("control", logging::LogLevel::info, "Listening for commands on ", path_);
+}
+
+ControlServer::~ControlServer()
+{
+  stop_.set();
+  spThread_.reset();
+  CloseHandle(hPipe_);
+}
+
+void ControlServer::run_()
+{
+  while (true)
+  {
+    DWORD transferred = 0;
+    if (wait_io_(ConnectNamedPipe(hPipe_, &overlapped_), transferred))
+      serve_client_();
+    else
+    {
+      auto const error = GetLastError();
+      if (error != ERROR_OPERATION_ABORTED)
+      {
+        logging::log("control", logging::LogLevel::error, "Failed to accept control client, error = ", error);
+        /* Do not spin on a persistent error */
+        if (stop_.wait(1000))
+          return;
+      }
+    }
+    DisconnectNamedPipe(hPipe_);
+    if (stop_.wait(0))
+      return;
+  }
+}
+
+void ControlServer::serve_client_()
+{
+  std::vector<char> buffer (bufferSize_);
+  std::string message;
+  while (true)
+  {
+    DWORD transferred = 0;
+    auto const read = wait_io_(ReadFile(hPipe_, buffer.data(), bufferSize_, NULL, &overlapped_), transferred);
+    auto const error = read ? ERROR_SUCCESS : GetLastError();
+    if (!read && error != ERROR_MORE_DATA)
+    {
+      if (error != ERROR_BROKEN_PIPE && error != ERROR_OPERATION_ABORTED)
+        logging::log("control", logging::LogLevel::error, "Failed to read control message, error = ", error);
+      return;
+    }
+    message.append(buffer.data(), transferred);
+    if (message.size() > maxMessageSize_)
+    {
+      logging::log("control", logging::LogLevel::error, "Control message is longer than ", maxMessageSize_, " bytes, disconnecting");
+      return;
+    }
+    /* The rest of the message follows */
+    if (!read)
+      continue;
+    auto const reply = handle_(message);
+    message.clear();
+    if (!wait_io_(WriteFile(hPipe_, reply.data(), reply.size(), NULL, &overlapped_), transferred))
+    {
+      auto const writeError = GetLastError();
+      if (writeError != ERROR_BROKEN_PIPE && writeError != ERROR_NO_DATA && writeError != ERROR_OPERATION_ABORTED)
+        logging::log("control", logging::LogLevel::error, "Failed to write control reply, error = ", writeError);
+      return;
+    }
+  }
+}
+
+bool ControlServer::wait_io_(BOOL started, DWORD & transferred)
+{
+  transferred = 0;
+  if (!started)
+  {
+    auto const error = GetLastError();
+    /* A client connected before ConnectNamedPipe() */
+    if (error == ERROR_PIPE_CONNECTED)
+      return true;
+    if (error == ERROR_IO_PENDING)
+    {
+      HANDLE const handles[] = { stop_.get_handle(), ioDone_.get_handle() };
+      if (WaitForMultipleObjects(2, handles, FALSE, INFINITE) != WAIT_OBJECT_0 + 1)
+      {
+        CancelIo(hPipe_);
+        GetOverlappedResult(hPipe_, &overlapped_, &transferred, TRUE);
+        SetLastError(ERROR_OPERATION_ABORTED);
+        return false;
+      }
+    }
+    else if (error != ERROR_MORE_DATA)
+      return false;
+  }
+  /* Fails with ERROR_MORE_DATA if a message did not fit, with transferred set */
+  return GetOverlappedResult(hPipe_, &overlapped_, &transferred, FALSE) != FALSE;
+}
+
+std::string ControlServer::handle_(std::string const & message) const
+{
+  nlohmann::json reply;
+  try {
+    reply = handler_(nlohmann::json::parse(message));
+    reply["ok"] = true;
+  } catch (std::exception & e)
+  {
+    reply = nlohmann::json::object();
+    reply["ok"] = false;
+    reply["error"] = e.what();
+  }
+  logging::log("control", logging::LogLevel::debug, "Command: ", message, "; reply: ", reply);
+  return reply.dump();
+}
+
+/* Commands */
+static PoseMemberID::type get_pose_member_id(nlohmann::json const & request)
+{
+  auto const name = request.at("tirAxis").get<std::string>();
+  auto const poseMemberID = PoseMemberID::from_cstr(name.c_str());
+  if (poseMemberID == PoseMemberID::num)
+    throw std::runtime_error(stream_to_str("Unknown TIR axis: '", name, "'"));
+  return poseMemberID;
+}
+
+static Pipeline & get_pipeline(Pipeline * pPipeline)
+{
+  if (pPipeline == NULL)
+    throw std::runtime_error("Devices are not read in this process (the pose comes from the pose server)");
+  return *pPipeline;
+}
+
+nlohmann::json handle_control_command(nlohmann::json const & request, Pipeline * pPipeline)
+{
+  auto const cmd = request.at("cmd").get<std::string>();
+  auto reply = nlohmann::json::object();
+  if (cmd == "setLogLevel")
+  {
+    auto const levelName = request.at("level").get<std::string>();
+    auto const level = logging::n2ll(levelName);
+    if (levelName != logging::ll2n(level))
+      throw std::runtime_error(stream_to_str("Unknown log level: '", levelName, "'"));
+    reply["previous"] = logging::ll2n(logging::root_logger().get_level());
+    logging::root_logger().set_level(level);
+    logging::log("control", logging::LogLevel::info, "Setting log level to ", levelName);
+  }
+  else if (cmd == "setLimits")
+  {
+    auto const poseMemberID = get_pose_member_id(request);
+    auto const & l = request.at("limits");
+    auto const limits = AxisPoseFactory::limits_t(l.at(0).get<float>(), l.at(1).get<float>());
+    auto & pipeline = get_pipeline(pPipeline);
+    auto const previous = pipeline.get_limits(poseMemberID);
+    pipeline.set_limits(poseMemberID, limits);
+    reply["previous"] = { previous.first, previous.second };
+  }
+  else if (cmd == "getLimits")
+  {
+    auto const limits = get_pipeline(pPipeline).get_limits(get_pose_member_id(request));
+    reply["limits"] = { limits.first, limits.second };
+  }
+  else if (cmd == "recenter")
+    get_pipeline(pPipeline).request_recenter(get_d<bool>(request, "reset", false));
+  else if (cmd == "stats")
+    get_pipeline(pPipeline).request_stats();
+  else
+    throw std::runtime_error(stream_to_str("Unknown command: '", cmd, "'"));
+  return reply;
+}
@@ -0,0 +1,62 @@
+#ifndef CONTROL_HPP
+#define CONTROL_HPP
+
+#include "thread.hpp"
+
+#include "nlohmann/json.hpp"
+
+#include <string>
+#include <memory>
+#include <functional>
+
+#include <windows.h>
+
+class Pipeline;
+
+/* Local control endpoint for live tuning (config "controlPipe").
+ * A background thread serves the named pipe \\.\pipe\<name>, one client at a time; each message is a JSON command object and gets one JSON reply.
+ * The handler runs on that thread, so it must only touch state the sampling path reads lock-free.
+ * The destructor waits for the thread, so in a DLL destroy it before unloading (Main::stop()), not from a static destructor.
+ */
+class ControlServer
+{
+public:
+  using handler_t = std::function<nlohmann::json(nlohmann::json const &)>;
+
+  /* Throws if the pipe can not be created, e.g. because another process serves the same name */
+  ControlServer(std::string const & name, handler_t const & handler);
+  ControlServer(ControlServer const &) =delete;
+  ControlServer & operator=(ControlServer const &) =delete;
+  ~ControlServer();
+
+private:
+  void run_();
+  void serve_client_();
+  /* Returns false if stopped or the I/O failed */
+  bool wait_io_(BOOL started, DWORD & transferred);
+  std::string handle_(std::string const & message) const;
+
+  static DWORD const bufferSize_ = 4096;
+  /* Longer requests are rejected */
+  static std::size_t const maxMessageSize_ = 65536;
+  std::string path_;
+  handler_t handler_;
+  HANDLE hPipe_;
+  OVERLAPPED overlapped_;
+  Event ioDone_;
+  Event stop_;
+  std::unique_ptr<Thread> spThread_;
+};
+
+/* Commands shared by the client DLLs and the pose server:
+ *   {"cmd": "setLogLevel", "level": "DEBUG"}
+ *   {"cmd": "setLimits", "tirAxis": "yaw", "limits": [-90, 90]}
+ *   {"cmd": "getLimits", "tirAxis": "yaw"}
+ *   {"cmd": "recenter"}, {"cmd": "recenter", "reset": true}
+ *   {"cmd": "stats"} (logged by the next update)
+ * pPipeline is NULL if the pose is read from the pose server; the pipeline commands then fail.
+ * Throws on unknown or malformed commands.
+ */
+nlohmann::json handle_control_command(nlohmann::json const & request, Pipeline * pPipeline);
+
+#endif
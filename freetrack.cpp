@@ -0,0 +1,217 @@
+#include "freetrack.hpp"
+#include "util.hpp"
+#include "logging.hpp"
+#include "profiler.hpp"
+#include "clock.hpp"
+
+#include <stdexcept>
+#include <atomic>
+#include <cstring>
+#include <cstddef>
+
+/* FreeTrackJoystick */
+float FreeTrackJoystick::get_axis_value(AxisID::type axisID) const
+{
+  return axes_.at(axisID);
+}
+
+void FreeTrackJoystick::update()
+{
+  PROFILE_ZONE("FreeTrackJoystick::update");
+  if (pHeap_ == NULL && !open_())
+    return;
+  std::uint32_t dataID;
+  pose_t pose;
+  read_(dataID, pose);
+  if (dataID == lastDataID_)
+    return;
+  /* Accept the copy only if nothing changed while making it */
+  for (int i = 0; i < maxRetries_; ++i)
+  {
+    std::uint32_t dataID2;
+    pose_t pose2;
+    read_(dataID2, pose2);
+    if (dataID2 == dataID && pose2 == pose)
+    {
+      lastDataID_ = dataID;
+      set_axes_(pose);
+      return;
+    }
+    dataID = dataID2;
+    pose = pose2;
+  }
+  if (read_locked_(dataID, pose))
+  {
+    lastDataID_ = dataID;
+    set_axes_(pose);
+  }
+}
+
+std::uint64_t FreeTrackJoystick::get_locked_reads() const
+{
+  return lockedReads_;
+}
+
+FreeTrackJoystick::FreeTrackJoystick(bool useRaw, double translationRange, double rotationRange)
+  : useRaw_(useRaw), translationScale_(0.0f), rotationScale_(0.0f),
+    hMapping_(NULL), hMutex_(NULL), pHeap_(NULL), lastDataID_(0), nextOpen_(0), lockedReads_(0), axes_()
+{
+  if (translationRange <= 0.0 || rotationRange <= 0.0)
+    throw std::runtime_error(stream_to_str("Invalid FreeTrack pose ranges: translation: ", translationRange, "; rotation: ", rotationRange));
+  double const pi = 3.14159265358979323846;
+  /* mm -> cm, radians -> degrees */
+  translationScale_ = static_cast<float>(0.1 / translationRange);
+  rotationScale_ = static_cast<float>(180.0 / (pi * rotationRange));
+  axes_.fill(0.0f);
+  if (!open_())
+    logging::log("joystick", logging::LogLevel::info, "FreeTrack shared memory is not available yet");
+}
+
+FreeTrackJoystick::~FreeTrackJoystick()
+{
+  close_();
+  logging::log("joystick", logging::LogLevel::debug, "FreeTrack reads that needed the mutex: ", lockedReads_);
+}
+
+bool FreeTrackJoystick::open_()
+{
+  auto const now = get_qpc_ticks();
+  if (now < nextOpen_)
+    return false;
+  nextOpen_ = now + static_cast<std::int64_t>(reopenPeriodMs_ * get_qpc_frequency() / 1000.0);
+  hMapping_ = OpenFileMappingA(FILE_MAP_READ, FALSE, freetrackHeapName);
+  if (hMapping_ == NULL)
+    return false;
+  pHeap_ = static_cast<FTHeap const volatile *>(MapViewOfFile(hMapping_, FILE_MAP_READ, 0, 0, sizeof(FTHeap)));
+  if (pHeap_ == NULL)
+  {
+    logging::log("joystick", logging::LogLevel::error, "Failed to map ", freetrackHeapName, ", error = ", GetLastError());
+    close_();
+    return false;
+  }
+  /* Only needed as a fallback; readers without it still work */
+  hMutex_ = OpenMutexA(SYNCHRONIZE, FALSE, freetrackMutexName);
+  lastDataID_ = pHeap_->data.DataID - 1;
+  logging::log("joystick", logging::LogLevel::info, "Opened FreeTrack shared memory", (hMutex_ ? "" : " (no mutex)"));
+  return true;
+}
+
+void FreeTrackJoystick::close_()
+{
+  if (pHeap_ != NULL)
+    UnmapViewOfFile(const_cast<FTHeap const *>(pHeap_));
+  if (hMapping_ != NULL)
+    CloseHandle(hMapping_);
+  if (hMutex_ != NULL)
+    CloseHandle(hMutex_);
+  pHeap_ = NULL;
+  hMapping_ = NULL;
+  hMutex_ = NULL;
+}
+
+void FreeTrackJoystick::read_(std::uint32_t & dataID, pose_t & pose) const
+{
+  auto const & d = pHeap_->data;
+  dataID = d.DataID;
+  if (useRaw_)
+    pose = pose_t{{ d.RawX, d.RawY, d.RawZ, d.RawYaw, d.RawPitch, d.RawRoll }};
+  else
+    pose = pose_t{{ d.X, d.Y, d.Z, d.Yaw, d.Pitch, d.Roll }};
+}
+
+bool FreeTrackJoystick::read_locked_(std::uint32_t & dataID, pose_t & pose)
+{
+  if (hMutex_ == NULL)
+    return false;
+  auto const result = WaitForSingleObject(hMutex_, 1);
+  if (result != WAIT_OBJECT_0 && result != WAIT_ABANDONED)
+    return false;
+  read_(dataID, pose);
+  ReleaseMutex(hMutex_);
+  ++lockedReads_;
+  return true;
+}
+
+void FreeTrackJoystick::set_axes_(pose_t const & pose)
+{
+  axes_[AxisID::x] = pose[0] * translationScale_;
+  axes_[AxisID::y] = pose[1] * translationScale_;
+  axes_[AxisID::z] = pose[2] * translationScale_;
+  axes_[AxisID::rx] = pose[3] * rotationScale_;
+  axes_[AxisID::ry] = pose[4] * rotationScale_;
+  axes_[AxisID::rz] = pose[5] * rotationScale_;
+}
+
+void pose_to_ftdata(Pose const & pose, std::uint32_t dataID, FTData & data)
+{
+  float const pi = 3.14159265358979323846f;
+  float const d2r = pi / 180.0f;
+  data.DataID = dataID;
+  data.Yaw = data.RawYaw = pose.yaw * d2r;
+  data.Pitch = data.RawPitch = pose.pitch * d2r;
+  data.Roll = data.RawRoll = pose.roll * d2r;
+  data.X = data.RawX = pose.x * 10.0f;
+  data.Y = data.RawY = pose.y * 10.0f;
+  data.Z = data.RawZ = pose.z * 10.0f;
+}
+
+/* FreeTrackPoseSink */
+void FreeTrackPoseSink::put_pose(Pose const & pose)
+{
+  PROFILE_ZONE("FreeTrackPoseSink::put_pose");
+  /* WAIT_ABANDONED (a tracker died holding the mutex) also gives ownership, which has to be released */
+  auto const result = WaitForSingleObject(hMutex_, 0);
+  if (result != WAIT_OBJECT_0 && result != WAIT_ABANDONED)
+  {
+    ++skipped_;
+    return;
+  }
+  FTData data;
+  std::memset(&data, 0, sizeof(data));
+  pose_to_ftdata(pose, ++dataID_, data);
+  auto const pData = const_cast<FTData *>(&pHeap_->data);
+  auto const offset = offsetof(FTData, CamWidth);
+  std::memcpy(reinterpret_cast<char *>(pData) + offset, reinterpret_cast<char const *>(&data) + offset, sizeof(data) - offset);
+  std::atomic_thread_fence(std::memory_order_release);
+  pHeap_->data.DataID = data.DataID;
+  ReleaseMutex(hMutex_);
+}
+
+std::uint64_t FreeTrackPoseSink::get_skipped() const
+{
+  return skipped_;
+}
+
+FreeTrackPoseSink::FreeTrackPoseSink() : hMapping_(NULL), hMutex_(NULL), pHeap_(NULL), dataID_(0), skipped_(0)
+{
+  hMapping_ = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, sizeof(FTHeap), freetrackHeapName);
+  if (hMapping_ == NULL)
+    throw std::runtime_error(stream_to_str("Failed to create ", freetrackHeapName, ", error = ", GetLastError()));
+  if (GetLastError() == ERROR_ALREADY_EXISTS)
+    logging::log("output", logging::LogLevel::info, freetrackHeapName, " already exists, another tracker may be writing to it");
+  pHeap_ = static_cast<FTHeap volatile *>(MapViewOfFile(hMapping_, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(FTHeap)));
+  if (pHeap_ == NULL)
+  {
+    auto const error = GetLastError();
+    CloseHandle(hMapping_);
+    throw std::runtime_error(stream_to_str("Failed to map ", freetrackHeapName, ", error = ", error));
+  }
+  hMutex_ = CreateMutexA(NULL, FALSE, freetrackMutexName);
+  if (hMutex_ == NULL)
+  {
+    auto const error = GetLastError();
+    UnmapViewOfFile(const_cast<FTHeap *>(pHeap_));
+    CloseHandle(hMapping_);
+    throw std::runtime_error(stream_to_str("Failed to create ", freetrackMutexName, ", error = ", error));
+  }
+  dataID_ = pHeap_->data.DataID;
+  logging::log("output", logging::LogLevel::info, "Publishing poses to FreeTrack shared memory");
+}
+
+FreeTrackPoseSink::~FreeTrackPoseSink()
+{
+  logging::log("output", logging::LogLevel::info, "FreeTrack output skipped ", skipped_, " poses while the mutex was held");
+  CloseHandle(hMutex_);
+  UnmapViewOfFile(const_cast<FTHeap *>(pHeap_));
+  CloseHandle(hMapping_);
+}
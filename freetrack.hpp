@@ -0,0 +1,116 @@
+#ifndef FREETRACK_HPP
+#define FREETRACK_HPP
+
+#include "joystick.hpp"
+#include "pose.hpp"
+
+#include <array>
+#include <cstdint>
+
+#include <windows.h>
+
+/* FreeTrack shared memory, as published by FreeTrack and opentrack */
+char const * const freetrackHeapName = "FT_SharedMem";
+char const * const freetrackMutexName = "FT_Mutext";
+
+/* Angles are in radians, positions in mm. The writer increments DataID after each update. */
+struct FTData
+{
+  std::uint32_t DataID;
+  std::int32_t CamWidth;
+  std::int32_t CamHeight;
+  /* Pose after smoothing, curves etc. */
+  float Yaw;
+  float Pitch;
+  float Roll;
+  float X;
+  float Y;
+  float Z;
+  /* Raw pose */
+  float RawYaw;
+  float RawPitch;
+  float RawRoll;
+  float RawX;
+  float RawY;
+  float RawZ;
+  /* Raw points, sorted by Y, origin at top left */
+  float X1, Y1, X2, Y2, X3, Y3, X4, Y4;
+};
+
+struct FTHeap
+{
+  FTData data;
+  std::int32_t GameID;
+  union
+  {
+    unsigned char table[8];
+    std::int32_t table_ints[2];
+  };
+  std::int32_t GameID2;
+};
+
+/* Pose read from FreeTrack shared memory, exposed as axes: x, y, z are position / translationRange (cm), rx, ry, rz are yaw, pitch, roll / rotationRange (degrees).
+ * The region is mapped read-only once; each update copies the pose without taking FT_Mutext, and accepts a copy only if DataID and the data are stable across two reads.
+ * The mutex is only taken when the lock-free read keeps failing. If no tracker is running, the region is looked for again once a second.
+ */
+class FreeTrackJoystick : public Joystick, public Updated
+{
+public:
+  virtual float get_axis_value(AxisID::type axisID) const override;
+  virtual void update() override;
+  std::uint64_t get_locked_reads() const;
+
+  FreeTrackJoystick(bool useRaw, double translationRange = 50.0, double rotationRange = 180.0);
+  FreeTrackJoystick(FreeTrackJoystick const &) =delete;
+  FreeTrackJoystick & operator=(FreeTrackJoystick const &) =delete;
+  ~FreeTrackJoystick();
+
+private:
+  typedef std::array<float, 6> pose_t;
+
+  bool open_();
+  void close_();
+  void read_(std::uint32_t & dataID, pose_t & pose) const;
+  bool read_locked_(std::uint32_t & dataID, pose_t & pose);
+  void set_axes_(pose_t const & pose);
+
+  static int const maxRetries_ = 4;
+  static double constexpr reopenPeriodMs_ = 1000.0;
+  bool useRaw_;
+  float translationScale_;
+  float rotationScale_;
+  HANDLE hMapping_;
+  HANDLE hMutex_;
+  FTHeap const volatile * pHeap_;
+  std::uint32_t lastDataID_;
+  std::int64_t nextOpen_;
+  std::uint64_t lockedReads_;
+  std::array<float, AxisID::num> axes_;
+};
+
+/* Fills pose members of data: degrees to radians, centimeters to millimeters; raw pose is the same as pose */
+void pose_to_ftdata(Pose const & pose, std::uint32_t dataID, FTData & data);
+
+/* Publishes poses to FreeTrack shared memory, for games that use the FreeTrack protocol through FreeTrackClient.dll.
+ * FT_Mutext is only tried: if a reader holds it, the pose is skipped instead of waited for. DataID is written last, so lock-free readers can detect torn copies.
+ */
+class FreeTrackPoseSink : public PoseSink
+{
+public:
+  virtual void put_pose(Pose const & pose) override;
+  std::uint64_t get_skipped() const;
+
+  FreeTrackPoseSink();
+  FreeTrackPoseSink(FreeTrackPoseSink const &) =delete;
+  FreeTrackPoseSink & operator=(FreeTrackPoseSink const &) =delete;
+  ~FreeTrackPoseSink();
+
+private:
+  HANDLE hMapping_;
+  HANDLE hMutex_;
+  FTHeap volatile * pHeap_;
+  std::uint32_t dataID_;
+  std::uint64_t skipped_;
+};
+
+#endif
@@ -2,14 +2,26 @@
 #include "util.hpp"
 #include "guid.hpp"
 #include "logging.hpp"
+#include "profiler.hpp"
+#include "timing.hpp"
+#include "clock.hpp"
+#include "trace.hpp"
+#include "simd.hpp"
 
 #include <iostream>
 #include <sstream>
 #include <algorithm>
 #include <cassert>
+#include <cmath>
 
 /* API-independent */
-decltype(AxisID::names_) AxisID::names_ = {"x", "y", "z", "rx", "ry", "rz", "u", "v"};
+decltype(AxisID::names_) AxisID::names_ = {
+  "x", "y", "z", "rx", "ry", "rz", "u", "v",
+  "vx", "vy", "vz", "vrx", "vry", "vrz", "vu", "vv",
+  "ax", "ay", "az", "arx", "ary", "arz", "au", "av",
+  "fx", "fy", "fz", "frx", "fry", "frz", "fu", "fv"
+};
+AxisID::mask_t constexpr AxisID::all;
 
 char const * AxisID::to_cstr(AxisID::type id)
 {
@@ -186,40 +198,64 @@ float LegacyJoystick::get_axis_value(AxisID::type axisID) const
 
 void LegacyJoystick::update()
 {
-  init_();
+  PROFILE_ZONE("LegacyJoystick::update");
+  if (!ready_ && !probe_())
+    return;
+  if (flags_ == 0)
+    return;
   JOYINFOEX ji;
   auto const sji = sizeof(ji);
   memset(&ji, 0, sji);
   ji.dwSize = sji;
-  ji.dwFlags = JOY_RETURNALL;
+  ji.dwFlags = flags_;
   auto mmr = joyGetPosEx(joyID_, &ji);
   if (JOYERR_NOERROR != mmr)
   {
     ready_ = false;
-    throw std::runtime_error(stream_to_str("Cannot get joystick info (id: ", joyID_, "; error: ", mmsyserr_to_cstr(mmr), ")"));
+    nextProbe_ = get_qpc_ticks() + reprobePeriod_;
+    throw std::runtime_error(stream_to_str("Cannot get joystick info (id: ", joyID_, "; error: ", mmsyserr_to_cstr(mmr), "), will probe again every ", qpc_ticks_to_ms(reprobePeriod_), " ms"));
   }
+  for (auto const & u : used_)
+  {
+    auto const & l = nativeLimits_.at(u.second);
+    axes_.at(u.first) = lerp<DWORD, float>(get_pos_from_joyinfoex(ji, u.second), l.first, l.second, -1.0f, 1.0f);
+  }
+}
+
+void LegacyJoystick::set_used_axes(AxisID::mask_t mask)
+{
+  flags_ = 0;
+  used_.clear();
   for (int i = AxisID::first; i < AxisID::num; ++i)
   {
     auto const ai = static_cast<AxisID::type>(i);
     auto const nai = w2n_axis_(ai);
-    if (LegacyAxisID::num == nai)
+    if (LegacyAxisID::num == nai || (mask & AxisID::to_mask(ai)) == 0)
       continue;
-    auto const & l = nativeLimits_.at(nai);
-    axes_.at(i) = lerp<DWORD, float>(get_pos_from_joyinfoex(ji, nai), l.first, l.second, -1.0f, 1.0f);
+    flags_ |= n2flag_(nai);
+    used_.push_back(std::make_pair(ai, nai));
   }
 }
 
-LegacyJoystick::LegacyJoystick(UINT joyID) : joyID_(joyID), ready_(false)
+LegacyJoystick::LegacyJoystick(UINT joyID, AxisID::mask_t usedAxes, DWORD reprobePeriod)
+  : joyID_(joyID), flags_(0), used_(), reprobePeriod_(get_qpc_frequency() * reprobePeriod / 1000), nextProbe_(0), ready_(false)
 {
   for (auto & v : axes_)
     v = 0.0f;
-  init_();
+  set_used_axes(usedAxes);
+  /* A joystick that is unplugged at startup is picked up by the reprobe */
+  auto const mmr = init_();
+  if (JOYERR_NOERROR != mmr)
+  {
+    nextProbe_ = get_qpc_ticks() + reprobePeriod_;
+    logging::log("joystick", logging::LogLevel::error, "Cannot get joystick caps or joystick is disconnected (id: ", joyID_, "; error: ", mmsyserr_to_cstr(mmr), "), will probe again every ", reprobePeriod, " ms");
+  }
 }
 
 LegacyAxisID::type LegacyJoystick::w2n_axis_(AxisID::type ai)
 {
   struct D { AxisID::type ai; LegacyAxisID::type nai; };
-  static std::array<D, AxisID::num> mapping = 
+  static std::array<D, 6> mapping = 
   {
     D{ AxisID::x, LegacyAxisID::x },
     D{ AxisID::y, LegacyAxisID::y },
@@ -234,10 +270,14 @@ LegacyAxisID::type LegacyJoystick::w2n_axis_(AxisID::type ai)
   return LegacyAxisID::num;
 }
 
-void LegacyJoystick::init_()
+DWORD LegacyJoystick::n2flag_(LegacyAxisID::type nai)
+{
+  static std::array<DWORD, LegacyAxisID::num> const flags = { JOY_RETURNX, JOY_RETURNY, JOY_RETURNZ, JOY_RETURNR, JOY_RETURNU, JOY_RETURNV };
+  return flags.at(nai);
+}
+
+MMRESULT LegacyJoystick::init_()
 {
-  if (ready_)
-    return;
   JOYCAPS jc;
   auto const sjc = sizeof(jc);
   memset(&jc, 0, sjc);
@@ -245,7 +285,7 @@ void LegacyJoystick::init_()
   if (JOYERR_NOERROR != mmr)
   {
     ready_ = false;
-    throw std::runtime_error(stream_to_str("Cannot get joystick caps or joystick is disconnected (id: ", joyID_, "; error: ", mmsyserr_to_cstr(mmr), ")"));
+    return mmr;
   }
   for (int i = LegacyAxisID::first; i < LegacyAxisID::num; ++i)
   {
@@ -254,6 +294,50 @@ void LegacyJoystick::init_()
   }
   ready_ = true;
   logging::log("joystick", logging::LogLevel::debug, "Initialized joystick ", joyID_);
+  return mmr;
+}
+
+bool LegacyJoystick::probe_()
+{
+  auto const now = get_qpc_ticks();
+  if (now < nextProbe_)
+    return false;
+  PROFILE_ZONE("LegacyJoystick::probe");
+  nextProbe_ = now + reprobePeriod_;
+  /* Cheap check first: a failing joyGetDevCaps() is as slow as a failing joyGetPosEx() */
+  JOYINFOEX ji;
+  memset(&ji, 0, sizeof(ji));
+  ji.dwSize = sizeof(ji);
+  ji.dwFlags = (flags_ != 0) ? flags_ : JOY_RETURNX;
+  if (JOYERR_NOERROR != joyGetPosEx(joyID_, &ji))
+    return false;
+  if (JOYERR_NOERROR != init_())
+    return false;
+  logging::log("joystick", logging::LogLevel::info, "Joystick ", joyID_, " is connected");
+  return true;
+}
+
+/* MockJoystick */
+float MockJoystick::get_axis_value(AxisID::type axisID) const
+{
+  return this->axes_.at(axisID);
+}
+
+void MockJoystick::update()
+{
+  double const pi = 3.14159265358979323846;
+  auto const t = qpc_ticks_to_ms(get_qpc_ticks() - start_) * 0.001;
+  auto const w = 2.0 * pi / period_;
+  for (int i = AxisID::first; i < AxisID::num; ++i)
+    axes_.at(i) = static_cast<float>(std::sin(w * t + i * pi / AxisID::num));
+}
+
+MockJoystick::MockJoystick(float period) : period_(period), start_(get_qpc_ticks())
+{
+  if (period_ <= 0.0f)
+    throw std::runtime_error(stream_to_str("Invalid mock joystick period: ", period_));
+  for (auto & v : axes_)
+    v = 0.0f;
 }
 
 /* DirectInput8 */
@@ -365,6 +449,7 @@ try {
 
 std::vector<DI8DeviceInfo> get_di8_devices_info(LPDIRECTINPUT8A pdi, DWORD devType, DWORD flags)
 {
+  PROFILE_ZONE("EnumDevices");
   FillDevicesCBData data;
   data.pdi = pdi;
   auto const result = pdi->EnumDevices(devType, fill_devices_cb, &data, flags);
@@ -388,6 +473,14 @@ GUID get_guid_by_name(std::vector<DI8DeviceInfo> const & infos, char const * nam
   return (itDev == infos.end()) ? GUID() : itDev->info.guidInstance;
 }
 
+char const * get_name_by_guid(std::vector<DI8DeviceInfo> const & infos, REFGUID instanceGUID)
+{
+  auto itDev = std::find_if(infos.begin(), infos.end(),
+    [&instanceGUID](std::remove_reference<decltype(infos)>::type::value_type const & v) { return instanceGUID == v.info.guidInstance; }
+  );
+  return (itDev == infos.end()) ? "unknown" : itDev->info.tszInstanceName;
+}
+
 LPDIRECTINPUTDEVICE8A create_device_by_name(LPDIRECTINPUT8A pdi, std::vector<DI8DeviceInfo> const & infos, char const * name)
 {
   auto instanceGuid = get_guid_by_name(infos, name);
@@ -402,6 +495,32 @@ LPDIRECTINPUTDEVICE8A create_device_by_name(LPDIRECTINPUT8A pdi, std::vector<DI8
 };
 
 /* DInput8Joystick */
+decltype(DI8Mode::names_) DI8Mode::names_ = {"buffered", "immediate", "auto"};
+
+char const * DI8Mode::to_cstr(DI8Mode::type id)
+{
+  return (id < first || id >= num) ? "unknown" : names_.at(id);
+}
+
+DI8Mode::type DI8Mode::from_cstr(char const * name)
+{
+  for (decltype(names_)::size_type i = 0; i < names_.size(); ++i)
+  {
+    if (strcmp(names_.at(i), name) == 0)
+      return static_cast<type>(i);
+  }
+  return num;
+}
+
+std::string di8modestats_to_str(DI8ModeStats const & stats)
+{
+  return stream_to_str(
+    "mode: ", DI8Mode::to_cstr(stats.mode), "; active: ", DI8Mode::to_cstr(stats.activeMode),
+    "; updates: ", stats.updates, "; busy: ", stats.busy, "; switches: ", stats.switches,
+    "; events/update: ", stats.eventsPerUpdate, "; buffered: ", stats.bufferedUs, " us; immediate: ", stats.immediateUs, " us"
+  );
+}
+
 float DInput8Joystick::get_axis_value(AxisID::type axisID) const
 {
   return this->axes_.at(axisID);
@@ -409,15 +528,98 @@ float DInput8Joystick::get_axis_value(AxisID::type axisID) const
 
 void DInput8Joystick::update()
 {
+  PROFILE_ZONE("DInput8Joystick::update");
+  /* A poll in flight holds the lock; the last axes are kept rather than waiting for the device on the game thread */
+  ScopedTryLock<CriticalSection> lock (deviceCS_);
+  if (!lock.owns_lock())
+  {
+    ++stats_.busy;
+    return;
+  }
   init_();
+  auto const activeMode = stats_.activeMode;
+  DWORD events = 0;
+  auto const begin = get_qpc_ticks();
+  if (activeMode == DI8Mode::immediate)
+    update_immediate_();
+  else
+    events = update_buffered_();
+  auto const us = static_cast<float>(qpc_ticks_to_us(get_qpc_ticks() - begin));
+  if (activeMode == DI8Mode::immediate && stats_.mode == DI8Mode::automatic)
+  {
+    /* Flush the buffer to keep measuring the event rate; returns number of flushed events */
+    if (pCapture_ == NULL)
+    {
+      DWORD inOut = INFINITE;
+      if (SUCCEEDED(pdid_->GetDeviceData(sizeof(DIDEVICEOBJECTDATA), NULL, &inOut, 0)))
+        events = inOut;
+    }
+    else
+    {
+      /* Captured events have to be read out */
+      std::array<DIDEVICEOBJECTDATA, buffSize_> data;
+      DWORD inOut = buffSize_;
+      while (SUCCEEDED(pdid_->GetDeviceData(sizeof(DIDEVICEOBJECTDATA), data.data(), &inOut, 0)) && inOut > 0)
+      {
+        capture_(data.data(), inOut);
+        events += inOut;
+        inOut = buffSize_;
+      }
+    }
+  }
+
+  auto & cost = (activeMode == DI8Mode::immediate) ? stats_.immediateUs : stats_.bufferedUs;
+  cost = (cost == 0.0f) ? us : cost + ewmaAlpha_ * (us - cost);
+  stats_.eventsPerUpdate += ewmaAlpha_ * (events - stats_.eventsPerUpdate);
+  ++stats_.updates;
+  if (stats_.mode == DI8Mode::automatic)
+    choose_mode_();
+}
+
+DI8ModeStats const & DInput8Joystick::get_mode_stats() const
+{
+  return stats_;
+}
+
+void DInput8Joystick::set_capture(trace::EventRing * pRing)
+{
+  ScopedLock<CriticalSection> lock (deviceCS_);
+  pCapture_ = pRing;
+}
+
+trace::EventRing * DInput8Joystick::get_capture() const
+{
+  return pCapture_;
+}
+
+void DInput8Joystick::capture_(DIDEVICEOBJECTDATA const * data, DWORD count)
+{
+  trace::DeviceEvent e;
+  e.device = pCapture_->get_device();
+  e.ticks = get_qpc_ticks();
+  for (DWORD i = 0; i < count; ++i)
+  {
+    e.ofs = data[i].dwOfs;
+    e.data = data[i].dwData;
+    e.timeStamp = data[i].dwTimeStamp;
+    e.sequence = data[i].dwSequence;
+    pCapture_->push(e);
+  }
+}
+
+DWORD DInput8Joystick::update_buffered_()
+{
   std::array<DIDEVICEOBJECTDATA, buffSize_> data;
   struct Value
   {
     DWORD dwData = 0;
     bool wasSet = false;
   };
+  /* By slot, so the slot coefficients apply */
   std::array<Value, AxisID::num> values;
+  DWORD events = 0;
   DWORD inOut = buffSize_;
+  PROFILE_ZONE("GetDeviceData");
   while (true)
   {
     auto const result = pdid_->GetDeviceData(sizeof(DIDEVICEOBJECTDATA), data.data(), &inOut, 0);
@@ -428,36 +630,86 @@ void DInput8Joystick::update()
     }
     if (inOut == 0)
       break;
+    events += inOut;
+    if (pCapture_)
+      capture_(data.data(), inOut);
     for (decltype(inOut) i = 0; i < inOut; ++i)
     {
       auto const & d = data.at(i);
-      auto const ai = n2w_axis_(d.dwOfs);
-      if (ai == AxisID::num)
+      auto const slot = d.dwOfs / sizeof(LONG);
+      if (slot >= dataFormat_.dwNumObjs)
         continue;
-      auto & v = values.at(ai);
+      auto & v = values.at(slot);
       v.wasSet = true;
       v.dwData = d.dwData;
     }
     inOut = buffSize_;
   }
-  for (int ai = AxisID::first; ai < AxisID::num; ++ai)
+  for (DWORD slot = 0; slot < dataFormat_.dwNumObjs; ++slot)
   {
-    auto const & v = values.at(ai);
+    auto const & v = values[slot];
+    /* dwData holds a LONG; the range may be negative */
     if (v.wasSet)
-    {
-      auto const & l = this->nativeLimits_.at(ai);
-      axes_.at(ai) = lerp<DWORD, float>(v.dwData, l.first, l.second, -1.0f, 1.0f);
-    }
+      axes_[slot2axis_[slot]] = static_cast<LONG>(v.dwData) * slotScale_[slot] + slotBias_[slot];
+  }
+  return events;
+}
+
+void DInput8Joystick::update_immediate_()
+{
+  PROFILE_ZONE("GetDeviceState");
+  auto const result = pdid_->GetDeviceState(dataFormat_.dwDataSize, state_.data());
+  if (FAILED(result))
+  {
+    ready_ = false;
+    check_for_dierr(result, "Failed to get device state");
   }
+  static_assert(sizeof(LONG) == sizeof(std::int32_t), "state_ slots must be 32-bit");
+  std::array<float, AxisID::num> values;
+  auto const numObjs = dataFormat_.dwNumObjs;
+  simd::scale_bias(reinterpret_cast<std::int32_t const *>(state_.data()), slotScale_.data(), slotBias_.data(), values.data(), numObjs);
+  for (DWORD slot = 0; slot < numObjs; ++slot)
+    axes_[slot2axis_[slot]] = values[slot];
+}
+
+void DInput8Joystick::choose_mode_()
+{
+  auto const activeMode = stats_.activeMode;
+  auto nextMode = activeMode;
+  if (activeMode == DI8Mode::buffered && stats_.eventsPerUpdate > autoHighEvents_)
+    nextMode = DI8Mode::immediate;
+  else if (activeMode == DI8Mode::immediate && stats_.eventsPerUpdate < autoLowEvents_)
+    nextMode = DI8Mode::buffered;
+  if (nextMode == activeMode)
+    return;
+  stats_.activeMode = nextMode;
+  ++stats_.switches;
+  logging::log("joystick", logging::LogLevel::debug, name_, ": switching to ", DI8Mode::to_cstr(nextMode), " mode (", di8modestats_to_str(stats_), ")");
 }
 
-DInput8Joystick::DInput8Joystick(LPDIRECTINPUTDEVICE8A pdid) : pdid_(pdid), ready_(false)
+DInput8Joystick::DInput8Joystick(LPDIRECTINPUTDEVICE8A pdid, DI8Mode::type mode, AxisID::mask_t usedAxes)
+  : pdid_(pdid), usedAxes_(usedAxes), objectFormats_(), dataFormat_(), ready_(false), name_("di8"), stats_(), pCapture_(NULL)
 {
   if (pdid == NULL)
     throw std::runtime_error("Device pointer is NULL");
-  for (auto & v : axes_)
-    v = 0.0f;
-  init_();
+  try {
+    if (mode < DI8Mode::first || mode >= DI8Mode::num)
+      throw std::runtime_error(stream_to_str("Invalid DirectInput8 mode: ", mode));
+    stats_.mode = mode;
+    stats_.activeMode = (mode == DI8Mode::immediate) ? DI8Mode::immediate : DI8Mode::buffered;
+    DIDEVICEINSTANCEA ddi;
+    ddi.dwSize = sizeof(ddi);
+    if (pdid_->GetDeviceInfo(&ddi) == DI_OK)
+      name_ = stream_to_str("di8:", ddi.tszInstanceName);
+    for (auto & v : axes_)
+      v = 0.0f;
+    init_();
+  } catch (...)
+  {
+    pdid_->Unacquire();
+    pdid_->Release();
+    throw;
+  }
   //logging::log("joystick", logging::LogLevel::debug, "Created di8 device ", pdid_);
 }
 
@@ -467,28 +719,225 @@ DInput8Joystick::~DInput8Joystick()
   assert(pdid_);
   //logging::log("joystick", logging::LogLevel::debug, "Releasing di8 device ", pdid_);
   pdid_->Unacquire();
-  //FIXME Causes client.exe to hang on exit.
-  //pdid_->Release();
+  /* Released when a reload or NP_UnregisterWindowHandle drops the device; left to the process exit under the loader lock, where releasing it hung client.exe */
+  if (!Thread::is_process_detaching())
+    pdid_->Release();
 }
 
-AxisID::type DInput8Joystick::n2w_axis_(DWORD nai)
+void DInput8Joystick::set_used_axes(AxisID::mask_t mask)
 {
-  struct D { AxisID::type ai; DWORD nai; };
-  static std::array<D, AxisID::num> mapping = 
+  ScopedLock<CriticalSection> lock (deviceCS_);
+  if (mask == usedAxes_)
+    return;
+  usedAxes_ = mask;
+  /* The data format can only be changed while the device is not acquired */
+  if (ready_)
   {
-    D{ AxisID::x, DIJOFS_X },
-    D{ AxisID::y, DIJOFS_Y },
-    D{ AxisID::z, DIJOFS_Z },
-    D{ AxisID::rx, DIJOFS_RX },
-    D{ AxisID::ry, DIJOFS_RY },
-    D{ AxisID::rz, DIJOFS_RZ },
-    D{ AxisID::u, DIJOFS_SLIDER(0) },
-    D{ AxisID::v, DIJOFS_SLIDER(1) }
-  };
-  for (auto const & d : mapping)
-    if (d.nai == nai)
-      return d.ai;
-  return AxisID::num;
+    pdid_->Unacquire();
+    ready_ = false;
+  }
+}
+
+AxisID::mask_t DInput8Joystick::get_used_axes() const
+{
+  return usedAxes_;
+}
+
+bool DInput8Joystick::needs_poll() const
+{
+  DIDEVCAPS caps;
+  caps.dwSize = sizeof(caps);
+  if (FAILED(pdid_->GetCapabilities(&caps)))
+    return false;
+  return (caps.dwFlags & (DIDC_POLLEDDEVICE | DIDC_POLLEDDATAFORMAT)) != 0;
+}
+
+bool DInput8Joystick::poll()
+{
+  ScopedLock<CriticalSection> lock (deviceCS_);
+  /* Reacquiring is left to update() */
+  if (!ready_)
+    return false;
+  return SUCCEEDED(pdid_->Poll());
+}
+
+/* PollScheduler */
+void PollScheduler::add(DInput8Joystick * pJoystick, float rate)
+{
+  if (pJoystick == NULL || rate <= 0.0f)
+    throw std::runtime_error(stream_to_str("Invalid poll parameters: joystick: ", pJoystick, "; rate: ", rate));
+  auto const period = static_cast<std::int64_t>(get_qpc_frequency() / rate);
+  {
+    ScopedLock<CriticalSection> lock (cs_);
+    entries_.push_back(Entry{ pJoystick, period, get_qpc_ticks(), 0, 0 });
+  }
+  changed_.set();
+}
+
+void PollScheduler::remove(DInput8Joystick * pJoystick)
+{
+  ScopedLock<CriticalSection> lock (cs_);
+  auto it = std::find_if(entries_.begin(), entries_.end(), [pJoystick](Entry const & e) { return e.pJoystick == pJoystick; });
+  if (it == entries_.end())
+    return;
+  log_entry_(*it);
+  entries_.erase(it);
+}
+
+PollScheduler::PollScheduler() : cs_(), entries_(), stop_(), changed_(false), spThread_()
+{
+  spThread_.reset(new Thread([this]() { run_(); }));
+  spThread_->set_priority(THREAD_PRIORITY_ABOVE_NORMAL);
+}
+
+PollScheduler::~PollScheduler()
+{
+  stop_.set();
+  spThread_->join();
+  for (auto const & e : entries_)
+    log_entry_(e);
+}
+
+void PollScheduler::run_()
+{
+  timeBeginPeriod(1);
+  HANDLE const handles[] = { stop_.get_handle(), changed_.get_handle() };
+  DWORD timeout = INFINITE;
+  while (WaitForMultipleObjects(2, handles, FALSE, timeout) != WAIT_OBJECT_0)
+  {
+    PROFILE_ZONE("PollScheduler::run_");
+    ScopedLock<CriticalSection> lock (cs_);
+    auto now = get_qpc_ticks();
+    std::int64_t next = 0;
+    for (auto & e : entries_)
+    {
+      if (e.next <= now)
+      {
+        if (e.pJoystick->poll())
+          ++e.polls;
+        else
+          ++e.failures;
+        now = get_qpc_ticks();
+        /* Skip missed polls instead of bursting to catch up */
+        e.next = std::max(e.next + e.period, now);
+      }
+      if (next == 0 || e.next < next)
+        next = e.next;
+    }
+    /* Rounded up: a timeout rounded down to 0 would busy-loop until the next poll is due */
+    timeout = (next == 0) ? INFINITE : static_cast<DWORD>(std::ceil(qpc_ticks_to_ms(std::max<std::int64_t>(next - now, 0))));
+  }
+  timeEndPeriod(1);
+}
+
+void PollScheduler::log_entry_(Entry const & e)
+{
+  logging::log("joystick", logging::LogLevel::debug, "Poll stats for ", e.pJoystick, ": polls: ", e.polls, "; failures: ", e.failures);
+}
+
+/* One entry per AxisID, in AxisID order. Sliders are matched by instance order, so the second slider of each aspect needs the first one in the format too. */
+struct DI8AxisDesc
+{
+  AxisID::type ai;
+  GUID const * pguid;
+  DWORD aspect;
+  AxisID::type prerequisite;
+};
+
+static constexpr DI8AxisDesc g_di8Axes[] = {
+  { AxisID::x, &GUID_XAxis, DIDOI_ASPECTPOSITION, AxisID::num },
+  { AxisID::y, &GUID_YAxis, DIDOI_ASPECTPOSITION, AxisID::num },
+  { AxisID::z, &GUID_ZAxis, DIDOI_ASPECTPOSITION, AxisID::num },
+  { AxisID::rx, &GUID_RxAxis, DIDOI_ASPECTPOSITION, AxisID::num },
+  { AxisID::ry, &GUID_RyAxis, DIDOI_ASPECTPOSITION, AxisID::num },
+  { AxisID::rz, &GUID_RzAxis, DIDOI_ASPECTPOSITION, AxisID::num },
+  { AxisID::u, &GUID_Slider, DIDOI_ASPECTPOSITION, AxisID::num },
+  { AxisID::v, &GUID_Slider, DIDOI_ASPECTPOSITION, AxisID::u },
+  { AxisID::vx, &GUID_XAxis, DIDOI_ASPECTVELOCITY, AxisID::num },
+  { AxisID::vy, &GUID_YAxis, DIDOI_ASPECTVELOCITY, AxisID::num },
+  { AxisID::vz, &GUID_ZAxis, DIDOI_ASPECTVELOCITY, AxisID::num },
+  { AxisID::vrx, &GUID_RxAxis, DIDOI_ASPECTVELOCITY, AxisID::num },
+  { AxisID::vry, &GUID_RyAxis, DIDOI_ASPECTVELOCITY, AxisID::num },
+  { AxisID::vrz, &GUID_RzAxis, DIDOI_ASPECTVELOCITY, AxisID::num },
+  { AxisID::vu, &GUID_Slider, DIDOI_ASPECTVELOCITY, AxisID::num },
+  { AxisID::vv, &GUID_Slider, DIDOI_ASPECTVELOCITY, AxisID::vu },
+  { AxisID::ax, &GUID_XAxis, DIDOI_ASPECTACCEL, AxisID::num },
+  { AxisID::ay, &GUID_YAxis, DIDOI_ASPECTACCEL, AxisID::num },
+  { AxisID::az, &GUID_ZAxis, DIDOI_ASPECTACCEL, AxisID::num },
+  { AxisID::arx, &GUID_RxAxis, DIDOI_ASPECTACCEL, AxisID::num },
+  { AxisID::ary, &GUID_RyAxis, DIDOI_ASPECTACCEL, AxisID::num },
+  { AxisID::arz, &GUID_RzAxis, DIDOI_ASPECTACCEL, AxisID::num },
+  { AxisID::au, &GUID_Slider, DIDOI_ASPECTACCEL, AxisID::num },
+  { AxisID::av, &GUID_Slider, DIDOI_ASPECTACCEL, AxisID::au },
+  { AxisID::fx, &GUID_XAxis, DIDOI_ASPECTFORCE, AxisID::num },
+  { AxisID::fy, &GUID_YAxis, DIDOI_ASPECTFORCE, AxisID::num },
+  { AxisID::fz, &GUID_ZAxis, DIDOI_ASPECTFORCE, AxisID::num },
+  { AxisID::frx, &GUID_RxAxis, DIDOI_ASPECTFORCE, AxisID::num },
+  { AxisID::fry, &GUID_RyAxis, DIDOI_ASPECTFORCE, AxisID::num },
+  { AxisID::frz, &GUID_RzAxis, DIDOI_ASPECTFORCE, AxisID::num },
+  { AxisID::fu, &GUID_Slider, DIDOI_ASPECTFORCE, AxisID::num },
+  { AxisID::fv, &GUID_Slider, DIDOI_ASPECTFORCE, AxisID::fu }
+};
+
+static constexpr bool di8_axes_are_ordered(size_t i = 0)
+{
+  return i == AxisID::num || (g_di8Axes[i].ai == static_cast<AxisID::type>(i) && di8_axes_are_ordered(i + 1));
+}
+
+static_assert(sizeof(g_di8Axes) / sizeof(g_di8Axes[0]) == AxisID::num, "g_di8Axes must describe every AxisID");
+static_assert(di8_axes_are_ordered(), "g_di8Axes must be in AxisID order");
+
+void DInput8Joystick::make_data_format_()
+{
+  auto mask = usedAxes_ ? usedAxes_ : AxisID::all;
+  for (auto const & a : g_di8Axes)
+    if (a.prerequisite != AxisID::num && (mask & AxisID::to_mask(a.ai)))
+      mask |= AxisID::to_mask(a.prerequisite);
+  objectFormats_.clear();
+  slot2axis_.fill(AxisID::num);
+  /* DirectInput's default range, for axes that do not report one */
+  nativeLimits_.fill(std::make_pair(0, 65535));
+  for (auto const & a : g_di8Axes)
+  {
+    if ((mask & AxisID::to_mask(a.ai)) == 0)
+      continue;
+    DIOBJECTDATAFORMAT odf;
+    odf.pguid = a.pguid;
+    odf.dwOfs = objectFormats_.size() * sizeof(LONG);
+    odf.dwType = DIDFT_AXIS | DIDFT_ANYINSTANCE | DIDFT_OPTIONAL;
+    odf.dwFlags = a.aspect;
+    slot2axis_.at(objectFormats_.size()) = a.ai;
+    objectFormats_.push_back(odf);
+  }
+  dataFormat_.dwSize = sizeof(DIDATAFORMAT);
+  dataFormat_.dwObjSize = sizeof(DIOBJECTDATAFORMAT);
+  dataFormat_.dwFlags = DIDF_ABSAXIS;
+  dataFormat_.dwDataSize = objectFormats_.size() * sizeof(LONG);
+  dataFormat_.dwNumObjs = objectFormats_.size();
+  dataFormat_.rgodf = objectFormats_.data();
+  state_.fill(0);
+}
+
+void DInput8Joystick::make_slot_coefficients_()
+{
+  slotScale_.fill(0.0f);
+  slotBias_.fill(0.0f);
+  for (DWORD slot = 0; slot < dataFormat_.dwNumObjs; ++slot)
+  {
+    auto const & l = nativeLimits_.at(slot2axis_[slot]);
+    if (l.second == l.first)
+      continue;
+    /* Same as lerp(v, l.first, l.second, -1, 1), but signed */
+    auto const scale = 2.0 / (static_cast<double>(l.second) - l.first);
+    slotScale_[slot] = static_cast<float>(scale);
+    slotBias_[slot] = static_cast<float>(1.0 - scale * l.second);
+  }
+}
+
+AxisID::type DInput8Joystick::offset2axis_(DWORD dwOfs) const
+{
+  auto const slot = dwOfs / sizeof(LONG);
+  return (slot < slot2axis_.size()) ? slot2axis_[slot] : AxisID::num;
 }
 
 BOOL WINAPI DInput8Joystick::fill_limits_cb_(LPCDIDEVICEOBJECTINSTANCE lpddoi, LPVOID pvRef)
@@ -502,7 +951,7 @@ BOOL WINAPI DInput8Joystick::fill_limits_cb_(LPCDIDEVICEOBJECTINSTANCE lpddoi, L
     range.diph.dwHow = DIPH_BYOFFSET;
     auto const dwOfs = lpddoi->dwOfs;
     range.diph.dwObj = dwOfs;
-    auto ai = n2w_axis_(dwOfs);
+    auto ai = that->offset2axis_(dwOfs);
     if (ai != AxisID::num && that->pdid_->GetProperty(DIPROP_RANGE, &range.diph) == DI_OK)
     {
       auto & nl = that->nativeLimits_.at(ai);
@@ -517,16 +966,26 @@ void DInput8Joystick::init_()
 {
   if (ready_)
     return;
-  auto result = pdid_->SetDataFormat(&c_dfDIJoystick);
+  PROFILE_ZONE("DInput8Joystick::init_");
+  HRESULT result;
+  {
+    ScopedPhase phase (startup_timer(), name_, "setDataFormat");
+    make_data_format_();
+    result = pdid_->SetDataFormat(&dataFormat_);
+  }
   check_for_dierr(result, "Failed to set data format");
-  DIPROPDWORD dipdBuffSize;
-  dipdBuffSize.diph.dwSize = sizeof(DIPROPDWORD);
-  dipdBuffSize.diph.dwHeaderSize = sizeof(DIPROPHEADER);
-  dipdBuffSize.diph.dwObj = 0;
-  dipdBuffSize.diph.dwHow = DIPH_DEVICE;
-  dipdBuffSize.dwData = buffSize_;
-  result = pdid_->SetProperty(DIPROP_BUFFERSIZE, &dipdBuffSize.diph);
-  check_for_dierr(result, "Failed to set buffer size");
+  /* Immediate mode needs no buffer; auto mode uses it to measure the event rate */
+  if (stats_.mode != DI8Mode::immediate)
+  {
+    DIPROPDWORD dipdBuffSize;
+    dipdBuffSize.diph.dwSize = sizeof(DIPROPDWORD);
+    dipdBuffSize.diph.dwHeaderSize = sizeof(DIPROPHEADER);
+    dipdBuffSize.diph.dwObj = 0;
+    dipdBuffSize.diph.dwHow = DIPH_DEVICE;
+    dipdBuffSize.dwData = buffSize_;
+    result = pdid_->SetProperty(DIPROP_BUFFERSIZE, &dipdBuffSize.diph);
+    check_for_dierr(result, "Failed to set buffer size");
+  }
   DIPROPDWORD dipdAxisMode;
   dipdAxisMode.diph.dwSize = sizeof(DIPROPDWORD);
   dipdAxisMode.diph.dwHeaderSize = sizeof(DIPROPHEADER);
@@ -535,72 +994,80 @@ void DInput8Joystick::init_()
   dipdAxisMode.dwData = DIPROPAXISMODE_ABS;
   result = pdid_->SetProperty(DIPROP_AXISMODE, &dipdAxisMode.diph);
   check_for_dierr(result, "Failed to set axis mode to absolute");
-  result = pdid_->EnumObjects(fill_limits_cb_, this, DIDFT_ABSAXIS);
-  check_for_dierr(result, "Failed to fill limits");
-  result = pdid_->Acquire();
-  check_for_dierr(result, "Failed to acquire");
-  DIJOYSTATE state;
-  result = pdid_->GetDeviceState(sizeof(state), &state);
-  check_for_dierr(result, "Failed to get device state");
-  struct { AxisID::type ai; LONG DIJOYSTATE::*member; } axisID2member[] =
-  {
-    { AxisID::x, &DIJOYSTATE::lX },
-    { AxisID::y, &DIJOYSTATE::lY },
-    { AxisID::z, &DIJOYSTATE::lZ },
-    { AxisID::rx, &DIJOYSTATE::lRx },
-    { AxisID::ry, &DIJOYSTATE::lRy },
-    { AxisID::rz, &DIJOYSTATE::lRz }
-  };
-  for (auto a2m : axisID2member)
   {
-    auto const & ai = a2m.ai;
-    auto const & member = a2m.member;
-    auto const & l = nativeLimits_.at(ai);
-    auto const nv = state.*member;
-    auto const v = lerp<DWORD, float>(nv, l.first, l.second, -1.0f, 1.0f);
-    axes_.at(ai) = v;
-    //logging::log("joystick", logging::LogLevel::debug, nv, "->", v);
+    ScopedPhase phase (startup_timer(), name_, "enumObjects");
+    result = pdid_->EnumObjects(fill_limits_cb_, this, DIDFT_ABSAXIS);
   }
-  struct { AxisID::type ai; size_t off; } axisID2off[] =
-  {
-    { AxisID::u, 0 },
-    { AxisID::v, 1 }
-  };
-  for (auto a2o : axisID2off)
+  check_for_dierr(result, "Failed to fill limits");
+  make_slot_coefficients_();
   {
-    auto const & ai = a2o.ai;
-    auto const & off = a2o.off;
-    auto const & l = nativeLimits_.at(ai);
-    axes_.at(ai) = lerp<DWORD, float>(state.rglSlider[off], l.first, l.second, -1.0f, 1.0f);
+    PROFILE_ZONE("Acquire");
+    ScopedPhase phase (startup_timer(), name_, "acquire");
+    result = pdid_->Acquire();
   }
+  check_for_dierr(result, "Failed to acquire");
   ready_ = true;
+  update_immediate_();
 }
 
-std::shared_ptr<DInput8Joystick> DInput8JoystickManager::make_joystick_by_name(char const * name)
+std::shared_ptr<DInput8Joystick> DInput8JoystickManager::make_joystick_by_name(char const * name, DI8Mode::type mode, AxisID::mask_t usedAxes, float pollRate)
 {
   auto const guid = get_guid_by_name(infos_, name);
   if (guid == GUID())
     throw std::runtime_error(stream_to_str("No GUID for name ", name));
-  return make_joystick_by_guid(guid);
+  return make_joystick_by_guid(guid, mode, usedAxes, pollRate);
 }
 
-std::shared_ptr<DInput8Joystick> DInput8JoystickManager::make_joystick_by_guid(REFGUID instanceGUID)
+std::shared_ptr<DInput8Joystick> DInput8JoystickManager::make_joystick_by_guid(REFGUID instanceGUID, DI8Mode::type mode, AxisID::mask_t usedAxes, float pollRate)
 {
   auto it = std::find_if(
     joysticks_.begin(), joysticks_.end(),
     [&instanceGUID](decltype(joysticks_)::value_type const & v) { return instanceGUID == v.first; }
   );
   if (it != joysticks_.end())
+  {
+    if (it->second->get_mode_stats().mode != mode)
+      logging::log("joystick", logging::LogLevel::info, "Device ", get_name_by_guid(infos_, instanceGUID), " is already open in ", DI8Mode::to_cstr(it->second->get_mode_stats().mode), " mode");
+    it->second->set_used_axes(it->second->get_used_axes() | usedAxes);
     return it->second;
+  }
   else
   {
-    auto pdid = create_device_by_guid(pdi_, instanceGUID);
-    auto spJoystick = std::make_shared<DInput8Joystick>(pdid);
+    LPDIRECTINPUTDEVICE8A pdid;
+    {
+      ScopedPhase phase (startup_timer(), stream_to_str("di8:", get_name_by_guid(infos_, instanceGUID)), "create");
+      pdid = create_device_by_guid(pdi_, instanceGUID);
+    }
+    auto spJoystick = std::make_shared<DInput8Joystick>(pdid, mode, usedAxes);
+    if (spJoystick->needs_poll())
+    {
+      if (!spPollScheduler_)
+        spPollScheduler_.reset(new PollScheduler());
+      spPollScheduler_->add(spJoystick.get(), pollRate);
+      logging::log("joystick", logging::LogLevel::info, "Device ", get_name_by_guid(infos_, instanceGUID), " needs polling, polling at ", pollRate, " Hz");
+    }
     joysticks_.push_back(std::make_pair(instanceGUID, spJoystick));
     return spJoystick;
   }
 }
 
+void DInput8JoystickManager::release_unused()
+{
+  ScopedLock<CriticalSection> lock (cs_);
+  for (auto it = joysticks_.begin(); it != joysticks_.end();)
+  {
+    if (it->second.use_count() > 1)
+    {
+      ++it;
+      continue;
+    }
+    if (spPollScheduler_)
+      spPollScheduler_->remove(it->second.get());
+    logging::log("joystick", logging::LogLevel::info, "Releasing device ", get_name_by_guid(infos_, it->first));
+    it = joysticks_.erase(it);
+  }
+}
+
 std::vector<DI8DeviceInfo> const & DInput8JoystickManager::get_joysticks_info() const
 {
   return infos_;
@@ -608,24 +1075,36 @@ std::vector<DI8DeviceInfo> const & DInput8JoystickManager::get_joysticks_info()
 
 void DInput8JoystickManager::update()
 {
+  /* Does not wait on the sampling path; the devices are updated again by the next call */
+  ScopedTryLock<CriticalSection> lock (cs_);
+  if (!lock.owns_lock())
+    return;
   for (auto & j : joysticks_)
     j.second->update();
 }
 
-DInput8JoystickManager::DInput8JoystickManager() : pdi_(NULL), joysticks_(), infos_()
+DInput8JoystickManager::DInput8JoystickManager() : pdi_(NULL), cs_(), joysticks_(), infos_(), spPollScheduler_()
 {
   auto const hInstance = GetModuleHandle(NULL);
   auto const dinputVersion = 0x800;
-  auto result = DirectInput8Create(hInstance, dinputVersion, IID_IDirectInput8, reinterpret_cast<void**>(&pdi_), NULL);
+  HRESULT result;
+  {
+    PROFILE_ZONE("DirectInput8Create");
+    ScopedPhase phase (startup_timer(), "directInput8Create");
+    result = DirectInput8Create(hInstance, dinputVersion, IID_IDirectInput8, reinterpret_cast<void**>(&pdi_), NULL);
+  }
   check_for_dierr(result, "Failed to create DirectInput8");
   assert(pdi_);
   //logging::log("joystick", logging::LogLevel::debug, "Created di8 ", pdi_);
+  ScopedPhase phase (startup_timer(), "enumDevices");
   infos_ = get_di8_devices_info(pdi_, DI8DEVTYPE_JOYSTICK, DIEDFL_ALLDEVICES);
 }
 
 DInput8JoystickManager::~DInput8JoystickManager()
 {
   //logging::log("joystick", logging::LogLevel::debug, "DInput8JoystickManager::~DInput8JoystickManager()");
+  /* Stop polling before the joysticks go away */
+  spPollScheduler_.reset();
   joysticks_.erase(joysticks_.begin(), joysticks_.end());
   assert(pdi_);
   //logging::log("joystick", logging::LogLevel::debug, "Releasing di8 ", pdi_);
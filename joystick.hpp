@@ -5,6 +5,9 @@
 #include <vector>
 #include <array>
 #include <memory> //shared ptr
+#include <cstdint>
+
+#include "thread.hpp"
 
 #include <windows.h> //legacy joystick API
 #include <dinput.h> //DirectInput API
@@ -22,8 +25,18 @@ T lerp(F const & fv, F const & fb, F const & fe, T const & tb, T const & te)
 /* API-independent */
 struct AxisID
 {
-  enum type { x = 0, first = x, y, z, rx, ry, rz, u, v, num };
-
+  /* Position axes and sliders, then their velocity (v*), acceleration (a*) and force (f*) counterparts, as in DIJOYSTATE2 */
+  enum type {
+    x = 0, first = x, y, z, rx, ry, rz, u, v,
+    vx, vy, vz, vrx, vry, vrz, vu, vv,
+    ax, ay, az, arx, ary, arz, au, av,
+    fx, fy, fz, frx, fry, frz, fu, fv,
+    num
+  };
+  typedef std::uint32_t mask_t;
+  static mask_t constexpr all = (num >= 32) ? ~mask_t(0) : (mask_t(1) << num) - 1;
+
+  static mask_t to_mask(type id) { return 1u << id; }
   static char const * to_cstr(type id);
   static type from_cstr(char const * name);
 
@@ -35,6 +48,8 @@ class Joystick
 {
 public:
   virtual float get_axis_value(AxisID::type axisID) const =0;
+  /* Hint which axes are actually read, so the backend can skip the rest */
+  virtual void set_used_axes(AxisID::mask_t /*mask*/) {}
 
   virtual ~Joystick() =default;
 };
@@ -87,25 +102,51 @@ std::string legacyjoystickinfo_to_str(LegacyJoystickInfo const & info, int mode
 
 std::vector<LegacyJoystickInfo> get_legacy_joysticks_info();
 
-/* Legacy joystick does not support device reconnects (only under Wine?). */
+/* Legacy joystick. Only axes set by set_used_axes() are requested from joyGetPosEx() and converted.
+ * A disconnected joystick, also one absent at construction, keeps its last axes values and is probed again at most every reprobePeriod ms,
+ * since winmm calls for absent devices can take milliseconds; caps are read only after a probe succeeds.
+ */
 class LegacyJoystick : public Joystick, public Updated
 {
 public:
   virtual float get_axis_value(AxisID::type axisID) const override;
   virtual void update() override;
+  virtual void set_used_axes(AxisID::mask_t mask) override;
 
-  LegacyJoystick(UINT joyID);
+  LegacyJoystick(UINT joyID, AxisID::mask_t usedAxes = AxisID::all, DWORD reprobePeriod = 1000);
 
 private:
   static LegacyAxisID::type w2n_axis_(AxisID::type ai);
-  void init_();
+  static DWORD n2flag_(LegacyAxisID::type nai);
+  MMRESULT init_();
+  bool probe_();
 
   UINT joyID_;
+  /* JOY_RETURN* flags of used axes */
+  DWORD flags_;
+  std::vector<std::pair<AxisID::type, LegacyAxisID::type> > used_;
+  std::int64_t reprobePeriod_;
+  std::int64_t nextProbe_;
   std::array<std::pair<UINT, UINT>, LegacyAxisID::num> nativeLimits_;
   std::array<float, AxisID::num> axes_;
   bool ready_;
 };
 
+/* Mock joystick generates phase-shifted sine waves and needs no device (load testing). */
+class MockJoystick : public Joystick, public Updated
+{
+public:
+  virtual float get_axis_value(AxisID::type axisID) const override;
+  virtual void update() override;
+
+  MockJoystick(float period);
+
+private:
+  float period_;
+  std::int64_t start_;
+  std::array<float, AxisID::num> axes_;
+};
+
 /* DirectInput8 */
 struct DI8DeviceInfo
 {
@@ -121,35 +162,139 @@ std::string didevcaps_to_str(DIDEVCAPS const & caps);
 LPDIRECTINPUTDEVICE8A create_device_by_guid(LPDIRECTINPUT8A pdi, REFGUID instanceGUID);
 LPDIRECTINPUTDEVICE8A create_device_by_name(LPDIRECTINPUT8A pdi, std::vector<DI8DeviceInfo> const & infos, char const * name);
 
+/* How DInput8Joystick reads the device: draining the event buffer, one GetDeviceState() snapshot, or whichever suits the event rate */
+struct DI8Mode
+{
+  enum type { buffered = 0, first = buffered, immediate, automatic, num };
+
+  static char const * to_cstr(type id);
+  static type from_cstr(char const * name);
+
+private:
+  static std::array<char const *, DI8Mode::num> names_;
+};
+
+struct DI8ModeStats
+{
+  DI8Mode::type mode;
+  DI8Mode::type activeMode;
+  std::uint64_t updates;
+  /* Updates skipped because a background poll held the device */
+  std::uint64_t busy;
+  std::uint64_t switches;
+  /* Exponentially weighted moving averages */
+  float eventsPerUpdate;
+  float bufferedUs;
+  float immediateUs;
+};
+
+std::string di8modestats_to_str(DI8ModeStats const & stats);
+
+namespace trace { class EventRing; }
+
 class DInput8Joystick : public Joystick, public Updated
 {
 public:
   virtual float get_axis_value(AxisID::type axisID) const override;
   virtual void update() override;
-
-  DInput8Joystick(LPDIRECTINPUTDEVICE8A pdid);
+  /* Rebuilds the data format on the next update if the set of axes changes */
+  virtual void set_used_axes(AxisID::mask_t mask) override;
+  AxisID::mask_t get_used_axes() const;
+  DI8ModeStats const & get_mode_stats() const;
+  /* True if the device only delivers data after Poll() (DIDC_POLLEDDEVICE or DIDC_POLLEDDATAFORMAT) */
+  bool needs_poll() const;
+  /* Thread-safe; returns false if the device is not acquired or polling failed */
+  bool poll();
+  /* Buffered events are also pushed to pRing (NULL stops capture); the ring must outlive the capture */
+  void set_capture(trace::EventRing * pRing);
+  trace::EventRing * get_capture() const;
+
+  /* Takes ownership of pdid, also if it throws */
+  DInput8Joystick(LPDIRECTINPUTDEVICE8A pdid, DI8Mode::type mode = DI8Mode::buffered, AxisID::mask_t usedAxes = AxisID::all);
   DInput8Joystick(DInput8Joystick const &) =delete;
   DInput8Joystick & operator=(DInput8Joystick const &) =delete;
   ~DInput8Joystick();
 
 private:
-  static AxisID::type n2w_axis_(DWORD nai);
   static BOOL WINAPI fill_limits_cb_(LPCDIDEVICEOBJECTINSTANCE lpddoi, LPVOID pvRef);
   void init_();
+  void make_data_format_();
+  AxisID::type offset2axis_(DWORD dwOfs) const;
+  void make_slot_coefficients_();
+  DWORD update_buffered_();
+  void update_immediate_();
+  void choose_mode_();
+  void capture_(DIDEVICEOBJECTDATA const * data, DWORD count);
 
   static DWORD const buffSize_ = 16;
+  /* Auto mode switches to immediate above the high and back to buffered below the low events per update */
+  static float constexpr autoHighEvents_ = 8.0f;
+  static float constexpr autoLowEvents_ = 2.0f;
+  static float constexpr ewmaAlpha_ = 1.0f / 64.0f;
   LPDIRECTINPUTDEVICE8A pdid_;
+  /* Data format with one LONG slot per used axis; slot i is at offset i*sizeof(LONG) */
+  AxisID::mask_t usedAxes_;
+  std::vector<DIOBJECTDATAFORMAT> objectFormats_;
+  DIDATAFORMAT dataFormat_;
+  std::array<AxisID::type, AxisID::num> slot2axis_;
+  std::array<LONG, AxisID::num> state_;
   std::array<std::pair<LONG, LONG>, AxisID::num> nativeLimits_;
+  /* Slot value * scale + bias maps the native range to [-1, 1] */
+  std::array<float, AxisID::num> slotScale_;
+  std::array<float, AxisID::num> slotBias_;
   std::array<float, AxisID::num> axes_;
   bool ready_;
+  std::string name_;
+  DI8ModeStats stats_;
+  trace::EventRing * pCapture_;
+  /* Serializes device access between update() and poll() */
+  CriticalSection deviceCS_;
+};
+
+/* Calls DInput8Joystick::poll() for each added joystick at its own rate on a background thread; waits are whole milliseconds, so rates above 1000 Hz are not reached */
+class PollScheduler
+{
+public:
+  void add(DInput8Joystick * pJoystick, float rate);
+  void remove(DInput8Joystick * pJoystick);
+
+  PollScheduler();
+  PollScheduler(PollScheduler const &) =delete;
+  PollScheduler & operator=(PollScheduler const &) =delete;
+  ~PollScheduler();
+
+private:
+  struct Entry
+  {
+    DInput8Joystick * pJoystick;
+    std::int64_t period;
+    std::int64_t next;
+    std::uint64_t polls;
+    std::uint64_t failures;
+  };
+
+  void run_();
+  static void log_entry_(Entry const & e);
+
+  CriticalSection cs_;
+  std::vector<Entry> entries_;
+  Event stop_;
+  Event changed_;
+  std::unique_ptr<Thread> spThread_;
 };
 
 class DInput8JoystickManager : public Updated
 {
 public:
-  std::shared_ptr<DInput8Joystick> make_joystick_by_name(char const * name);
-  std::shared_ptr<DInput8Joystick> make_joystick_by_guid(REFGUID instanceGUID);
+  /* A device that is already open gets usedAxes added to its used axes */
+  /* Devices that need polling are polled at pollRate Hz in the background */
+  std::shared_ptr<DInput8Joystick> make_joystick_by_name(char const * name, DI8Mode::type mode = DI8Mode::buffered, AxisID::mask_t usedAxes = AxisID::all, float pollRate = 250.0f);
+  std::shared_ptr<DInput8Joystick> make_joystick_by_guid(REFGUID instanceGUID, DI8Mode::type mode = DI8Mode::buffered, AxisID::mask_t usedAxes = AxisID::all, float pollRate = 250.0f);
   std::vector<DI8DeviceInfo> const & get_joysticks_info() const;
+  /* Stops polling and releases the devices no one but the manager holds; not concurrently with make_joystick_by_guid().
+   * Called by a Pipeline being destroyed, for the devices a later pipeline did not carry over; update() skips a call that finds it running.
+   */
+  void release_unused();
   virtual void update() override;
 
   DInput8JoystickManager();
@@ -159,8 +304,12 @@ public:
 
 private:
   LPDIRECTINPUT8A pdi_;
+  /* Guards joysticks_ between update() and release_unused() */
+  CriticalSection cs_;
   std::vector<std::pair<GUID, std::shared_ptr<DInput8Joystick> > > joysticks_;
   std::vector<DI8DeviceInfo> infos_;
+  /* Created with the first polled device */
+  std::unique_ptr<PollScheduler> spPollScheduler_;
 };
 
 #endif
@@ -1,6 +1,14 @@
 #include "joystick.hpp"
 #include "logging.hpp"
 #include "util.hpp"
+#include "alloc_count.hpp"
+#include "clock.hpp"
+#include "rawinput.hpp"
+#include "xinput.hpp"
+#include "udp.hpp"
+#include "pose.hpp"
+#include "freetrack.hpp"
+#include "trace.hpp"
 
 #include <type_traits>
 #include <vector>
@@ -11,6 +19,7 @@
 #include <sstream>
 #include <iostream>
 #include <iomanip>
+#include <cmath>
 #include <cassert>
 
 #include <hidusage.h>
@@ -73,140 +82,176 @@ int print_legacy_joystick(int joyID)
   return 0;
 }
 
-struct RawDeviceInfo
+int print_rawhid_joystick(DWORD vendorID, DWORD productID, unsigned index)
 {
-  HANDLE handle = 0;
-  UINT type = 0;
-  std::string name = "";
-  UINT usagePage = 0;
-  UINT usage = 0;
-};
+  auto const spThread = std::make_shared<RawInputThread>();
+  RawHIDJoystick j (spThread, find_raw_hid_device(vendorID, productID, index));
+  std::cout << std::fixed << std::setprecision(2) << std::showpos;
+  while(true)
+  {
+    j.update();
+    std::cout <<
+      "x: " << j.get_axis_value(AxisID::x) <<
+      "; y: " << j.get_axis_value(AxisID::y) <<
+      "; z: " << j.get_axis_value(AxisID::z) <<
+      "; rx: " << j.get_axis_value(AxisID::rx) <<
+      "; ry: " << j.get_axis_value(AxisID::ry) <<
+      "; rz: " << j.get_axis_value(AxisID::rz) <<
+      std::endl;
+    Sleep(10);
+  }
+  return 0;
+}
 
-std::ostream & operator<<(std::ostream & os, RawDeviceInfo const & rdi)
+int print_xinput_joystick(DWORD slot)
 {
-  return os << "handle: " << rdi.handle << ", type: " << rdi.type << ", name: " << rdi.name << ", usagePage: " << rdi.usagePage << ", usage: " << rdi.usage;
+  auto const spManager = std::make_shared<XInputManager>();
+  XInputJoystick j (spManager, slot);
+  std::cout << "Using " << spManager->get_library_name() << std::endl;
+  std::cout << std::fixed << std::setprecision(2) << std::showpos;
+  while(true)
+  {
+    spManager->update();
+    std::cout <<
+      "x: " << j.get_axis_value(AxisID::x) <<
+      "; y: " << j.get_axis_value(AxisID::y) <<
+      "; z: " << j.get_axis_value(AxisID::z) <<
+      "; rx: " << j.get_axis_value(AxisID::rx) <<
+      "; ry: " << j.get_axis_value(AxisID::ry) <<
+      "; rz: " << j.get_axis_value(AxisID::rz) <<
+      std::endl;
+    Sleep(10);
+  }
+  return 0;
 }
 
-std::vector<RawDeviceInfo> get_raw_devices()
+int print_udp_joystick(unsigned short port, bool useThread)
 {
-  UINT uiNumDevices = 0;
-  INT r = GetRawInputDeviceList(0, &uiNumDevices, sizeof(RAWINPUTDEVICELIST));
-  if (-1 == r)
-    throw std::runtime_error("Error getting device number");
-  std::vector<RAWINPUTDEVICELIST> rawInputDeviceList (uiNumDevices);
-  r = GetRawInputDeviceList(rawInputDeviceList.data(), &uiNumDevices, sizeof(RAWINPUTDEVICELIST));
-  if (-1 == r)
-    throw std::runtime_error("Error listing devices");
-  std::vector<RawDeviceInfo> devices;
-  for (UINT i = 0; i < uiNumDevices; ++i)
-  {
-    auto const & ridl = rawInputDeviceList[i];
-    //Get required device name string length
-    UINT szName = 0;
-    r = GetRawInputDeviceInfoA(ridl.hDevice, RIDI_DEVICENAME, nullptr, &szName);
-    if (-1 == r)
-      throw std::runtime_error("Error getting device name string length");
-    char name [256];
-    r = GetRawInputDeviceInfoA(ridl.hDevice, RIDI_DEVICENAME, name, &szName);
-    if (-1 == r)
-      throw std::runtime_error("Error getting device name");
-    RID_DEVICE_INFO ridi;
-    UINT szRidi = sizeof(RID_DEVICE_INFO);
-    r = GetRawInputDeviceInfoA(ridl.hDevice, RIDI_DEVICEINFO, &ridi, &szRidi);
-    if (-1 == r)
-      throw std::runtime_error("Error getting device info");
-    RawDeviceInfo di;
-    di.handle = ridl.hDevice;
-    di.type = ridl.dwType;
-    di.name = name;
-    if (ridl.dwType == RIM_TYPEMOUSE)
-    {
-      di.usagePage = HID_USAGE_PAGE_GENERIC;
-      di.usage = HID_USAGE_GENERIC_MOUSE;
-    }
-    else if (ridl.dwType == RIM_TYPEKEYBOARD)
-    {
-      di.usagePage = HID_USAGE_PAGE_GENERIC;
-      di.usage = HID_USAGE_GENERIC_KEYBOARD;
-    }
-    else if (ridl.dwType == RIM_TYPEHID)
+  UdpJoystick j ("0.0.0.0", port, useThread);
+  std::cout << std::fixed << std::setprecision(2) << std::showpos;
+  while(true)
+  {
+    j.update();
+    std::cout <<
+      "x: " << j.get_axis_value(AxisID::x) <<
+      "; y: " << j.get_axis_value(AxisID::y) <<
+      "; z: " << j.get_axis_value(AxisID::z) <<
+      "; rx: " << j.get_axis_value(AxisID::rx) <<
+      "; ry: " << j.get_axis_value(AxisID::ry) <<
+      "; rz: " << j.get_axis_value(AxisID::rz) <<
+      "; packets: " << j.get_packets() <<
+      "; dropped: " << j.get_dropped() <<
+      std::endl;
+    Sleep(10);
+  }
+  return 0;
+}
+
+/* Sends sine poses through UdpPoseSink to a UdpJoystick on loopback and checks that every pose arrives unchanged */
+int check_udp_sink(unsigned short port, double rate, double seconds)
+{
+  double const pi = 3.14159265358979323846;
+  double const translationRange = 50.0, rotationRange = 180.0;
+  UdpJoystick receiver ("127.0.0.1", port, false, translationRange, rotationRange);
+  UdpPoseSink sink (std::vector<UdpPoseSink::endpoint_t>(1, UdpPoseSink::endpoint_t("127.0.0.1", port)));
+  auto const frequency = get_qpc_frequency();
+  auto const begin = get_qpc_ticks();
+  auto const endTicks = begin + static_cast<std::int64_t>(seconds * frequency);
+  auto const period = static_cast<std::int64_t>(frequency / rate);
+  std::uint64_t poses = 0, mismatches = 0;
+  timeBeginPeriod(1);
+  for (auto next = begin; next < endTicks; next += period)
+  {
+    while (get_qpc_ticks() < next)
+      Sleep(0);
+    auto const t = static_cast<float>(next - begin) / frequency;
+    Pose const pose (90.0f * std::sin(2 * pi * t / 4.0), 45.0f * std::sin(2 * pi * t / 5.0), 0.0f, 10.0f * std::sin(2 * pi * t / 3.0), 0.0f, -5.0f);
+    auto const packetsBefore = receiver.get_packets();
+    sink.put_pose(pose);
+    /* An unchanged pose must not be sent again */
+    sink.put_pose(pose);
+    ++poses;
+    for (int i = 0; i < 100 && receiver.get_packets() == packetsBefore; ++i)
     {
-      di.usagePage = ridi.hid.usUsagePage;
-      di.usage = ridi.hid.usUsage;
+      receiver.update();
+      if (receiver.get_packets() == packetsBefore)
+        Sleep(0);
     }
-    else
+    double const expected[] = { pose.x / translationRange, pose.y / translationRange, pose.z / translationRange, pose.yaw / rotationRange, pose.pitch / rotationRange, pose.roll / rotationRange };
+    AxisID::type const axes[] = { AxisID::x, AxisID::y, AxisID::z, AxisID::rx, AxisID::ry, AxisID::rz };
+    for (int i = 0; i < 6; ++i)
     {
-      throw std::runtime_error("Unexpected device type");
+      if (std::fabs(receiver.get_axis_value(axes[i]) - expected[i]) > 1e-5)
+      {
+        ++mismatches;
+        break;
+      }
     }
-    devices.push_back(di);
   }
-  return devices;
+  timeEndPeriod(1);
+  auto const elapsed = static_cast<double>(get_qpc_ticks() - begin) / frequency;
+  std::cout <<
+    "poses: " << poses <<
+    "; sent: " << sink.get_sent() <<
+    "; dropped: " << sink.get_dropped() <<
+    "; received: " << receiver.get_packets() <<
+    "; mismatches: " << mismatches <<
+    "; rate: " << receiver.get_packets() / elapsed << " Hz" << std::endl;
+  auto const ok = mismatches == 0 && sink.get_sent() == poses && receiver.get_packets() == poses;
+  std::cout << (ok ? "OK" : "FAILED") << std::endl;
+  return ok ? 0 : 1;
 }
 
-void register_raw_device(RawDeviceInfo const & rdi, HWND hwnd, bool remove = false)
+int print_freetrack_joystick(bool useRaw)
 {
-  static const UINT numRid = 1;
-  RAWINPUTDEVICE rid[numRid];
-  rid[0].usUsagePage = rdi.usagePage;
-  rid[0].usUsage = rdi.usage;
-  UINT dwFlags = RIDEV_INPUTSINK;
-  if (remove)
-  {
-    dwFlags |= RIDEV_REMOVE;
-    hwnd = NULL;
-  }
-  rid[0].dwFlags = dwFlags;
-  rid[0].hwndTarget = hwnd;
-  if (!RegisterRawInputDevices(rid, numRid, sizeof(RAWINPUTDEVICE)))
-    throw std::runtime_error("Failed to register device");
+  FreeTrackJoystick j (useRaw);
+  std::cout << std::fixed << std::setprecision(2) << std::showpos;
+  while(true)
+  {
+    j.update();
+    std::cout <<
+      "x: " << j.get_axis_value(AxisID::x) <<
+      "; y: " << j.get_axis_value(AxisID::y) <<
+      "; z: " << j.get_axis_value(AxisID::z) <<
+      "; rx: " << j.get_axis_value(AxisID::rx) <<
+      "; ry: " << j.get_axis_value(AxisID::ry) <<
+      "; rz: " << j.get_axis_value(AxisID::rz) <<
+      "; locked reads: " << j.get_locked_reads() <<
+      std::endl;
+    Sleep(10);
+  }
+  return 0;
 }
 
-HWND create_window(WNDPROC wndProc, char const * className, char const * windowName, bool useMessageWindow, float alpha=1.0)
+/* Stands in for a tracker: sends sine poses (yaw +-90 degrees, x +-10 cm, ...) */
+int send_udp_poses(char const * address, unsigned short port, double rate, double seconds)
 {
-  //Define Window Class
-  WNDCLASS wndclass;
-  wndclass.style = CS_HREDRAW | CS_VREDRAW;
-  wndclass.lpfnWndProc = wndProc;
-  wndclass.cbClsExtra = wndclass.cbWndExtra = 0;
-  wndclass.hInstance = GetModuleHandleA(nullptr);
-  wndclass.hIcon = LoadIconA(nullptr, IDI_APPLICATION);
-  wndclass.hCursor = LoadCursorA(nullptr, IDC_ARROW);
-  wndclass.hbrBackground = static_cast<HBRUSH>(GetStockObject(WHITE_BRUSH));
-  wndclass.lpszMenuName = nullptr;
-  wndclass.lpszClassName = className;
-  //Register Window Class
-  if (!RegisterClassA(&wndclass))
-    throw std::runtime_error("Failed to register window class");
-  //Create Window
-  //auto const exStyle = WS_EX_LAYERED | WS_EX_APPWINDOW | WS_EX_TOPMOST | WS_EX_TRANSPARENT;
-  //auto const exStyle = WS_EX_LAYERED | WS_EX_APPWINDOW | WS_EX_TOPMOST;
-  auto const exStyle = WS_EX_LAYERED | WS_EX_TRANSPARENT;
-  //auto const exStyle = WS_EX_LAYERED;
-  //auto style = WS_VISIBLE | WS_POPUP;
-  //auto style = WS_OVERLAPPED;
-  auto style = WS_VISIBLE;
-  auto parent = useMessageWindow ? HWND_MESSAGE : nullptr;
-  auto hwnd = CreateWindowEx(
-    exStyle,
-    className, windowName,
-    style,
-    CW_USEDEFAULT, CW_USEDEFAULT, CW_USEDEFAULT, CW_USEDEFAULT,
-    parent,
-    nullptr,
-    wndclass.hInstance,
-    nullptr);
-  if (0 == hwnd)
-    throw std::runtime_error("Failed to create window");
-  if (!useMessageWindow)
-  {
-    unsigned int const bAlpha = 255*alpha;
-    if (!SetLayeredWindowAttributes(hwnd, 0, bAlpha, LWA_ALPHA))
-      throw std::runtime_error("Failed to set window alpha");
-    ShowWindow(hwnd, SW_SHOWNORMAL);
-    UpdateWindow(hwnd);
-  }
-  //TODO Check for error
-  return hwnd;
+  double const pi = 3.14159265358979323846;
+  UdpPoseSender sender (address, port);
+  auto const frequency = get_qpc_frequency();
+  auto const begin = get_qpc_ticks();
+  auto const endTicks = begin + static_cast<std::int64_t>(seconds * frequency);
+  auto const period = static_cast<std::int64_t>(frequency / rate);
+  std::uint64_t sent = 0;
+  std::uint64_t failed = 0;
+  timeBeginPeriod(1);
+  for (auto next = begin; next < endTicks; next += period)
+  {
+    while (get_qpc_ticks() < next)
+      Sleep(0);
+    auto const t = static_cast<double>(next - begin) / frequency;
+    udp_pose_t pose;
+    for (size_t i = 0; i < pose.size(); ++i)
+      pose[i] = ((i < 3) ? 10.0 : 90.0) * std::sin(2.0 * pi * (t / 4.0 + i / 6.0));
+    auto const error = sender.send(pose);
+    if (error == 0)
+      ++sent;
+    else if (failed++ == 0)
+      std::cerr << "Failed to send UDP pose, error = " << error << std::endl;
+  }
+  timeEndPeriod(1);
+  std::cout << "Sent " << sent << " poses, failed " << failed << std::endl;
+  return 0;
 }
 
 LRESULT __stdcall wnd_proc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam)
@@ -303,6 +348,169 @@ std::ostream & operator<<(std::ostream & os, RAWINPUT const & ri)
   return os << "header: " << ri.header;
 }
 
+/* Allocation check */
+#ifdef JOY2TIR_ALLOC_COUNT
+/* Returns non-zero if any update after warm-up allocates. */
+int check_update_allocs(Updated & updated, Joystick const & joystick, int frames)
+{
+  int const warmupFrames = 10;
+  alloc_count::FrameMonitor monitor (warmupFrames);
+  float sum = 0.0f;
+  for (int i = 0; i < warmupFrames + frames; ++i)
+  {
+    alloc_count::ScopedCounter counter;
+    updated.update();
+    for (int ai = AxisID::first; ai < AxisID::num; ++ai)
+      sum += joystick.get_axis_value(static_cast<AxisID::type>(ai));
+    monitor.end_frame(counter);
+  }
+  std::cout << "frames: " << monitor.get_frames() << "; frames that allocated: " << monitor.get_bad_frames()
+    << "; allocations: " << monitor.get_bad_allocs() << "; checksum: " << sum << std::endl;
+  return monitor.get_bad_frames() == 0 ? 0 : 1;
+}
+#endif
+
+int check_allocs(int argc, char** argv)
+{
+#ifdef JOY2TIR_ALLOC_COUNT
+  if (argc < 2)
+  {
+    std::cout << "params: legacy|di8 joystick_num|joystick_name [frames]" << std::endl;
+    return 1;
+  }
+  std::string const type (argv[0]);
+  int const frames = (argc > 2) ? atoi(argv[2]) : 1000;
+  if (type == "legacy")
+  {
+    LegacyJoystick j (atoi(argv[1]));
+    return check_update_allocs(j, j, frames);
+  }
+  else if (type == "di8")
+  {
+    DInput8JoystickManager manager;
+    auto spj = manager.make_joystick_by_name(argv[1]);
+    return check_update_allocs(*spj, *spj, frames);
+  }
+  std::cout << "Unknown joystick type: " << type << std::endl;
+  return 1;
+#else
+  std::cout << "Not built with allocation counting (make ALLOC_COUNT=1)" << std::endl;
+  return 1;
+#endif
+}
+
+/* Traces */
+int record_axes(Joystick const & j, Updated & u, char const * path, double seconds)
+{
+  trace::AxisTraceWriter writer (path);
+  auto const frequency = get_qpc_frequency();
+  auto const endTicks = get_qpc_ticks() + static_cast<std::int64_t>(seconds * frequency);
+  trace::axes_t axes;
+  timeBeginPeriod(1);
+  while (true)
+  {
+    auto const now = get_qpc_ticks();
+    if (now >= endTicks)
+      break;
+    u.update();
+    for (int i = AxisID::first; i < AxisID::num; ++i)
+      axes[i] = j.get_axis_value(static_cast<AxisID::type>(i));
+    writer.add(now, axes);
+    Sleep(1);
+  }
+  timeEndPeriod(1);
+  std::cout << "Recorded " << writer.get_records() << " samples to " << path << std::endl;
+  return 0;
+}
+
+int record(int argc, char** argv)
+{
+  if (argc < 3)
+  {
+    std::cout << "params: legacy|di8|mock joystick_num|joystick_name|period path [seconds]" << std::endl;
+    return 1;
+  }
+  std::string const type (argv[0]);
+  auto const path = argv[2];
+  auto const seconds = (argc > 3) ? atof(argv[3]) : 10.0;
+  if (type == "legacy")
+  {
+    LegacyJoystick j (atoi(argv[1]));
+    return record_axes(j, j, path, seconds);
+  }
+  else if (type == "di8")
+  {
+    DInput8JoystickManager manager;
+    auto spj = manager.make_joystick_by_name(argv[1]);
+    return record_axes(*spj, *spj, path, seconds);
+  }
+  else if (type == "mock")
+  {
+    MockJoystick j (atof(argv[1]));
+    return record_axes(j, j, path, seconds);
+  }
+  std::cout << "Unknown joystick type: " << type << std::endl;
+  return 1;
+}
+
+int print_replay(char const * path, double speed)
+{
+  ReplayJoystick j (path, speed, false);
+  std::cout << std::fixed << std::setprecision(2) << std::showpos;
+  while(true)
+  {
+    j.update();
+    std::cout <<
+      "x: " << j.get_axis_value(AxisID::x) <<
+      "; y: " << j.get_axis_value(AxisID::y) <<
+      "; z: " << j.get_axis_value(AxisID::z) <<
+      "; rx: " << j.get_axis_value(AxisID::rx) <<
+      "; ry: " << j.get_axis_value(AxisID::ry) <<
+      "; rz: " << j.get_axis_value(AxisID::rz) <<
+      std::endl;
+    Sleep(10);
+  }
+  return 0;
+}
+
+int capture_events(char const * joyName, char const * path, double seconds)
+{
+  trace::EventTraceWriter writer (path);
+  DInput8JoystickManager manager;
+  auto spj = manager.make_joystick_by_name(joyName);
+  spj->set_capture(writer.add_device(joyName));
+  auto const endTicks = get_qpc_ticks() + static_cast<std::int64_t>(seconds * get_qpc_frequency());
+  timeBeginPeriod(1);
+  while (get_qpc_ticks() < endTicks)
+  {
+    manager.update();
+    spj->update();
+    Sleep(1);
+  }
+  timeEndPeriod(1);
+  spj->set_capture(NULL);
+  std::cout << "Captured " << writer.get_events() << " events, dropped " << writer.get_dropped() << std::endl;
+  return 0;
+}
+
+int print_capture(char const * path)
+{
+  trace::EventTraceReader reader (path);
+  auto const frequency = reader.get_qpc_frequency();
+  trace::DeviceEvent e;
+  std::uint64_t events = 0;
+  while (reader.next(e))
+  {
+    std::cout <<
+      "t: " << std::fixed << std::setprecision(3) << 1000.0 * (e.ticks - reader.get_start_ticks()) / frequency << " ms" <<
+      "; device: " << reader.get_device_name(e.device) <<
+      "; ofs: " << e.ofs << "; data: " << e.data << "; timeStamp: " << e.timeStamp << "; sequence: " << e.sequence << std::endl;
+    ++events;
+  }
+  std::cout << events << " events" << std::endl;
+  return 0;
+}
+
 /* DirectInput8 */
 BOOL __stdcall enum_devices_cb(LPCDIDEVICEINSTANCE lpddi, LPVOID pvRef)
 {
@@ -354,17 +562,342 @@ void test_dinput(int argc, char** argv)
   }
 }
 
+/* Backend comparison */
+class BenchBackend
+{
+public:
+  /* Reads the device; returns true if the observed state has changed. */
+  virtual bool read() =0;
+  virtual char const * get_name() const =0;
+
+  virtual ~BenchBackend() =default;
+};
+
+class JoystickBenchBackend : public BenchBackend
+{
+public:
+  virtual bool read() override
+  {
+    spUpdated_->update();
+    bool changed = false;
+    for (int ai = AxisID::first; ai < AxisID::num; ++ai)
+    {
+      auto const v = spJoystick_->get_axis_value(static_cast<AxisID::type>(ai));
+      if (v != axes_.at(ai))
+      {
+        axes_.at(ai) = v;
+        changed = true;
+      }
+    }
+    return changed;
+  }
+
+  virtual char const * get_name() const override { return name_; }
+
+  JoystickBenchBackend(char const * name, std::shared_ptr<Joystick> const & spJoystick, std::shared_ptr<Updated> const & spUpdated)
+    : name_(name), spJoystick_(spJoystick), spUpdated_(spUpdated)
+  {
+    axes_.fill(0.0f);
+  }
+
+private:
+  char const * name_;
+  std::shared_ptr<Joystick> spJoystick_;
+  std::shared_ptr<Updated> spUpdated_;
+  std::array<float, AxisID::num> axes_;
+};
+
+class DInput8ImmediateBenchBackend : public BenchBackend
+{
+public:
+  virtual bool read() override
+  {
+    pdid_->Poll();
+    DIJOYSTATE state;
+    auto const result = pdid_->GetDeviceState(sizeof(state), &state);
+    if (FAILED(result))
+      throw std::runtime_error("Failed to get device state");
+    /* Axes and sliders only */
+    auto const n = offsetof(DIJOYSTATE, rgdwPOV);
+    auto const changed = memcmp(&state, &state_, n) != 0;
+    memcpy(&state_, &state, n);
+    return changed;
+  }
+
+  virtual char const * get_name() const override { return "di8 immediate"; }
+
+  /* Takes ownership of pdid */
+  DInput8ImmediateBenchBackend(LPDIRECTINPUTDEVICE8A pdid) : pdid_(pdid)
+  {
+    if (FAILED(pdid_->SetDataFormat(&c_dfDIJoystick)))
+    {
+      pdid_->Release();
+      throw std::runtime_error("Failed to set data format");
+    }
+    if (FAILED(pdid_->Acquire()))
+    {
+      pdid_->Release();
+      throw std::runtime_error("Failed to acquire");
+    }
+    memset(&state_, 0, sizeof(state_));
+  }
+
+  ~DInput8ImmediateBenchBackend()
+  {
+    pdid_->Unacquire();
+    pdid_->Release();
+  }
+
+private:
+  LPDIRECTINPUTDEVICE8A pdid_;
+  DIJOYSTATE state_;
+};
+
+class RawInputBenchBackend : public BenchBackend
+{
+public:
+  virtual bool read() override
+  {
+    changed_ = false;
+    ris_.run_once();
+    return changed_;
+  }
+
+  virtual char const * get_name() const override { return "raw input"; }
+
+  RawInputBenchBackend(RawDeviceInfo const & rdi) : ris_("RawInputBench"), changed_(false)
+  {
+    ris_.track(rdi, [this](RAWINPUT const & ri)
+    {
+      auto const & hid = ri.data.hid;
+      auto const begin = hid.bRawData;
+      auto const end = begin + hid.dwSizeHid;
+      if (report_.size() != hid.dwSizeHid || !std::equal(begin, end, report_.begin()))
+      {
+        report_.assign(begin, end);
+        changed_ = true;
+      }
+    });
+  }
+
+private:
+  RawInputSource ris_;
+  std::vector<BYTE> report_;
+  bool changed_;
+};
+
+/* Onset of motion is the first change seen by any backend after a quiet period.
+   Lag of a backend is the time from onset until it sees the change itself. */
+struct BenchStats
+{
+  std::uint64_t reads = 0;
+  std::uint64_t changes = 0;
+  std::int64_t readTicks = 0;
+  std::int64_t maxReadTicks = 0;
+  std::uint64_t onsets = 0;
+  std::int64_t lagTicks = 0;
+  std::int64_t maxLagTicks = 0;
+  std::uint64_t lastOnset = 0;
+};
+
+int bench(int argc, char** argv)
+{
+  if (argc < 2)
+  {
+    std::cout << "params: legacy_joystick_num|-1 di8_joystick_name [seconds]" << std::endl;
+    return 1;
+  }
+  auto const legacyID = atoi(argv[0]);
+  auto const di8Name = argv[1];
+  auto const seconds = (argc > 2) ? atof(argv[2]) : 30.0;
+
+  std::vector<std::unique_ptr<BenchBackend> > backends;
+  auto add_backend = [&backends](char const * name, std::function<BenchBackend*()> const & make)
+  {
+    try {
+      backends.emplace_back(make());
+    } catch (std::exception & e)
+    {
+      std::cout << "Skipping " << name << " (" << e.what() << ")" << std::endl;
+    }
+  };
+
+  if (legacyID >= 0)
+    add_backend("legacy", [legacyID]()
+    {
+      auto spj = std::make_shared<LegacyJoystick>(legacyID);
+      return new JoystickBenchBackend("legacy", spj, spj);
+    });
+
+  DInput8JoystickManager manager;
+  add_backend("di8 buffered", [&manager, di8Name]()
+  {
+    auto spj = manager.make_joystick_by_name(di8Name);
+    return new JoystickBenchBackend("di8 buffered", spj, spj);
+  });
+
+  LPDIRECTINPUT8A pdi = NULL;
+  if (FAILED(DirectInput8Create(GetModuleHandle(NULL), 0x800, IID_IDirectInput8, reinterpret_cast<void**>(&pdi), NULL)))
+    throw std::runtime_error("Failed to create DirectInput8");
+  auto const & infos = manager.get_joysticks_info();
+  add_backend("di8 immediate", [pdi, &infos, di8Name]()
+  {
+    return new DInput8ImmediateBenchBackend(create_device_by_name(pdi, infos, di8Name));
+  });
+
+  add_backend("raw input", [&infos, di8Name]() -> BenchBackend*
+  {
+    auto itInfo = std::find_if(infos.begin(), infos.end(), [di8Name](DI8DeviceInfo const & info) { return strcmp(info.info.tszInstanceName, di8Name) == 0; });
+    if (itInfo == infos.end())
+      throw std::runtime_error("DirectInput8 device not found");
+    /* DirectInput product GUID holds MAKELONG(vendor id, product id) */
+    auto const vendorID = LOWORD(itInfo->info.guidProduct.Data1);
+    auto const productID = HIWORD(itInfo->info.guidProduct.Data1);
+    for (auto const & rdi : get_raw_devices())
+      if (rdi.type == RIM_TYPEHID && rdi.vendorID == vendorID && rdi.productID == productID)
+        return new RawInputBenchBackend(rdi);
+    throw std::runtime_error("Raw input device not found");
+  });
+
+  if (backends.empty())
+  {
+    pdi->Release();
+    return 1;
+  }
+
+  std::cout << "Move the device in short bursts separated by pauses for " << seconds << " s" << std::endl;
+  auto const frequency = get_qpc_frequency();
+  auto const quietTicks = frequency / 5;
+  auto const endTicks = get_qpc_ticks() + static_cast<std::int64_t>(seconds * frequency);
+  std::vector<BenchStats> stats (backends.size());
+  std::int64_t lastChange = 0, onsetTime = 0;
+  std::uint64_t onset = 0;
+  for (size_t iteration = 0; get_qpc_ticks() < endTicks; ++iteration)
+  {
+    /* Rotate read order so no backend is always read first */
+    for (size_t k = 0; k < backends.size(); ++k)
+    {
+      auto const i = (iteration + k) % backends.size();
+      auto & s = stats.at(i);
+      auto const begin = get_qpc_ticks();
+      auto const changed = backends.at(i)->read();
+      auto const end = get_qpc_ticks();
+      auto const readTicks = end - begin;
+      ++s.reads;
+      s.readTicks += readTicks;
+      s.maxReadTicks = std::max(s.maxReadTicks, readTicks);
+      if (!changed)
+        continue;
+      ++s.changes;
+      if (end - lastChange > quietTicks)
+      {
+        ++onset;
+        onsetTime = end;
+      }
+      lastChange = end;
+      if (s.lastOnset != onset)
+      {
+        s.lastOnset = onset;
+        auto const lag = end - onsetTime;
+        ++s.onsets;
+        s.lagTicks += lag;
+        s.maxLagTicks = std::max(s.maxLagTicks, lag);
+      }
+    }
+  }
+
+  std::cout << std::fixed << std::setprecision(3);
+  for (size_t i = 0; i < backends.size(); ++i)
+  {
+    auto const & s = stats.at(i);
+    std::cout << backends.at(i)->get_name()
+      << ": reads: " << s.reads
+      << "; read cost (mean/max us): " << qpc_ticks_to_us(s.reads ? s.readTicks / static_cast<std::int64_t>(s.reads) : 0) << "/" << qpc_ticks_to_us(s.maxReadTicks)
+      << "; updates/s: " << s.changes / seconds
+      << "; onsets seen: " << s.onsets << "/" << onset
+      << "; lag behind first observer (mean/max ms): " << qpc_ticks_to_ms(s.onsets ? s.lagTicks / static_cast<std::int64_t>(s.onsets) : 0) << "/" << qpc_ticks_to_ms(s.maxLagTicks)
+      << std::endl;
+  }
+  backends.clear();
+  pdi->Release();
+  return 0;
+}
+
+int print_di8_mode_stats(int argc, char** argv)
+{
+  if (argc < 2)
+  {
+    std::cout << "params: di8_joystick_name buffered|immediate|auto [seconds]" << std::endl;
+    return 1;
+  }
+  auto const di8Name = argv[0];
+  auto const mode = DI8Mode::from_cstr(argv[1]);
+  if (mode == DI8Mode::num)
+  {
+    std::cout << "Unknown mode: " << argv[1] << std::endl;
+    return 1;
+  }
+  auto const seconds = (argc > 2) ? atof(argv[2]) : 30.0;
+
+  DInput8JoystickManager manager;
+  auto spj = manager.make_joystick_by_name(di8Name, mode);
+  auto const frequency = get_qpc_frequency();
+  auto const endTicks = get_qpc_ticks() + static_cast<std::int64_t>(seconds * frequency);
+  auto nextPrint = get_qpc_ticks() + frequency;
+  timeBeginPeriod(1);
+  while (get_qpc_ticks() < endTicks)
+  {
+    spj->update();
+    if (get_qpc_ticks() >= nextPrint)
+    {
+      std::cout << di8modestats_to_str(spj->get_mode_stats()) << std::endl;
+      nextPrint += frequency;
+    }
+    Sleep(1);
+  }
+  timeEndPeriod(1);
+  return 0;
+}
+
+int send_control_command(char const * pipeName, char const * command)
+{
+  auto const path = std::string("\\\\.\\pipe\\") + pipeName;
+  std::vector<char> reply (65536);
+  DWORD replySize = 0;
+  if (!CallNamedPipeA(path.c_str(), const_cast<char *>(command), strlen(command), reply.data(), reply.size(), &replySize, 2000))
+  {
+    std::cout << "Failed to send command to " << path << ", error = " << GetLastError() << std::endl;
+    return 1;
+  }
+  std::cout << std::string(reply.data(), replySize) << std::endl;
+  return 0;
+}
+
 int main(int argc, char** argv)
 {
   if (argc == 1)
   {
     std::cout
       << "Usage: " << argv[0] << " mode params\n"
-      << "mode=list|print|list_raw|window\n"
+      << "mode=list|print|print_rawhid|print_xinput|print_udp|udp_send|udp_sink_check|print_freetrack|record|replay|capture|print_capture|list_raw|window|alloc_check|bench|di8_mode|control\n"
       << "list: list joysticks\n"
       << "print: print joystick axes values; params: joystick_num\n"
+      << "print_rawhid: print raw input HID joystick axes values; params: vid pid [index] (hex vid/pid)\n"
+      << "print_xinput: print XInput gamepad axes values; params: slot\n"
+      << "print_udp: print poses received over UDP as axes values; params: [port] [thread]\n"
+      << "udp_send: send test poses over UDP; params: [address] [port] [rate_hz] [seconds]\n"
+      << "udp_sink_check: send poses through the UDP output to a loopback receiver and verify contents and rate; params: [port] [rate_hz] [seconds]\n"
+      << "print_freetrack: print pose from FreeTrack shared memory as axes values; params: [raw]\n"
+      << "record: record joystick axes to a trace file; params: legacy|di8|mock joystick_num|joystick_name|period path [seconds]\n"
+      << "replay: print axes values replayed from a trace file; params: path [speed]\n"
+      << "capture: capture buffered events of a DirectInput8 joystick to an event trace; params: di8_joystick_name path [seconds]\n"
+      << "print_capture: print events from an event trace; params: path\n"
       << "list_raw: list raw devices\n"
-      << "window: create and destroy window\n";
+      << "window: create and destroy window\n"
+      << "alloc_check: fail if joystick updates allocate; params: legacy|di8 joystick_num|joystick_name [frames]\n"
+      << "bench: compare read cost, update rate and lag of input APIs for one device; params: legacy_joystick_num|-1 di8_joystick_name [seconds]\n"
+      << "di8_mode: update a DirectInput8 joystick every 1 ms and print read mode stats each second; params: di8_joystick_name buffered|immediate|auto [seconds]\n"
+      << "control: send a JSON command to a control pipe (config \"controlPipe\") and print the reply; params: pipe_name json, e.g. joy2tir '{\"cmd\": \"stats\"}'\n";
     return 0;
   }
 
@@ -380,6 +913,82 @@ int main(int argc, char** argv)
     ss >> joyID;
     return print_legacy_joystick(joyID);
   }
+  else if (mode == "print_rawhid")
+  {
+    if (argc < 4)
+    {
+      std::cout << "Need vid and pid" << std::endl;
+      return 1;
+    }
+    auto const vid = strtoul(argv[2], nullptr, 16);
+    auto const pid = strtoul(argv[3], nullptr, 16);
+    auto const index = (argc > 4) ? atoi(argv[4]) : 0;
+    return print_rawhid_joystick(vid, pid, index);
+  }
+  else if (mode == "print_xinput")
+  {
+    auto const slot = (argc > 2) ? atoi(argv[2]) : 0;
+    return print_xinput_joystick(slot);
+  }
+  else if (mode == "print_udp")
+  {
+    auto const port = (argc > 2) ? atoi(argv[2]) : 4242;
+    auto const useThread = (argc > 3) ? atoi(argv[3]) != 0 : false;
+    return print_udp_joystick(port, useThread);
+  }
+  else if (mode == "udp_send")
+  {
+    auto const address = (argc > 2) ? argv[2] : "127.0.0.1";
+    auto const port = (argc > 3) ? atoi(argv[3]) : 4242;
+    auto const rate = (argc > 4) ? atof(argv[4]) : 250.0;
+    auto const seconds = (argc > 5) ? atof(argv[5]) : 30.0;
+    return send_udp_poses(address, port, rate, seconds);
+  }
+  else if (mode == "udp_sink_check")
+  {
+    auto const port = (argc > 2) ? atoi(argv[2]) : 4243;
+    auto const rate = (argc > 3) ? atof(argv[3]) : 250.0;
+    auto const seconds = (argc > 4) ? atof(argv[4]) : 5.0;
+    return check_udp_sink(port, rate, seconds);
+  }
+  else if (mode == "print_freetrack")
+  {
+    auto const useRaw = (argc > 2) ? atoi(argv[2]) != 0 : false;
+    return print_freetrack_joystick(useRaw);
+  }
+  else if (mode == "record")
+  {
+    return record(argc - 2, argv + 2);
+  }
+  else if (mode == "replay")
+  {
+    if (argc < 3)
+    {
+      std::cout << "Need trace path" << std::endl;
+      return 1;
+    }
+    auto const speed = (argc > 3) ? atof(argv[3]) : 1.0;
+    return print_replay(argv[2], speed);
+  }
+  else if (mode == "capture")
+  {
+    if (argc < 4)
+    {
+      std::cout << "Need joystick name and trace path" << std::endl;
+      return 1;
+    }
+    auto const seconds = (argc > 4) ? atof(argv[4]) : 10.0;
+    return capture_events(argv[2], argv[3], seconds);
+  }
+  else if (mode == "print_capture")
+  {
+    if (argc < 3)
+    {
+      std::cout << "Need trace path" << std::endl;
+      return 1;
+    }
+    return print_capture(argv[2]);
+  }
   else if (mode == "list_raw")
   {
     auto deviceInfos = get_raw_devices();
@@ -421,6 +1030,27 @@ int main(int argc, char** argv)
     }
     return 0;
   }
+  else if (mode == "alloc_check")
+  {
+    return check_allocs(argc - 2, argv + 2);
+  }
+  else if (mode == "bench")
+  {
+    return bench(argc - 2, argv + 2);
+  }
+  else if (mode == "di8_mode")
+  {
+    return print_di8_mode_stats(argc - 2, argv + 2);
+  }
+  else if (mode == "control")
+  {
+    if (argc < 4)
+    {
+      std::cout << "Need pipe name and command" << std::endl;
+      return 1;
+    }
+    return send_control_command(argv[2], argv[3]);
+  }
   else if (mode == "test_dinput")
   {
     argc -= 2;
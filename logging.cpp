@@ -1,6 +1,8 @@
 #include "logging.hpp"
+#include "thread.hpp"
 #include <cstdlib>
 #include <cstring>
+#include <ctime>
 
 namespace logging
 {
@@ -38,6 +40,16 @@ LogMessage::LogMessage(std::string const & source, LogLevel level, std::time_t c
   : source(source), level(level), time(time), msg(msg)
 {}
 
+std::string format_message(LogMessage const & lm)
+{
+  static char const fmt[] = "%H:%M:%S";
+  size_t const n = 128;
+  char timeCstr[n] = {0};
+  auto time = std::localtime(&lm.time);
+  std::strftime(timeCstr, n, fmt, time);
+  return stream_to_str("(", lm.source, ") <", timeCstr, "> [", lm.level, "] ", lm.msg);
+}
+
 void StreamLogPrinter::print(LogMessage const & lm) const
 {
   auto const msg = formatter_(lm);
@@ -50,20 +62,23 @@ StreamLogPrinter::StreamLogPrinter(formatter_t const & formatter, stream_holder_
 
 void Logger::log(LogMessage const & lm)
 {
-  if (static_cast<int>(lm.level) < static_cast<int>(level_))
+  if (static_cast<int>(lm.level) < static_cast<int>(get_level()))
     return;
+  /* Messages may come from background threads */
+  static CriticalSection cs;
+  ScopedLock<CriticalSection> lock (cs);
   for (auto const & sp : printers_)
     sp->print(lm);
 }
 
 void Logger::set_level(LogLevel level)
 {
-  level_ = level;
+  level_.store(level, std::memory_order_relaxed);
 }
 
 LogLevel Logger::get_level() const
 {
-  return level_;
+  return level_.load(std::memory_order_relaxed);
 }
 
 void Logger::add_printer(std::shared_ptr<LogPrinter> const & spPrinter)
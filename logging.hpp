@@ -7,6 +7,7 @@
 #include <vector>
 #include <functional>
 #include <memory>
+#include <atomic>
 #include <ctime>
 
 /* Logging */
@@ -34,6 +35,9 @@ struct LogMessage
   LogMessage(std::string const & source, LogLevel level, std::time_t const & time, std::string const & msg);
 };
 
+/* "(source) <HH:MM:SS> [level] msg" */
+std::string format_message(LogMessage const & lm);
+
 class LogPrinter
 {
 public:
@@ -63,7 +67,7 @@ public:
   template <typename... T>
   void log(char const * source, LogLevel level, const T&... t)
   {
-    if (static_cast<int>(level) < static_cast<int>(level_))
+    if (static_cast<int>(level) < static_cast<int>(get_level()))
       return;
     auto const msg = stream_to_str(t...);
     auto const time = std::time(nullptr);
@@ -73,6 +77,7 @@ public:
 
   void log(LogMessage const & lm);
 
+  /* Thread-safe, e.g. for the control channel */
   void set_level(LogLevel level);
   LogLevel get_level() const;
 
@@ -81,7 +86,7 @@ public:
   Logger(LogLevel level=LogLevel::notset);
 
 private:
-  LogLevel level_;
+  std::atomic<LogLevel> level_;
   std::vector<std::shared_ptr<LogPrinter> > printers_;
 };
 
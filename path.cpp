@@ -49,3 +49,16 @@ std::string & append_to_path(std::string & path, std::string const & name)
   append_to_path(path, name.c_str());
   return path;
 }
+
+bool is_absolute_path(std::string const & path)
+{
+  return (path.size() > 1 && path[1] == ':') || (path.size() > 0 && (path[0] == '\\' || path[0] == '/'));
+}
+
+std::string make_module_path(std::string const & path)
+{
+  if (is_absolute_path(path))
+    return path;
+  auto result = get_dir_to_module();
+  return append_to_path(result, path);
+}
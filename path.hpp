@@ -14,4 +14,9 @@ std::string & append_to_path(std::string & path, char const * name);
 
 std::string & append_to_path(std::string & path, std::string const & name);
 
+bool is_absolute_path(std::string const & path);
+
+/* Relative paths are taken relative to the module directory */
+std::string make_module_path(std::string const & path);
+
 #endif
@@ -0,0 +1,484 @@
+#include "pipeline.hpp"
+#include "config.hpp"
+#include "rawinput.hpp"
+#include "xinput.hpp"
+#include "udp.hpp"
+#include "freetrack.hpp"
+#include "trace.hpp"
+#include "shared_pose.hpp"
+#include "logging.hpp"
+#include "util.hpp"
+#include "guid.hpp"
+#include "path.hpp"
+#include "timing.hpp"
+#include "clock.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+
+void log_devices(DInput8JoystickManager const & di8JoyManager, int mode)
+{
+  logging::log("init", logging::LogLevel::info, "======Legacy joysticks======");
+  auto const legacyJoysticksInfo = get_legacy_joysticks_info();
+  for (decltype(legacyJoysticksInfo)::size_type joyID = 0; joyID < legacyJoysticksInfo.size(); ++joyID)
+  {
+    auto const & info = legacyJoysticksInfo.at(joyID);
+    logging::log("init", logging::LogLevel::info, "id: ", joyID, "; ", legacyjoystickinfo_to_str(info, mode));
+  }
+  logging::log("init", logging::LogLevel::info, "============================");
+  logging::log("init", logging::LogLevel::info, "===DirectInput8 joysticks===");
+  for (auto const & info : di8JoyManager.get_joysticks_info())
+  {
+    logging::log("init", logging::LogLevel::info, di8deviceinfo_to_str(info, mode));
+  }
+  logging::log("init", logging::LogLevel::info, "============================");
+  logging::log("init", logging::LogLevel::info, "=====Raw input HID devices=====");
+  for (auto const & rdi : get_raw_devices())
+  {
+    if (rdi.type == RIM_TYPEHID)
+      logging::log("init", logging::LogLevel::info, rdi);
+  }
+  logging::log("init", logging::LogLevel::info, "===============================");
+  logging::log("init", logging::LogLevel::info, "=======XInput gamepads=======");
+  try {
+    XInputManager xim;
+    for (DWORD slot = 0; slot < XInputManager::numSlots; ++slot)
+    {
+      xim.use_slot(slot);
+      logging::log("init", logging::LogLevel::info, "slot: ", slot, "; connected: ", xim.is_connected(slot));
+    }
+  } catch (std::runtime_error & e)
+  {
+    logging::log("init", logging::LogLevel::info, e.what());
+  }
+  logging::log("init", logging::LogLevel::info, "============================");
+}
+
+/* Pipeline */
+void Pipeline::update()
+{
+  if (statsRequested_.exchange(false, std::memory_order_relaxed))
+    log_stats();
+  for (auto const & sp : updated_)
+    try
+    {
+      sp->update();
+    }
+    catch (std::runtime_error & e)
+    {
+      logging::log("main", logging::LogLevel::error, e.what());
+    }
+}
+
+Pose Pipeline::make_pose()
+{
+  auto pose = spPoseFactory_->make_pose();
+  auto const recenter = recenterRequest_.exchange(recenterNone, std::memory_order_relaxed);
+  if (recenter == recenterSet)
+    center_ = pose;
+  else if (recenter == recenterReset)
+    center_ = Pose(0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f);
+  pose.yaw -= center_.yaw;
+  pose.pitch -= center_.pitch;
+  pose.roll -= center_.roll;
+  pose.x -= center_.x;
+  pose.y -= center_.y;
+  pose.z -= center_.z;
+  for (auto const & sp : sinks_)
+    sp->put_pose(pose);
+  return pose;
+}
+
+void Pipeline::set_limits(PoseMemberID::type poseMemberID, AxisPoseFactory::limits_t const & limits)
+{
+  spPoseFactory_->set_limits(poseMemberID, limits);
+  logging::log("main", logging::LogLevel::info, "Limits of ", PoseMemberID::to_cstr(poseMemberID), " set to [", limits.first, ", ", limits.second, "]");
+}
+
+AxisPoseFactory::limits_t Pipeline::get_limits(PoseMemberID::type poseMemberID) const
+{
+  return spPoseFactory_->get_limits(poseMemberID);
+}
+
+void Pipeline::request_recenter(bool reset)
+{
+  recenterRequest_.store(reset ? recenterReset : recenterSet, std::memory_order_relaxed);
+}
+
+void Pipeline::request_stats()
+{
+  statsRequested_.store(true, std::memory_order_relaxed);
+}
+
+void Pipeline::log_stats() const
+{
+  log_joystick_stats_();
+  for (auto const & sp : sinks_)
+  {
+    if (auto const spUdpSink = std::dynamic_pointer_cast<UdpPoseSink>(sp))
+      logging::log("main", logging::LogLevel::info, "UDP output sent ", spUdpSink->get_sent(), " datagrams, dropped ", spUdpSink->get_dropped());
+  }
+  logging::log("main", logging::LogLevel::info, "Center: ", center_);
+}
+
+void Pipeline::log_joystick_stats_() const
+{
+  for (auto const & j : joysticks_)
+  {
+    if (auto const spdij = std::dynamic_pointer_cast<DInput8Joystick>(j.second))
+      logging::log("main", logging::LogLevel::info, "Joystick '", j.first, "' read stats: ", di8modestats_to_str(spdij->get_mode_stats()));
+  }
+}
+
+void Pipeline::carry_state(Pipeline const & previous)
+{
+  center_ = previous.center_;
+}
+
+DInput8JoystickManager & Pipeline::get_di8_manager_()
+{
+  if (!spDI8JoyManager_)
+  {
+    spDI8JoyManager_ = std::make_shared<DInput8JoystickManager>();
+    updated_.push_back(spDI8JoyManager_);
+  }
+  return *spDI8JoyManager_;
+}
+
+bool Pipeline::carry_joystick_(Pipeline const & previous, std::string const & name, nlohmann::json const & cfg, AxisID::mask_t usedAxes, bool captureCarried)
+{
+  auto const itEntry = previous.joystickEntries_.find(name);
+  auto const itJoystick = previous.joysticks_.find(name);
+  if (itEntry == previous.joystickEntries_.end() || itJoystick == previous.joysticks_.end())
+    return false;
+  auto const & entry = itEntry->second;
+  if (entry.config != cfg)
+    return false;
+  auto const type = get_d<std::string>(cfg, "type", "");
+  /* Only these are set up for the axes used; the others, e.g. a UDP joystick holding its port, are the same device whatever the mapping */
+  if ((type == "legacy" || type == "di8") && entry.usedAxes != usedAxes)
+    return false;
+  /* XInput joysticks share a manager that the previous pipeline keeps updating; they are cheap to create */
+  if (type == "xinput")
+    return false;
+  /* Their events go to the rings of the previous capture */
+  if (type == "di8" && !captureCarried)
+    return false;
+  auto const & spj = itJoystick->second;
+  joysticks_[name] = spj;
+  joystickEntries_[name] = entry;
+  /* Updated directly, also DirectInput8 joysticks: their manager is not updated by this pipeline */
+  if (auto const spUpdated = std::dynamic_pointer_cast<Updated>(spj))
+  {
+    if (std::find(updated_.begin(), updated_.end(), spUpdated) == updated_.end())
+      updated_.push_back(spUpdated);
+  }
+  if (entry.spOwner && std::find(carriedDI8JoyManagers_.begin(), carriedDI8JoyManagers_.end(), entry.spOwner) == carriedDI8JoyManagers_.end())
+    carriedDI8JoyManagers_.push_back(entry.spOwner);
+  logging::log("init", logging::LogLevel::info, "Carried over joystick '", name, "'");
+  return true;
+}
+
+Pipeline::Pipeline(nlohmann::json const & config, Pipeline const * pPrevious)
+  : recenterRequest_(recenterNone), statsRequested_(false), center_(0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f)
+{
+  auto & timer = startup_timer();
+  /* On reload a DirectInput8 manager is only created for new devices, since the previous one is still being updated */
+  if (pPrevious == NULL)
+  {
+    get_di8_manager_();
+    if (get_d<bool>(config, "printJoysticks", false))
+      log_devices(*spDI8JoyManager_, get_d<int>(config, "printJoysticksMode", 1));
+  }
+  else
+  {
+    /* Registers devices thread-safely, and there can only be one receiver of raw input per device class */
+    spRawInputThread_ = pPrevious->spRawInputThread_;
+  }
+
+  /* Axes referenced by mapping, so devices can skip the rest */
+  std::map<std::string, AxisID::mask_t> usedAxes;
+  for (auto const & m : config.at("mapping"))
+  {
+    if (!m.contains("joystick") || !m.contains("joyAxis"))
+      continue;
+    auto const axisID = AxisID::from_cstr(m.at("joyAxis").get<std::string>().c_str());
+    if (axisID != AxisID::num)
+      usedAxes[m.at("joystick").get<std::string>()] |= AxisID::to_mask(axisID);
+  }
+
+  captureConfig_ = config.contains("capture") ? config.at("capture") : nlohmann::json();
+  auto const captureCarried = pPrevious != NULL && pPrevious->captureConfig_ == captureConfig_;
+  if (captureCarried)
+    spCapture_ = pPrevious->spCapture_;
+  else if (config.contains("capture"))
+  {
+    auto const & captureCfg = config.at("capture");
+    auto const capturePath = make_module_path(get_d<std::string>(captureCfg, "path", "NPClient.events"));
+    auto const ringSize = get_d<unsigned>(captureCfg, "ringSize", 4096);
+    auto const flushPeriod = get_d<unsigned>(captureCfg, "flushPeriod", 100);
+    spCapture_ = std::make_shared<trace::EventTraceWriter>(capturePath, ringSize, flushPeriod);
+    logging::log("init", logging::LogLevel::info, "Capturing device events to: ", capturePath);
+  }
+
+  auto const joysticksBegin = get_qpc_ticks();
+  auto const & joysticks = config.at("joysticks");
+  for (auto const & j : joysticks.items())
+  {
+    auto const name = j.key();
+    auto const cfg = j.value();
+    try {
+      if (pPrevious != NULL && carry_joystick_(*pPrevious, name, cfg, usedAxes[name], captureCarried))
+        continue;
+      auto const type = get_d<std::string>(cfg, "type", "");
+      if (type == "legacy")
+      {
+        auto const joyID = get_d<UINT>(cfg, "id", 0);
+        auto const reprobePeriod = get_d<DWORD>(cfg, "reprobePeriod", 1000);
+        auto const spj = std::make_shared<LegacyJoystick>(joyID, usedAxes[name], reprobePeriod);
+        joysticks_[name] = spj;
+        updated_.push_back(spj);
+      }
+      else if (type == "di8")
+      {
+        auto & di8JoyManager = get_di8_manager_();
+        std::shared_ptr<DInput8Joystick> spj;
+        auto const modeName = get_d<std::string>(cfg, "mode", "buffered");
+        auto const mode = DI8Mode::from_cstr(modeName.c_str());
+        if (mode == DI8Mode::num)
+          throw std::runtime_error(stream_to_str("Unknown di8 mode: '", modeName, "'"));
+        auto const pollRate = get_d<float>(cfg, "pollRate", 250.0f);
+        auto const joyNameStr = get_d<std::string>(cfg, "name", "");
+        if (joyNameStr.size())
+          spj = di8JoyManager.make_joystick_by_name(joyNameStr.c_str(), mode, usedAxes[name], pollRate);
+        else
+        {
+          auto const joyGuidStr = get_d<std::string>(cfg, "guid", "");
+          if (joyGuidStr.size())
+          {
+            spj = di8JoyManager.make_joystick_by_guid(str2guid(joyGuidStr.c_str()), mode, usedAxes[name], pollRate);
+          }
+          else
+            throw std::runtime_error("Need to specify either name or guid");
+        }
+        if (spCapture_ && spj->get_capture() == NULL)
+          spj->set_capture(spCapture_->add_device(name));
+        joysticks_[name] = spj;
+      }
+      else if (type == "rawhid")
+      {
+        auto const vid = std::strtoul(get_d<std::string>(cfg, "vid", "0").c_str(), nullptr, 16);
+        auto const pid = std::strtoul(get_d<std::string>(cfg, "pid", "0").c_str(), nullptr, 16);
+        auto const index = get_d<unsigned>(cfg, "index", 0);
+        auto const rdi = find_raw_hid_device(vid, pid, index);
+        if (!spRawInputThread_)
+          spRawInputThread_ = std::make_shared<RawInputThread>();
+        auto const spj = std::make_shared<RawHIDJoystick>(spRawInputThread_, rdi);
+        joysticks_[name] = spj;
+        updated_.push_back(spj);
+      }
+      else if (type == "rawmouse")
+      {
+        auto const nameSubstr = get_d<std::string>(cfg, "name", "");
+        auto const sensitivity = get_d<float>(cfg, "sensitivity", 0.001f);
+        auto const sensitivityX = get_d<float>(cfg, "sensitivityX", float(sensitivity));
+        auto sensitivityY = get_d<float>(cfg, "sensitivityY", float(sensitivity));
+        if (get_d<bool>(cfg, "invertY", false))
+          sensitivityY = -sensitivityY;
+        if (!spRawInputThread_)
+          spRawInputThread_ = std::make_shared<RawInputThread>();
+        auto const spj = std::make_shared<RawMouseJoystick>(spRawInputThread_, nameSubstr, sensitivityX, sensitivityY);
+        joysticks_[name] = spj;
+        updated_.push_back(spj);
+      }
+      else if (type == "xinput")
+      {
+        auto const slot = get_d<DWORD>(cfg, "slot", 0);
+        if (!spXInputManager_)
+        {
+          spXInputManager_ = std::make_shared<XInputManager>();
+          updated_.push_back(spXInputManager_);
+        }
+        joysticks_[name] = std::make_shared<XInputJoystick>(spXInputManager_, slot);
+      }
+      else if (type == "udp")
+      {
+        auto const address = get_d<std::string>(cfg, "address", "0.0.0.0");
+        auto const port = get_d<unsigned short>(cfg, "port", 4242);
+        auto const useThread = get_d<bool>(cfg, "thread", false);
+        auto const translationRange = get_d<double>(cfg, "translationRange", 50.0);
+        auto const rotationRange = get_d<double>(cfg, "rotationRange", 180.0);
+        auto const spj = std::make_shared<UdpJoystick>(address.c_str(), port, useThread, translationRange, rotationRange);
+        joysticks_[name] = spj;
+        updated_.push_back(spj);
+      }
+      else if (type == "freetrack")
+      {
+        auto const useRaw = get_d<bool>(cfg, "raw", false);
+        auto const translationRange = get_d<double>(cfg, "translationRange", 50.0);
+        auto const rotationRange = get_d<double>(cfg, "rotationRange", 180.0);
+        auto const spj = std::make_shared<FreeTrackJoystick>(useRaw, translationRange, rotationRange);
+        joysticks_[name] = spj;
+        updated_.push_back(spj);
+      }
+      else if (type == "replay")
+      {
+        auto const path = make_module_path(get_d<std::string>(cfg, "path", ""));
+        auto const speed = get_d<double>(cfg, "speed", 1.0);
+        auto const loop = get_d<bool>(cfg, "loop", true);
+        auto const spj = std::make_shared<ReplayJoystick>(path, speed, loop);
+        joysticks_[name] = spj;
+        updated_.push_back(spj);
+      }
+      else if (type == "mock")
+      {
+        auto const period = get_d<float>(cfg, "period", 4.0f);
+        auto const spj = std::make_shared<MockJoystick>(period);
+        joysticks_[name] = spj;
+        updated_.push_back(spj);
+      }
+      else
+        throw std::runtime_error(stream_to_str("Unknown joystick type: '", type, "'"));
+      joystickEntries_[name] = JoystickEntry{ cfg, usedAxes[name], (type == "di8") ? spDI8JoyManager_ : nullptr };
+    } catch (std::runtime_error & e)
+    {
+      logging::log("init", logging::LogLevel::error, "Could not create joystick '", name, "' (", e.what(), ")");
+    }
+  }
+  timer.add("joysticks", joysticksBegin, get_qpc_ticks());
+
+  auto const mappingBegin = get_qpc_ticks();
+  auto spPoseFactory = std::make_shared<AxisPoseFactory>();
+  auto & mappings = config.at("mapping");
+  for (auto & m : mappings)
+  {
+    try {
+      auto const tirAxisName = m.at("tirAxis").get<std::string>();
+      auto poseMemberID = PoseMemberID::from_cstr(tirAxisName.c_str());
+      auto const joyName = m.at("joystick").get<std::string>();
+      auto axisID = AxisID::from_cstr(m.at("joyAxis").get<std::string>().c_str());
+      auto limits = AxisPoseFactory::limits_t(-1.0f, 1.0f);
+      if (m.contains("limits"))
+      {
+        auto const & l = m.at("limits");
+        limits.first = l[0].get<float>();
+        limits.second = l[1].get<float>();
+      }
+
+      auto itJoystick = joysticks_.find(joyName);
+      if (joysticks_.end() == itJoystick)
+      {
+        logging::log("init", logging::LogLevel::error, "Could not create mapping for TIR axis '", tirAxisName, "' (joystick '", joyName, "' was not created)");
+        continue;
+      }
+
+      auto spAxis = std::make_shared<JoystickAxis>(itJoystick->second, axisID);
+      spPoseFactory->set_mapping(poseMemberID, spAxis, limits);
+    }
+    catch (std::exception & e)
+    {
+      logging::log("init", logging::LogLevel::error, "Could not create mapping ", m, " (", e.what(), ")");
+    }
+  }
+  spPoseFactory_ = spPoseFactory;
+  timer.add("mapping", mappingBegin, get_qpc_ticks());
+
+  if (config.contains("outputs"))
+  {
+    ScopedPhase phase (timer, "outputs");
+    for (auto const & o : config.at("outputs"))
+    {
+      try {
+        auto const type = get_d<std::string>(o, "type", "");
+        if (type == "freetrack")
+          sinks_.push_back(std::make_shared<FreeTrackPoseSink>());
+        else if (type == "udp")
+        {
+          std::vector<UdpPoseSink::endpoint_t> endpoints;
+          if (o.contains("endpoints"))
+          {
+            for (auto const & e : o.at("endpoints"))
+              endpoints.push_back(UdpPoseSink::endpoint_t(get_d<std::string>(e, "address", "127.0.0.1"), get_d<unsigned short>(e, "port", 4242)));
+          }
+          else
+            endpoints.push_back(UdpPoseSink::endpoint_t(get_d<std::string>(o, "address", "127.0.0.1"), get_d<unsigned short>(o, "port", 4242)));
+          sinks_.push_back(std::make_shared<UdpPoseSink>(endpoints));
+        }
+        else
+          throw std::runtime_error(stream_to_str("Unknown output type: '", type, "'"));
+      } catch (std::runtime_error & e)
+      {
+        logging::log("init", logging::LogLevel::error, "Could not create output ", o, " (", e.what(), ")");
+      }
+    }
+  }
+}
+
+Pipeline::~Pipeline()
+{
+  log_joystick_stats_();
+  /* DirectInput8 joysticks not carried over to a later pipeline are released now, not when the last pipeline sharing their manager goes */
+  spPoseFactory_.reset();
+  updated_.clear();
+  joystickEntries_.clear();
+  joysticks_.clear();
+  if (spDI8JoyManager_)
+    spDI8JoyManager_->release_unused();
+  for (auto const & spManager : carriedDI8JoyManagers_)
+    spManager->release_unused();
+}
+
+/* PoseSource */
+decltype(PoseServerMode::names_) PoseServerMode::names_ = {"off", "auto", "require"};
+
+void PoseSource::update()
+{
+  if (spPipeline_)
+    spPipeline_->update();
+}
+
+void PoseSource::carry_state(PoseSource const & previous)
+{
+  serverPose_ = previous.serverPose_;
+  if (spPipeline_ && previous.spPipeline_)
+    spPipeline_->carry_state(*previous.spPipeline_);
+}
+
+Pose PoseSource::get_pose()
+{
+  if (spPipeline_)
+    return spPipeline_->make_pose();
+  auto const live = spPoseReader_->read(serverPose_);
+  if (live != live_)
+    logging::log("main", live ? logging::LogLevel::info : logging::LogLevel::error, live ? "Pose server is back" : "Pose server is gone, keeping the last pose");
+  live_ = live;
+  return serverPose_;
+}
+
+PoseSource::PoseSource(nlohmann::json const & config, PoseSource const * pPrevious) : serverPose_(0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f), live_(true)
+{
+  auto const poseServerModeName = get_d<std::string>(config, "poseServer", "off");
+  auto const poseServerMode = PoseServerMode::from_cstr(poseServerModeName.c_str());
+  if (poseServerMode == PoseServerMode::num)
+    throw std::runtime_error(stream_to_str("Unknown pose server mode: '", poseServerModeName, "'"));
+  if (poseServerMode != PoseServerMode::off)
+  {
+    ScopedPhase phase (startup_timer(), "poseServer");
+    auto const timeout = get_d<double>(config, "poseServerTimeout", 500.0);
+    std::unique_ptr<SharedPoseReader> spPoseReader (new SharedPoseReader(timeout));
+    if (poseServerMode == PoseServerMode::require || spPoseReader->read(serverPose_))
+    {
+      logging::log("init", logging::LogLevel::info, "Reading pose from pose server", (spPoseReader->is_open() ? "" : " (not running yet)"));
+      spPoseReader_ = std::move(spPoseReader);
+    }
+    else
+      logging::log("init", logging::LogLevel::info, "Pose server is not running, reading devices");
+  }
+  if (!spPoseReader_)
+    spPipeline_.reset(new Pipeline(config, (pPrevious != NULL) ? pPrevious->spPipeline_.get() : NULL));
+}
+
+PoseSource::~PoseSource()
+{
+}
@@ -0,0 +1,135 @@
+#ifndef PIPELINE_HPP
+#define PIPELINE_HPP
+
+#include "joystick.hpp"
+#include "pose.hpp"
+
+#include "nlohmann/json.hpp"
+
+#include <vector>
+#include <map>
+#include <string>
+#include <memory>
+#include <atomic>
+
+class RawInputThread;
+class SharedPoseReader;
+class XInputManager;
+namespace trace { class EventTraceWriter; }
+
+/* Logs legacy, DirectInput8, raw input HID and XInput devices (config "printJoysticks") */
+void log_devices(DInput8JoystickManager const & di8JoyManager, int mode);
+
+/* Devices, mapping and outputs built from the "joysticks", "mapping", "outputs" and "capture" config sections.
+ * Used by NPClient.dll when it reads devices itself and by the pose server.
+ * A pipeline built on config reload carries over the devices of pPrevious whose config did not change, instead of acquiring them again.
+ * pPrevious may still be in use on the sampling path meanwhile: only its construction-time state is read and no device is touched.
+ */
+class Pipeline
+{
+public:
+  /* Updates devices; errors of single devices are logged, not thrown */
+  void update();
+  /* Makes the pose and passes it to the outputs */
+  Pose make_pose();
+
+  /* May be called from one other thread (the control channel) while update() and make_pose() run */
+  void set_limits(PoseMemberID::type poseMemberID, AxisPoseFactory::limits_t const & limits);
+  AxisPoseFactory::limits_t get_limits(PoseMemberID::type poseMemberID) const;
+  /* Makes the next pose the center, or with reset goes back to the uncentered pose; applied by the next make_pose() */
+  void request_recenter(bool reset = false);
+  /* Logged by the next update() */
+  void request_stats();
+  /* Device read and output stats */
+  void log_stats() const;
+  /* Takes over the center of the pipeline it replaces; on the sampling path */
+  void carry_state(Pipeline const & previous);
+
+  Pipeline(nlohmann::json const & config, Pipeline const * pPrevious = NULL);
+  Pipeline(Pipeline const &) =delete;
+  Pipeline & operator=(Pipeline const &) =delete;
+  ~Pipeline();
+
+private:
+  enum RecenterRequest { recenterNone = 0, recenterSet, recenterReset };
+
+  /* What a later pipeline needs to carry a device over */
+  struct JoystickEntry
+  {
+    nlohmann::json config;
+    AxisID::mask_t usedAxes;
+    /* Keeps the device's manager alive in the pipelines it is carried to; NULL if there is none */
+    std::shared_ptr<DInput8JoystickManager> spOwner;
+  };
+
+  void log_joystick_stats_() const;
+  DInput8JoystickManager & get_di8_manager_();
+  bool carry_joystick_(Pipeline const & previous, std::string const & name, nlohmann::json const & cfg, AxisID::mask_t usedAxes, bool captureCarried);
+
+  /* Declared first so they outlive the joysticks; capture writers are used by the joysticks writing to their rings */
+  std::shared_ptr<trace::EventTraceWriter> spCapture_;
+  nlohmann::json captureConfig_;
+  std::vector<std::shared_ptr<DInput8JoystickManager> > carriedDI8JoyManagers_;
+  std::vector<std::shared_ptr<Updated> > updated_;
+  std::map<std::string, std::shared_ptr<Joystick> > joysticks_;
+  std::map<std::string, JoystickEntry> joystickEntries_;
+  std::shared_ptr<AxisPoseFactory> spPoseFactory_;
+  std::vector<std::shared_ptr<PoseSink> > sinks_;
+  std::shared_ptr<DInput8JoystickManager> spDI8JoyManager_;
+  std::shared_ptr<RawInputThread> spRawInputThread_;
+  std::shared_ptr<XInputManager> spXInputManager_;
+  /* Requests from the control channel, taken by the sampling path */
+  std::atomic<int> recenterRequest_;
+  std::atomic<bool> statsRequested_;
+  Pose center_;
+};
+
+/* Config "poseServer" */
+struct PoseServerMode
+{
+  /* off: read devices in process; automatic: use a pose server if one runs at start or reload, else read devices; require: only use a pose server */
+  enum type { off = 0, first = off, automatic, require, num };
+
+  static type from_cstr(char const * name)
+  {
+    for (int i = 0; i < names_.size(); ++i)
+    {
+      if (strcmp(names_.at(i), name) == 0)
+        return static_cast<type>(i);
+    }
+    return num;
+  }
+
+private:
+  static std::array<char const *, num> names_;
+};
+
+/* Pose of a client DLL: made from devices read in process by a Pipeline, or read from the pose server, as selected by config "poseServer" */
+class PoseSource
+{
+public:
+  void update();
+  /* With a pose server, keeps the last pose while the server is gone */
+  Pose get_pose();
+  /* False if the last get_pose() got no fresh pose from the pose server; callers should then not present it as a new frame */
+  bool is_live() const { return live_; }
+  /* NULL if the pose is read from the pose server */
+  Pipeline * get_pipeline() { return spPipeline_.get(); }
+  /* See Pipeline::carry_state() */
+  void carry_state(PoseSource const & previous);
+
+  /* On config reload, pPrevious is the source being replaced (see Pipeline) */
+  PoseSource(nlohmann::json const & config, PoseSource const * pPrevious = NULL);
+  PoseSource(PoseSource const &) =delete;
+  PoseSource & operator=(PoseSource const &) =delete;
+  ~PoseSource();
+
+private:
+  /* Exactly one of these is set */
+  std::unique_ptr<Pipeline> spPipeline_;
+  std::unique_ptr<SharedPoseReader> spPoseReader_;
+  Pose serverPose_;
+  bool live_;
+};
+
+#endif
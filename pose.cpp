@@ -0,0 +1,84 @@
+#include "pose.hpp"
+#include "profiler.hpp"
+#include "simd.hpp"
+
+decltype(PoseMemberID::names_) PoseMemberID::names_ = {"yaw", "pitch", "roll", "x", "y", "z"};
+
+std::ostream & operator<<(std::ostream & os, Pose const & pose)
+{
+  return os << "yaw: " << pose.yaw << "; pitch: " << pose.pitch << "; roll: "<< pose.roll
+    << "; x: " << pose.x << "; y: " << pose.y << "; z: " << pose.z;
+}
+
+Pose AxisPoseFactory::make_pose() const
+{
+  PROFILE_ZONE("AxisPoseFactory::make_pose");
+  auto const num = PoseMemberID::num;
+  std::array<float, num> in, v;
+  for (size_t i = PoseMemberID::first; i < num; ++i)
+  {
+    auto const & d = this->axes_[i];
+    in[i] = d.spAxis ? d.spAxis->get_value() : 0.0f;
+  }
+  /* Bounded: if the read keeps being torn, the previous coefficients are used for this pose */
+  coefficients_.read(used_);
+  simd::scale_bias(in.data(), used_.scale.data(), used_.bias.data(), v.data(), num);
+  return Pose (
+    v.at(PoseMemberID::yaw),
+    v.at(PoseMemberID::pitch),
+    v.at(PoseMemberID::roll),
+    v.at(PoseMemberID::x),
+    v.at(PoseMemberID::y),
+    v.at(PoseMemberID::z)
+  );
+}
+
+void AxisPoseFactory::set_mapping(PoseMemberID::type poseMemberID, std::shared_ptr<Axis> const & spAxis, AxisPoseFactory::limits_t const & limits)
+{
+  auto & d = this->axes_.at(poseMemberID);
+  d.spAxis = spAxis;
+  d.limits = limits;
+  update_coefficients_(poseMemberID);
+}
+
+void AxisPoseFactory::set_axis(PoseMemberID::type poseMemberID, std::shared_ptr<Axis> const & spAxis)
+{
+  auto & d = this->axes_.at(poseMemberID);
+  d.spAxis = spAxis;
+  update_coefficients_(poseMemberID);
+}
+
+void AxisPoseFactory::set_limits(PoseMemberID::type poseMemberID, AxisPoseFactory::limits_t const & limits)
+{
+  auto & d = this->axes_.at(poseMemberID);
+  d.limits = limits;
+  update_coefficients_(poseMemberID);
+}
+
+AxisPoseFactory::limits_t AxisPoseFactory::get_limits(PoseMemberID::type poseMemberID) const
+{
+  return this->axes_.at(poseMemberID).limits;
+}
+
+AxisPoseFactory::AxisPoseFactory()
+{
+  for (auto & d : this->axes_)
+  {
+    d.spAxis = nullptr;
+    d.limits = limits_t(-1.0f, 1.0f);
+  }
+  written_.scale.fill(0.0f);
+  written_.bias.fill(0.0f);
+  coefficients_.write(written_);
+  used_ = written_;
+}
+
+void AxisPoseFactory::update_coefficients_(PoseMemberID::type poseMemberID)
+{
+  auto const & d = this->axes_.at(poseMemberID);
+  /* Same as lerp(v, -1, 1, limits.first, limits.second) */
+  auto const scale = d.spAxis ? 0.5f * (d.limits.second - d.limits.first) : 0.0f;
+  written_.scale.at(poseMemberID) = scale;
+  written_.bias.at(poseMemberID) = d.spAxis ? d.limits.second - scale : 0.0f;
+  coefficients_.write(written_);
+}
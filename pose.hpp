@@ -0,0 +1,99 @@
+#ifndef POSE_HPP
+#define POSE_HPP
+
+#include "joystick.hpp"
+#include "seqlock.hpp"
+
+#include <array>
+#include <memory>
+#include <ostream>
+#include <cstring>
+
+/* Pose */
+struct PoseMemberID
+{
+  enum type { yaw = 0, first = yaw, pitch, roll, x, y, z, num };
+
+  static type from_cstr(char const * name)
+  {
+    for (int i = 0; i < names_.size(); ++i)
+    {
+      if (strcmp(names_.at(i), name) == 0)
+        return static_cast<type>(i);
+    }
+    return num;
+  }
+
+  static char const * to_cstr(type id)
+  {
+    return (id < first || id > num) ? "unknown" : names_.at(id);
+  }
+
+private:
+  static std::array<char const *, num> names_;
+};
+
+struct Pose
+{
+  float yaw, pitch, roll, x, y, z;
+  Pose() =default;
+  Pose(float yaw, float pitch, float roll, float x, float y, float z)
+    : yaw(yaw), pitch(pitch), roll(roll), x(x), y(y), z(z)
+  {}
+  ~Pose() =default;
+};
+
+std::ostream & operator<<(std::ostream & os, Pose const & pose);
+
+class PoseFactory
+{
+public:
+  virtual Pose make_pose() const =0;
+
+  virtual ~PoseFactory() =default;
+};
+
+/* Receives each pose made on the sampling path, to pass it on to other consumers; must not block */
+class PoseSink
+{
+public:
+  virtual void put_pose(Pose const & pose) =0;
+
+  virtual ~PoseSink() =default;
+};
+
+class AxisPoseFactory : public PoseFactory
+{
+public:
+  using limits_t = std::pair<float, float>;
+
+  virtual Pose make_pose() const;
+
+  void set_mapping(PoseMemberID::type poseMemberID, std::shared_ptr<Axis> const & spAxis, limits_t const & limits);
+  void set_axis(PoseMemberID::type poseMemberID, std::shared_ptr<Axis> const & spAxis);
+  /* make_pose() is called by one thread at a time; one other thread at a time may call set_limits() and get_limits() while it runs */
+  void set_limits(PoseMemberID::type poseMemberID, limits_t const & limits);
+  limits_t get_limits(PoseMemberID::type poseMemberID) const;
+
+  AxisPoseFactory();
+
+private:
+  struct AxisData { std::shared_ptr<Axis> spAxis; limits_t limits; };
+  void update_coefficients_(PoseMemberID::type poseMemberID);
+
+  /* Axis value * scale + bias maps [-1, 1] to the member limits; both 0 without an axis */
+  struct Coefficients
+  {
+    std::array<float, PoseMemberID::num> scale;
+    std::array<float, PoseMemberID::num> bias;
+  };
+
+  std::array<AxisData, PoseMemberID::num> axes_;
+  /* Written by the setters, published to make_pose() through coefficients_ */
+  Coefficients written_;
+  Seqlock<Coefficients> coefficients_;
+  /* make_pose() only: the last coefficients read untorn, used while a setter keeps rewriting them */
+  mutable Coefficients used_;
+};
+
+#endif
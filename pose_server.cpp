@@ -0,0 +1,148 @@
+#include "pipeline.hpp"
+#include "shared_pose.hpp"
+#include "control.hpp"
+#include "rcu.hpp"
+#include "config.hpp"
+#include "logging.hpp"
+#include "thread.hpp"
+#include "clock.hpp"
+#include "path.hpp"
+#include "util.hpp"
+#include "timing.hpp"
+#include "profiler.hpp"
+
+#include <string>
+#include <memory>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+#include <windows.h>
+
+/* Reads devices and publishes the pose to shared memory for NPClient.dll instances running with "poseServer": "auto" or "require".
+ * Uses the same config as NPClient.dll; "poseServerRate" sets the publish rate in Hz.
+ * With "controlPipe" set, the control channel is served on <controlPipe>_server, since client DLLs use the plain name.
+ */
+
+static Event * g_pStop = NULL;
+
+static BOOL WINAPI ctrl_handler(DWORD ctrlType)
+{
+  if (g_pStop == NULL)
+    return FALSE;
+  logging::log("server", logging::LogLevel::info, "Stopping (control event ", ctrlType, ")");
+  g_pStop->set();
+  /* Windows terminates the process when the handler returns from CTRL_CLOSE_EVENT */
+  if (ctrlType == CTRL_CLOSE_EVENT)
+    Sleep(1000);
+  return TRUE;
+}
+
+int run(std::string const & configPath)
+{
+  auto & timer = startup_timer();
+  timer.start();
+  logging::log("server", logging::LogLevel::info, "Loading config from: ", configPath);
+  auto const config = load_config(configPath);
+  auto const logLevelName = get_d<std::string>(config, "logLevel", "INFO");
+  logging::root_logger().set_level(logging::n2ll(logLevelName));
+  auto const rate = get_d<double>(config, "poseServerRate", 250.0);
+  if (rate <= 0.0)
+    throw std::runtime_error(stream_to_str("Invalid poseServerRate: ", rate));
+
+  SharedPoseWriter writer;
+  /* Replaced on config reload, see NPClient.dll */
+  RcuSlot<Pipeline> pipelines;
+  pipelines.reset(std::unique_ptr<Pipeline>(new Pipeline(config)));
+  std::unique_ptr<ConfigWatcher> spConfigWatcher;
+  if (get_d<bool>(config, "watchConfig", true))
+  {
+    auto const reload = [&configPath, &pipelines]() {
+      logging::log("server", logging::LogLevel::info, "Config changed, reloading");
+      auto const config = load_config(configPath);
+      logging::root_logger().set_level(logging::n2ll(get_d<std::string>(config, "logLevel", "INFO")));
+      pipelines.offer(std::unique_ptr<Pipeline>(new Pipeline(config, pipelines.get())));
+    };
+    try {
+      spConfigWatcher.reset(new ConfigWatcher(configPath, reload, pipelines.get_retired_handle(), [&pipelines]() { pipelines.collect(); }));
+    } catch (std::runtime_error & e)
+    {
+      logging::log("server", logging::LogLevel::error, "Config reload is off (", e.what(), ")");
+    }
+  }
+  std::unique_ptr<ControlServer> spControlServer;
+  auto const controlPipe = get_d<std::string>(config, "controlPipe", "");
+  if (!controlPipe.empty())
+  {
+    auto const handle = [&pipelines](nlohmann::json const & request) {
+      ScopedLock<CriticalSection> lock (pipelines.get_reader_cs());
+      return handle_control_command(request, pipelines.get());
+    };
+    try {
+      spControlServer.reset(new ControlServer(controlPipe + "_server", handle));
+    } catch (std::runtime_error & e)
+    {
+      logging::log("server", logging::LogLevel::error, "Control channel is off (", e.what(), ")");
+    }
+  }
+  logging::log("server", logging::LogLevel::info, "Started in ", timer.get_total_ms(), " ms, publishing at ", rate, " Hz");
+  timer.set_enabled(false);
+
+  Event stop;
+  g_pStop = &stop;
+  SetConsoleCtrlHandler(ctrl_handler, TRUE);
+  timeBeginPeriod(1);
+  auto const period = static_cast<std::int64_t>(get_qpc_frequency() / rate);
+  auto next = get_qpc_ticks();
+  std::uint64_t frames = 0;
+  while (true)
+  {
+    pipelines.swap([](Pipeline & next, Pipeline const & current) { next.carry_state(current); });
+    auto & pipeline = *pipelines.get();
+    pipeline.update();
+    writer.publish(pipeline.make_pose());
+    ++frames;
+    next += period;
+    auto const now = get_qpc_ticks();
+    /* Do not try to catch up after a stall */
+    if (next < now)
+      next = now;
+    auto const waitMs = static_cast<DWORD>(qpc_ticks_to_ms(next - now));
+    if (stop.wait(waitMs))
+      break;
+  }
+  timeEndPeriod(1);
+  SetConsoleCtrlHandler(ctrl_handler, FALSE);
+  g_pStop = NULL;
+  logging::log("server", logging::LogLevel::info, "Published ", frames, " poses");
+#ifdef JOY2TIR_PROFILE
+  auto const tracePath = profiler::get_trace_path();
+  if (PROFILE_DUMP(tracePath))
+    logging::log("server", logging::LogLevel::info, "Wrote profile to ", tracePath);
+#endif
+  return 0;
+}
+
+int main(int argc, char** argv)
+{
+  auto spConsolePrinter = std::make_shared<logging::StreamLogPrinter>(logging::format_message, []() -> std::ostream& { return std::cout; });
+  logging::root_logger().add_printer(spConsolePrinter);
+  auto logPath = get_dir_to_module();
+  append_to_path(logPath, "pose_server.log");
+  auto spLogFileStream = std::make_shared<std::fstream>(logPath, std::ios::out|std::ios::trunc);
+  auto spFilePrinter = std::make_shared<logging::StreamLogPrinter>(logging::format_message, [spLogFileStream]() -> std::ostream& { return *spLogFileStream; });
+  logging::root_logger().add_printer(spFilePrinter);
+
+  if (argc > 1 && std::string(argv[1]) == "-h")
+  {
+    std::cout << "Usage: " << argv[0] << " [config_path]\n" << "Default config path: JOY2TIR_CONFIG or NPClient.json next to the executable" << std::endl;
+    return 0;
+  }
+  try {
+    return run((argc > 1) ? std::string(argv[1]) : get_config_path());
+  } catch (std::exception & e)
+  {
+    logging::log("server", logging::LogLevel::error, e.what());
+    return 1;
+  }
+}
@@ -0,0 +1,154 @@
+#include "profiler.hpp"
+
+#ifdef JOY2TIR_PROFILE
+
+#include "thread.hpp"
+#include "path.hpp"
+
+#include "nlohmann/json.hpp"
+
+#include <array>
+#include <vector>
+#include <atomic>
+#include <fstream>
+#include <cstdlib> //getenv
+
+#include <windows.h>
+
+#ifndef JOY2TIR_PROFILE_ZONES
+#define JOY2TIR_PROFILE_ZONES 4096
+#endif
+
+namespace profiler
+{
+
+namespace
+{
+
+struct Zone
+{
+  char const * name;
+  std::int64_t begin;
+  std::int64_t end;
+};
+
+/* Written only by the owning thread; oldest zones are overwritten when full. */
+class ZoneBuffer
+{
+public:
+  static std::uint32_t const capacity = JOY2TIR_PROFILE_ZONES;
+  static_assert(capacity != 0 && (capacity & (capacity - 1)) == 0, "JOY2TIR_PROFILE_ZONES must be a power of 2");
+
+  void push(char const * name, std::int64_t begin, std::int64_t end)
+  {
+    auto const n = count_.load(std::memory_order_relaxed);
+    auto & z = zones_[n & (capacity - 1)];
+    z.name = name;
+    z.begin = begin;
+    z.end = end;
+    count_.store(n + 1, std::memory_order_release);
+  }
+
+  template <class C>
+  void for_each(C && cb) const
+  {
+    auto const n = count_.load(std::memory_order_acquire);
+    auto const first = n > capacity ? n - capacity : 0;
+    for (auto i = first; i < n; ++i)
+      cb(zones_[i & (capacity - 1)]);
+  }
+
+  DWORD get_thread_id() const { return threadID_; }
+
+  ZoneBuffer(DWORD threadID) : threadID_(threadID), count_(0) {}
+
+private:
+  DWORD threadID_;
+  std::atomic<std::uint32_t> count_;
+  std::array<Zone, capacity> zones_;
+};
+
+struct Registry
+{
+  CriticalSection cs;
+  /* Buffers outlive their threads so that zones of finished threads are exported too. */
+  std::vector<ZoneBuffer*> buffers;
+};
+
+Registry & get_registry()
+{
+  static Registry registry;
+  return registry;
+}
+
+thread_local ZoneBuffer * t_pBuffer = nullptr;
+
+ZoneBuffer & get_thread_buffer()
+{
+  if (!t_pBuffer)
+  {
+    t_pBuffer = new ZoneBuffer(GetCurrentThreadId());
+    auto & registry = get_registry();
+    ScopedLock<CriticalSection> lock (registry.cs);
+    registry.buffers.push_back(t_pBuffer);
+  }
+  return *t_pBuffer;
+}
+
+nlohmann::json make_chrome_trace()
+{
+  auto events = nlohmann::json::array();
+  auto const pid = GetCurrentProcessId();
+  auto & registry = get_registry();
+  ScopedLock<CriticalSection> lock (registry.cs);
+  for (auto const * pBuffer : registry.buffers)
+  {
+    auto const tid = pBuffer->get_thread_id();
+    pBuffer->for_each(
+      [&events, pid, tid](Zone const & z)
+      {
+        events.push_back({
+          {"name", z.name}, {"cat", "joy2tir"}, {"ph", "X"},
+          {"ts", qpc_ticks_to_us(z.begin)}, {"dur", qpc_ticks_to_us(z.end - z.begin)},
+          {"pid", pid}, {"tid", tid}
+        });
+      }
+    );
+  }
+  return nlohmann::json{ {"traceEvents", events}, {"displayTimeUnit", "ns"} };
+}
+
+} //anonymous
+
+void record_zone(char const * name, std::int64_t begin, std::int64_t end)
+{
+  get_thread_buffer().push(name, begin, end);
+}
+
+std::string get_trace_path()
+{
+  if (auto envTracePath = std::getenv("JOY2TIR_TRACE"))
+    return envTracePath;
+  auto path = get_path_to_module();
+  auto const dot = path.find_last_of('.');
+  if (dot != std::string::npos && dot > path.find_last_of('\\'))
+    path.erase(dot);
+  path += ".trace.json";
+  return path;
+}
+
+bool write_chrome_trace(std::string const & path)
+try {
+  std::ofstream stream (path, std::ios::out|std::ios::trunc);
+  if (!stream.is_open())
+    return false;
+  stream << make_chrome_trace();
+  return stream.good();
+} catch (std::exception &)
+{
+  return false;
+}
+
+} //profiler
+
+#endif
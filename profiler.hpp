@@ -0,0 +1,53 @@
+#ifndef PROFILER_HPP
+#define PROFILER_HPP
+
+/* Scoped-zone profiler.
+ * Compiled out unless JOY2TIR_PROFILE is defined (make PROFILE=1).
+ * Zones are recorded into per-thread ring buffers of JOY2TIR_PROFILE_ZONES zones (make PROFILE_ZONES=n) and exported in Chrome trace-event format
+ * (chrome://tracing, Perfetto) by PROFILE_DUMP, which the owner of the threads calls on shutdown (not at unload, under the loader lock).
+ */
+#ifdef JOY2TIR_PROFILE
+
+#include "clock.hpp"
+
+#include <string>
+#include <cstdint>
+
+namespace profiler
+{
+
+/* name must have static storage duration (string literal) */
+void record_zone(char const * name, std::int64_t begin, std::int64_t end);
+
+/* Path from JOY2TIR_TRACE or <module name>.trace.json next to the module */
+std::string get_trace_path();
+bool write_chrome_trace(std::string const & path);
+
+class ScopedZone
+{
+public:
+  ScopedZone(char const * name) : name_(name), begin_(get_qpc_ticks()) {}
+  ScopedZone(ScopedZone const &) =delete;
+  ScopedZone & operator=(ScopedZone const &) =delete;
+  ~ScopedZone() { record_zone(name_, begin_, get_qpc_ticks()); }
+
+private:
+  char const * name_;
+  std::int64_t begin_;
+};
+
+} //profiler
+
+#define PROFILER_CONCAT_IMPL_(a, b) a##b
+#define PROFILER_CONCAT_(a, b) PROFILER_CONCAT_IMPL_(a, b)
+#define PROFILE_ZONE(name) profiler::ScopedZone PROFILER_CONCAT_(profileZone_, __LINE__) (name)
+#define PROFILE_DUMP(path) profiler::write_chrome_trace(path)
+
+#else
+
+#define PROFILE_ZONE(name) do {} while (0)
+#define PROFILE_DUMP(path) false
+
+#endif
+
+#endif
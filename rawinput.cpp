@@ -0,0 +1,565 @@
+#include "rawinput.hpp"
+#include "util.hpp"
+#include "logging.hpp"
+#include "profiler.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <cassert>
+
+#include <hidusage.h>
+#include <hidpi.h>
+
+/* Raw input devices */
+std::ostream & operator<<(std::ostream & os, RawDeviceInfo const & rdi)
+{
+  return os << "handle: " << rdi.handle << ", type: " << rdi.type << ", name: " << rdi.name << ", usagePage: " << rdi.usagePage << ", usage: " << rdi.usage;
+}
+
+
+std::vector<RawDeviceInfo> get_raw_devices()
+{
+  UINT uiNumDevices = 0;
+  INT r = GetRawInputDeviceList(0, &uiNumDevices, sizeof(RAWINPUTDEVICELIST));
+  if (-1 == r)
+    throw std::runtime_error("Error getting device number");
+  std::vector<RAWINPUTDEVICELIST> rawInputDeviceList (uiNumDevices);
+  r = GetRawInputDeviceList(rawInputDeviceList.data(), &uiNumDevices, sizeof(RAWINPUTDEVICELIST));
+  if (-1 == r)
+    throw std::runtime_error("Error listing devices");
+  std::vector<RawDeviceInfo> devices;
+  /* A device that can not be queried (e.g. unplugged meanwhile) is skipped, so that the others can still be found */
+  for (UINT i = 0; i < uiNumDevices; ++i)
+  {
+    auto const & ridl = rawInputDeviceList[i];
+    //Get required device name string length
+    UINT szName = 0;
+    r = GetRawInputDeviceInfoA(ridl.hDevice, RIDI_DEVICENAME, nullptr, &szName);
+    if (-1 == r)
+    {
+      logging::log("rawinput", logging::LogLevel::debug, "Skipping device ", ridl.hDevice, ": error getting device name string length");
+      continue;
+    }
+    /* Interface paths of e.g. Bluetooth devices are long; szName includes the terminating null */
+    std::vector<char> name (szName + 1, '\0');
+    r = GetRawInputDeviceInfoA(ridl.hDevice, RIDI_DEVICENAME, name.data(), &szName);
+    if (-1 == r)
+    {
+      logging::log("rawinput", logging::LogLevel::debug, "Skipping device ", ridl.hDevice, ": error getting device name");
+      continue;
+    }
+    RID_DEVICE_INFO ridi;
+    ridi.cbSize = sizeof(ridi);
+    UINT szRidi = sizeof(ridi);
+    r = GetRawInputDeviceInfoA(ridl.hDevice, RIDI_DEVICEINFO, &ridi, &szRidi);
+    if (-1 == r)
+    {
+      logging::log("rawinput", logging::LogLevel::debug, "Skipping device ", name.data(), ": error getting device info");
+      continue;
+    }
+    RawDeviceInfo di;
+    di.handle = ridl.hDevice;
+    di.type = ridl.dwType;
+    di.name = name.data();
+    if (ridl.dwType == RIM_TYPEMOUSE)
+    {
+      di.usagePage = HID_USAGE_PAGE_GENERIC;
+      di.usage = HID_USAGE_GENERIC_MOUSE;
+    }
+    else if (ridl.dwType == RIM_TYPEKEYBOARD)
+    {
+      di.usagePage = HID_USAGE_PAGE_GENERIC;
+      di.usage = HID_USAGE_GENERIC_KEYBOARD;
+    }
+    else if (ridl.dwType == RIM_TYPEHID)
+    {
+      di.usagePage = ridi.hid.usUsagePage;
+      di.usage = ridi.hid.usUsage;
+      di.vendorID = ridi.hid.dwVendorId;
+      di.productID = ridi.hid.dwProductId;
+    }
+    else
+    {
+      logging::log("rawinput", logging::LogLevel::debug, "Skipping device ", di.name, ": unexpected device type ", ridl.dwType);
+      continue;
+    }
+    devices.push_back(di);
+  }
+  return devices;
+}
+
+RawDeviceInfo find_raw_hid_device(DWORD vendorID, DWORD productID, unsigned index)
+{
+  for (auto const & rdi : get_raw_devices())
+  {
+    if (rdi.type != RIM_TYPEHID || rdi.vendorID != vendorID || rdi.productID != productID)
+      continue;
+    if (index == 0)
+      return rdi;
+    --index;
+  }
+  throw std::runtime_error(stream_to_str("Cannot find raw HID device (vid: ", std::hex, vendorID, "; pid: ", productID, ")"));
+}
+
+void register_raw_device(RawDeviceInfo const & rdi, HWND hwnd, bool remove)
+{
+  static const UINT numRid = 1;
+  RAWINPUTDEVICE rid[numRid];
+  rid[0].usUsagePage = rdi.usagePage;
+  rid[0].usUsage = rdi.usage;
+  UINT dwFlags = RIDEV_INPUTSINK;
+  if (remove)
+  {
+    dwFlags |= RIDEV_REMOVE;
+    hwnd = NULL;
+  }
+  rid[0].dwFlags = dwFlags;
+  rid[0].hwndTarget = hwnd;
+  if (!RegisterRawInputDevices(rid, numRid, sizeof(RAWINPUTDEVICE)))
+    throw std::runtime_error("Failed to register device");
+}
+
+HWND create_window(WNDPROC wndProc, char const * className, char const * windowName, bool useMessageWindow, float alpha)
+{
+  //Define Window Class
+  WNDCLASS wndclass;
+  wndclass.style = CS_HREDRAW | CS_VREDRAW;
+  wndclass.lpfnWndProc = wndProc;
+  wndclass.cbClsExtra = wndclass.cbWndExtra = 0;
+  wndclass.hInstance = GetModuleHandleA(nullptr);
+  wndclass.hIcon = LoadIconA(nullptr, IDI_APPLICATION);
+  wndclass.hCursor = LoadCursorA(nullptr, IDC_ARROW);
+  wndclass.hbrBackground = static_cast<HBRUSH>(GetStockObject(WHITE_BRUSH));
+  wndclass.lpszMenuName = nullptr;
+  wndclass.lpszClassName = className;
+  //Register Window Class
+  if (!RegisterClassA(&wndclass))
+    throw std::runtime_error("Failed to register window class");
+  //Create Window
+  //auto const exStyle = WS_EX_LAYERED | WS_EX_APPWINDOW | WS_EX_TOPMOST | WS_EX_TRANSPARENT;
+  //auto const exStyle = WS_EX_LAYERED | WS_EX_APPWINDOW | WS_EX_TOPMOST;
+  auto const exStyle = WS_EX_LAYERED | WS_EX_TRANSPARENT;
+  //auto const exStyle = WS_EX_LAYERED;
+  //auto style = WS_VISIBLE | WS_POPUP;
+  //auto style = WS_OVERLAPPED;
+  auto style = WS_VISIBLE;
+  auto parent = useMessageWindow ? HWND_MESSAGE : nullptr;
+  auto hwnd = CreateWindowEx(
+    exStyle,
+    className, windowName,
+    style,
+    CW_USEDEFAULT, CW_USEDEFAULT, CW_USEDEFAULT, CW_USEDEFAULT,
+    parent,
+    nullptr,
+    wndclass.hInstance,
+    nullptr);
+  if (0 == hwnd)
+    throw std::runtime_error("Failed to create window");
+  if (!useMessageWindow)
+  {
+    unsigned int const bAlpha = 255*alpha;
+    if (!SetLayeredWindowAttributes(hwnd, 0, bAlpha, LWA_ALPHA))
+      throw std::runtime_error("Failed to set window alpha");
+    ShowWindow(hwnd, SW_SHOWNORMAL);
+    UpdateWindow(hwnd);
+  }
+  //TODO Check for error
+  return hwnd;
+}
+
+
+/* RawInputThread */
+void RawInputThread::add_callback(HANDLE hDevice, void const * owner, callback_t const & cb)
+{
+  ScopedLock<CriticalSection> lock (cs_);
+  callbacks_.push_back(Callback{ hDevice, owner, cb });
+}
+
+void RawInputThread::remove_callbacks(void const * owner)
+{
+  ScopedLock<CriticalSection> lock (cs_);
+  callbacks_.erase(
+    std::remove_if(callbacks_.begin(), callbacks_.end(), [owner](Callback const & c) { return c.owner == owner; }),
+    callbacks_.end()
+  );
+}
+
+void RawInputThread::register_usage(USHORT usagePage, USHORT usage)
+{
+  /* Registration is done by the thread that owns the target window */
+  RegisterRequest request { usagePage, usage, false, 0 };
+  registered_.reset();
+  if (!PostMessage(hwnd_, registerMsg_, 0, reinterpret_cast<LPARAM>(&request)))
+    throw std::runtime_error(stream_to_str("Failed to post raw input registration request, error = ", GetLastError()));
+  registered_.wait();
+  if (!request.done)
+    throw std::runtime_error(stream_to_str("Failed to register raw input usage page ", usagePage, ", usage ", usage, ", error = ", request.error));
+}
+
+RawInputThread::RawInputThread()
+  : cs_(), callbacks_(), ready_(), registered_(false), stop_(), className_(stream_to_str("joy2tir raw input ", this)),
+    hwnd_(NULL), headerSize_(sizeof(RAWINPUTHEADER)), blockAlign_(sizeof(ULONG_PTR)), buffer_(2048), spThread_()
+{
+  BOOL isWow64 = FALSE;
+  if (sizeof(void*) == 4 && IsWow64Process(GetCurrentProcess(), &isWow64) && isWow64)
+  {
+    headerSize_ = 24;
+    blockAlign_ = 8;
+  }
+  spThread_.reset(new Thread([this]() { run_(); }));
+  spThread_->set_priority(THREAD_PRIORITY_HIGHEST);
+  ready_.wait();
+  if (hwnd_ == NULL)
+  {
+    spThread_->join();
+    throw std::runtime_error("Failed to create raw input window");
+  }
+}
+
+RawInputThread::~RawInputThread()
+{
+  stop_.set();
+  spThread_->join();
+}
+
+void RawInputThread::run_()
+{
+  try {
+    hwnd_ = create_window(DefWindowProcA, className_.c_str(), className_.c_str(), true);
+  } catch (std::runtime_error & e)
+  {
+    logging::log("rawinput", logging::LogLevel::error, e.what());
+  }
+  ready_.set();
+  if (hwnd_ == NULL)
+    return;
+
+  auto const hStop = stop_.get_handle();
+  auto const wake = QS_RAWINPUT | QS_POSTMESSAGE | QS_SENDMESSAGE;
+  while (MsgWaitForMultipleObjectsEx(1, &hStop, INFINITE, wake, MWMO_INPUTAVAILABLE) != WAIT_OBJECT_0)
+  {
+    drain_();
+    /* Everything except WM_INPUT, which is consumed by GetRawInputBuffer() */
+    MSG msg;
+    while (PeekMessage(&msg, NULL, 0, WM_INPUT - 1, PM_REMOVE))
+      handle_message_(msg);
+    while (PeekMessage(&msg, NULL, WM_INPUT + 1, static_cast<UINT>(-1), PM_REMOVE))
+      handle_message_(msg);
+  }
+
+  DestroyWindow(hwnd_);
+  UnregisterClassA(className_.c_str(), GetModuleHandleA(nullptr));
+}
+
+void RawInputThread::drain_()
+{
+  PROFILE_ZONE("RawInputThread::drain_");
+  while (true)
+  {
+    auto pBuffer = reinterpret_cast<PRAWINPUT>(buffer_.data());
+    UINT size = buffer_.size() * sizeof(buffer_.front());
+    auto const n = GetRawInputBuffer(pBuffer, &size, sizeof(RAWINPUTHEADER));
+    if (n == 0)
+      return;
+    if (n == static_cast<UINT>(-1))
+    {
+      /* Buffer is too small for even one input */
+      UINT required = 0;
+      if (GetRawInputBuffer(NULL, &required, sizeof(RAWINPUTHEADER)) != 0 || required == 0)
+        return;
+      buffer_.resize(std::max<size_t>(buffer_.size() * 2, 16 * required / sizeof(buffer_.front())));
+      continue;
+    }
+    {
+      ScopedLock<CriticalSection> lock (cs_);
+      auto p = reinterpret_cast<BYTE const *>(pBuffer);
+      for (UINT i = 0; i < n; ++i)
+      {
+        auto const & header = *reinterpret_cast<RAWINPUTHEADER const *>(p);
+        auto const data = p + headerSize_;
+        for (auto const & c : callbacks_)
+          if (c.hDevice == NULL || c.hDevice == header.hDevice)
+            c.cb(header.dwType, data);
+        p += (header.dwSize + blockAlign_ - 1) & ~(blockAlign_ - 1);
+      }
+    }
+    DefRawInputProc(&pBuffer, n, sizeof(RAWINPUTHEADER));
+  }
+}
+
+void RawInputThread::handle_message_(MSG const & msg)
+{
+  if (msg.message != registerMsg_)
+  {
+    DispatchMessage(&msg);
+    return;
+  }
+  auto & request = *reinterpret_cast<RegisterRequest*>(msg.lParam);
+  RAWINPUTDEVICE rid;
+  rid.usUsagePage = request.usagePage;
+  rid.usUsage = request.usage;
+  rid.dwFlags = RIDEV_INPUTSINK;
+  rid.hwndTarget = hwnd_;
+  request.done = RegisterRawInputDevices(&rid, 1, sizeof(rid)) != FALSE;
+  request.error = request.done ? 0 : GetLastError();
+  registered_.set();
+}
+
+/* RawHIDJoystick */
+float RawHIDJoystick::get_axis_value(AxisID::type axisID) const
+{
+  return this->axes_.at(axisID);
+}
+
+void RawHIDJoystick::update()
+{
+  for (int i = AxisID::first; i < AxisID::num; ++i)
+    axes_.at(i) = sharedAxes_.at(i).load(std::memory_order_relaxed);
+}
+
+RawHIDJoystick::RawHIDJoystick(std::shared_ptr<RawInputThread> const & spThread, RawDeviceInfo const & rdi)
+  : spThread_(spThread), rdi_(rdi), preparsedData_(), reportLength_(0), useReportIDs_(false), plan_(), caps_()
+{
+  if (!spThread_)
+    throw std::runtime_error("Raw input thread is NULL");
+  for (auto & v : sharedAxes_)
+    v.store(0.0f);
+  axes_.fill(0.0f);
+
+  UINT size = 0;
+  if (GetRawInputDeviceInfoA(rdi_.handle, RIDI_PREPARSEDDATA, NULL, &size) != 0 || size == 0)
+    throw std::runtime_error(stream_to_str("Cannot get preparsed data size for raw HID device ", rdi_.name));
+  preparsedData_.resize(size);
+  if (GetRawInputDeviceInfoA(rdi_.handle, RIDI_PREPARSEDDATA, preparsedData_.data(), &size) == static_cast<UINT>(-1))
+    throw std::runtime_error(stream_to_str("Cannot get preparsed data for raw HID device ", rdi_.name));
+  auto const pp = reinterpret_cast<PHIDP_PREPARSED_DATA>(preparsedData_.data());
+
+  HIDP_CAPS caps;
+  if (HidP_GetCaps(pp, &caps) != HIDP_STATUS_SUCCESS)
+    throw std::runtime_error(stream_to_str("Cannot get caps for raw HID device ", rdi_.name));
+  reportLength_ = caps.InputReportByteLength;
+  USHORT numValueCaps = caps.NumberInputValueCaps;
+  std::vector<HIDP_VALUE_CAPS> valueCaps (numValueCaps);
+  if (numValueCaps && HidP_GetValueCaps(HidP_Input, valueCaps.data(), &numValueCaps, pp) != HIDP_STATUS_SUCCESS)
+    throw std::runtime_error(stream_to_str("Cannot get value caps for raw HID device ", rdi_.name));
+  for (USHORT i = 0; i < numValueCaps; ++i)
+  {
+    auto const & vc = valueCaps.at(i);
+    if (vc.IsRange)
+      continue;
+    auto const ai = usage2axis_(vc.UsagePage, vc.NotRange.Usage);
+    if (ai == AxisID::num)
+      continue;
+    AxisCaps ac { ai, vc.ReportID, vc.UsagePage, vc.NotRange.Usage, vc.LinkCollection, vc.BitSize, vc.LogicalMin, vc.LogicalMax };
+    /* Unsigned fields are sometimes described with a negative logical maximum */
+    if (ac.logicalMin >= 0 && ac.logicalMax < ac.logicalMin && ac.bitSize < 32)
+      ac.logicalMax = static_cast<LONG>((1UL << ac.bitSize) - 1);
+    if (vc.ReportID != 0)
+      useReportIDs_ = true;
+    ExtractionStep step;
+    if (make_extraction_step_(ac, step))
+      plan_.push_back(step);
+    else
+      caps_.push_back(ac);
+  }
+  if (plan_.empty() && caps_.empty())
+    throw std::runtime_error(stream_to_str("Raw HID device ", rdi_.name, " has no supported axes"));
+  for (auto const & ac : caps_)
+    logging::log("joystick", logging::LogLevel::info, "Could not locate ", AxisID::to_cstr(ac.ai), " in reports of raw HID device ", rdi_.name, ", will use slow path");
+
+  /* The callback goes first so no input after registration is missed; the destructor does not run if registration throws */
+  spThread_->add_callback(rdi_.handle, this, [this](DWORD type, BYTE const * data) { on_input_(type, data); });
+  try {
+    spThread_->register_usage(rdi_.usagePage, rdi_.usage);
+  } catch (...)
+  {
+    spThread_->remove_callbacks(this);
+    throw;
+  }
+  logging::log("joystick", logging::LogLevel::debug, "Created raw HID joystick ", rdi_.name, " with ", plan_.size() + caps_.size(), " axes");
+}
+
+RawHIDJoystick::~RawHIDJoystick()
+{
+  spThread_->remove_callbacks(this);
+}
+
+AxisID::type RawHIDJoystick::usage2axis_(USHORT usagePage, USHORT usage)
+{
+  if (usagePage != HID_USAGE_PAGE_GENERIC)
+    return AxisID::num;
+  struct D { USHORT usage; AxisID::type ai; };
+  static std::array<D, 8> const mapping =
+  {
+    D{ HID_USAGE_GENERIC_X, AxisID::x },
+    D{ HID_USAGE_GENERIC_Y, AxisID::y },
+    D{ HID_USAGE_GENERIC_Z, AxisID::z },
+    D{ HID_USAGE_GENERIC_RX, AxisID::rx },
+    D{ HID_USAGE_GENERIC_RY, AxisID::ry },
+    D{ HID_USAGE_GENERIC_RZ, AxisID::rz },
+    D{ HID_USAGE_GENERIC_SLIDER, AxisID::u },
+    D{ HID_USAGE_GENERIC_DIAL, AxisID::v }
+  };
+  for (auto const & d : mapping)
+    if (d.usage == usage)
+      return d.ai;
+  return AxisID::num;
+}
+
+/* Finds the value field by writing zero and all-ones into blank reports and comparing them. */
+bool RawHIDJoystick::make_extraction_step_(AxisCaps const & ac, ExtractionStep & step) const
+{
+  if (ac.bitSize == 0 || ac.bitSize > 32 || ac.logicalMax == ac.logicalMin)
+    return false;
+  auto const pp = reinterpret_cast<PHIDP_PREPARSED_DATA>(const_cast<BYTE*>(preparsedData_.data()));
+  std::vector<CHAR> zeros (reportLength_), ones (reportLength_);
+  auto const allOnes = (ac.bitSize == 32) ? 0xFFFFFFFFUL : ((1UL << ac.bitSize) - 1);
+  if (HidP_InitializeReportForID(HidP_Input, ac.reportID, pp, zeros.data(), reportLength_) != HIDP_STATUS_SUCCESS
+    || HidP_InitializeReportForID(HidP_Input, ac.reportID, pp, ones.data(), reportLength_) != HIDP_STATUS_SUCCESS
+    || HidP_SetUsageValue(HidP_Input, ac.usagePage, ac.linkCollection, ac.usage, 0, pp, zeros.data(), reportLength_) != HIDP_STATUS_SUCCESS
+    || HidP_SetUsageValue(HidP_Input, ac.usagePage, ac.linkCollection, ac.usage, allOnes, pp, ones.data(), reportLength_) != HIDP_STATUS_SUCCESS)
+    return false;
+
+  ULONG firstBit = 0, lastBit = 0;
+  bool found = false;
+  for (ULONG i = 0; i < reportLength_ * 8; ++i)
+  {
+    auto const diff = (zeros.at(i / 8) ^ ones.at(i / 8)) & (1 << (i % 8));
+    if (!diff)
+      continue;
+    if (!found)
+      firstBit = i;
+    lastBit = i;
+    found = true;
+  }
+  /* The field must be a single contiguous run of exactly bitSize bits */
+  if (!found || lastBit - firstBit + 1 != ac.bitSize)
+    return false;
+
+  step.ai = ac.ai;
+  step.reportID = ac.reportID;
+  step.byteOffset = firstBit / 8;
+  step.bitShift = firstBit % 8;
+  step.numBytes = (step.bitShift + ac.bitSize + 7) / 8;
+  step.isSigned = ac.logicalMin < 0;
+  step.signShift = 32 - ac.bitSize;
+  step.mask = allOnes;
+  step.scale = 2.0f / (static_cast<float>(ac.logicalMax) - static_cast<float>(ac.logicalMin));
+  step.bias = -1.0f - step.scale * ac.logicalMin;
+  return true;
+}
+
+void RawHIDJoystick::on_input_(DWORD type, BYTE const * data)
+{
+  if (type != RIM_TYPEHID)
+    return;
+  auto const & hid = *reinterpret_cast<RAWHID const *>(data);
+  auto const reportSize = hid.dwSizeHid;
+  auto report = hid.bRawData;
+  for (DWORD r = 0; r < hid.dwCount; ++r, report += reportSize)
+  {
+    for (auto const & step : plan_)
+    {
+      if ((useReportIDs_ && report[0] != step.reportID) || step.byteOffset + step.numBytes > reportSize)
+        continue;
+      std::uint64_t bits = 0;
+      for (unsigned k = 0; k < step.numBytes; ++k)
+        bits |= static_cast<std::uint64_t>(report[step.byteOffset + k]) << (8 * k);
+      auto const raw = static_cast<std::uint32_t>(bits >> step.bitShift) & step.mask;
+      auto const v = step.isSigned
+        ? static_cast<std::int32_t>(raw << step.signShift) >> step.signShift
+        : static_cast<std::int32_t>(raw);
+      sharedAxes_[step.ai].store(v * step.scale + step.bias, std::memory_order_relaxed);
+    }
+    if (caps_.empty())
+      continue;
+    auto const pp = reinterpret_cast<PHIDP_PREPARSED_DATA>(preparsedData_.data());
+    auto const pReport = reinterpret_cast<PCHAR>(const_cast<BYTE*>(report));
+    for (auto const & ac : caps_)
+    {
+      ULONG value = 0;
+      if (HidP_GetUsageValue(HidP_Input, ac.usagePage, ac.linkCollection, ac.usage, &value, pp, pReport, reportSize) != HIDP_STATUS_SUCCESS)
+        continue;
+      LONG v = static_cast<LONG>(value);
+      if (ac.logicalMin < 0 && ac.bitSize < 32 && (value & (1UL << (ac.bitSize - 1))))
+        v = static_cast<LONG>(value | ~((1UL << ac.bitSize) - 1));
+      sharedAxes_.at(ac.ai).store(lerp<LONG, float>(v, ac.logicalMin, ac.logicalMax, -1.0f, 1.0f), std::memory_order_relaxed);
+    }
+  }
+}
+
+/* RawMouseJoystick */
+float RawMouseJoystick::get_axis_value(AxisID::type axisID) const
+{
+  return this->axes_.at(axisID);
+}
+
+void RawMouseJoystick::update()
+{
+  auto const dx = dx_.exchange(0, std::memory_order_relaxed);
+  auto const dy = dy_.exchange(0, std::memory_order_relaxed);
+  if (dx == 0 && dy == 0)
+    return;
+  auto & rx = axes_[AxisID::rx];
+  auto & ry = axes_[AxisID::ry];
+  rx = std::max(-1.0f, std::min(1.0f, rx + dx * sensitivityX_));
+  ry = std::max(-1.0f, std::min(1.0f, ry + dy * sensitivityY_));
+}
+
+void RawMouseJoystick::recenter()
+{
+  dx_.store(0, std::memory_order_relaxed);
+  dy_.store(0, std::memory_order_relaxed);
+  axes_.fill(0.0f);
+}
+
+RawMouseJoystick::RawMouseJoystick(std::shared_ptr<RawInputThread> const & spThread, std::string const & nameSubstr, float sensitivityX, float sensitivityY)
+  : spThread_(spThread), sensitivityX_(sensitivityX), sensitivityY_(sensitivityY), dx_(0), dy_(0), axes_()
+{
+  if (!spThread_)
+    throw std::runtime_error("Raw input thread is NULL");
+  axes_.fill(0.0f);
+  HANDLE hDevice = NULL;
+  if (!nameSubstr.empty())
+  {
+    for (auto const & rdi : get_raw_devices())
+    {
+      if (rdi.type == RIM_TYPEMOUSE && rdi.name.find(nameSubstr) != std::string::npos)
+      {
+        hDevice = rdi.handle;
+        logging::log("joystick", logging::LogLevel::debug, "Using raw mouse ", rdi.name);
+        break;
+      }
+    }
+    if (hDevice == NULL)
+      throw std::runtime_error(stream_to_str("No raw mouse with name containing '", nameSubstr, "'"));
+  }
+  /* See RawHIDJoystick */
+  spThread_->add_callback(hDevice, this, [this](DWORD type, BYTE const * data) { on_input_(type, data); });
+  try {
+    spThread_->register_usage(HID_USAGE_PAGE_GENERIC, HID_USAGE_GENERIC_MOUSE);
+  } catch (...)
+  {
+    spThread_->remove_callbacks(this);
+    throw;
+  }
+}
+
+RawMouseJoystick::~RawMouseJoystick()
+{
+  spThread_->remove_callbacks(this);
+}
+
+void RawMouseJoystick::on_input_(DWORD type, BYTE const * data)
+{
+  if (type != RIM_TYPEMOUSE)
+    return;
+  auto const & mouse = *reinterpret_cast<RAWMOUSE const *>(data);
+  /* Absolute positions (tablets, remote desktop) are not movement */
+  if (mouse.usFlags & MOUSE_MOVE_ABSOLUTE)
+    return;
+  if (mouse.lLastX)
+    dx_.fetch_add(mouse.lLastX, std::memory_order_relaxed);
+  if (mouse.lLastY)
+    dy_.fetch_add(mouse.lLastY, std::memory_order_relaxed);
+}
@@ -0,0 +1,177 @@
+#ifndef RAWINPUT_HPP
+#define RAWINPUT_HPP
+
+#include "joystick.hpp"
+#include "thread.hpp"
+
+#include <string>
+#include <vector>
+#include <array>
+#include <memory>
+#include <atomic>
+#include <functional>
+#include <ostream>
+#include <cstdint>
+
+#include <windows.h>
+
+/* Raw input devices */
+struct RawDeviceInfo
+{
+  HANDLE handle = 0;
+  UINT type = 0;
+  std::string name = "";
+  UINT usagePage = 0;
+  UINT usage = 0;
+  DWORD vendorID = 0;
+  DWORD productID = 0;
+};
+
+std::ostream & operator<<(std::ostream & os, RawDeviceInfo const & rdi);
+
+std::vector<RawDeviceInfo> get_raw_devices();
+/* index selects among several devices with the same VID/PID */
+RawDeviceInfo find_raw_hid_device(DWORD vendorID, DWORD productID, unsigned index = 0);
+void register_raw_device(RawDeviceInfo const & rdi, HWND hwnd, bool remove = false);
+HWND create_window(WNDPROC wndProc, char const * className, char const * windowName, bool useMessageWindow, float alpha=1.0);
+
+/* Message pump thread with a message-only window. WM_INPUT is drained in batches with GetRawInputBuffer(). */
+class RawInputThread
+{
+public:
+  /* Called on the raw input thread; data points to RAWHID or RAWMOUSE, depending on type (RIM_TYPE*). */
+  using callback_t = std::function<void(DWORD type, BYTE const * data)>;
+
+  /* Callback with hDevice NULL receives input of all devices. */
+  void add_callback(HANDLE hDevice, void const * owner, callback_t const & cb);
+  /* After return the callbacks of owner are not being called and will not be called. */
+  void remove_callbacks(void const * owner);
+  /* Starts delivery of input of devices with given usage page and usage. */
+  void register_usage(USHORT usagePage, USHORT usage);
+
+  RawInputThread();
+  RawInputThread(RawInputThread const &) =delete;
+  RawInputThread & operator=(RawInputThread const &) =delete;
+  ~RawInputThread();
+
+private:
+  struct Callback
+  {
+    HANDLE hDevice;
+    void const * owner;
+    callback_t cb;
+  };
+
+  struct RegisterRequest
+  {
+    USHORT usagePage;
+    USHORT usage;
+    bool done;
+    DWORD error;
+  };
+
+  void run_();
+  void drain_();
+  void handle_message_(MSG const & msg);
+
+  static UINT const registerMsg_ = WM_USER + 1;
+
+  CriticalSection cs_;
+  std::vector<Callback> callbacks_;
+  Event ready_;
+  Event registered_;
+  Event stop_;
+  std::string className_;
+  HWND hwnd_;
+  /* 32-bit process on 64-bit Windows gets 64-bit RAWINPUTHEADER layout from GetRawInputBuffer() */
+  size_t headerSize_;
+  size_t blockAlign_;
+  std::vector<std::uint64_t> buffer_;
+  std::unique_ptr<Thread> spThread_;
+};
+
+/* HID joystick read via raw input; reports are decoded on the raw input thread. */
+class RawHIDJoystick : public Joystick, public Updated
+{
+public:
+  virtual float get_axis_value(AxisID::type axisID) const override;
+  virtual void update() override;
+
+  RawHIDJoystick(std::shared_ptr<RawInputThread> const & spThread, RawDeviceInfo const & rdi);
+  RawHIDJoystick(RawHIDJoystick const &) =delete;
+  RawHIDJoystick & operator=(RawHIDJoystick const &) =delete;
+  ~RawHIDJoystick();
+
+private:
+  struct AxisCaps
+  {
+    AxisID::type ai;
+    UCHAR reportID;
+    USHORT usagePage;
+    USHORT usage;
+    USHORT linkCollection;
+    USHORT bitSize;
+    LONG logicalMin;
+    LONG logicalMax;
+  };
+
+  /* Where an axis value lives in the report, computed once from the preparsed data. */
+  struct ExtractionStep
+  {
+    AxisID::type ai;
+    UCHAR reportID;
+    USHORT byteOffset;
+    UCHAR numBytes;
+    UCHAR bitShift;
+    UCHAR signShift;
+    bool isSigned;
+    std::uint32_t mask;
+    float scale;
+    float bias;
+  };
+
+  static AxisID::type usage2axis_(USHORT usagePage, USHORT usage);
+  bool make_extraction_step_(AxisCaps const & ac, ExtractionStep & step) const;
+  void on_input_(DWORD type, BYTE const * data);
+
+  std::shared_ptr<RawInputThread> spThread_;
+  RawDeviceInfo rdi_;
+  std::vector<BYTE> preparsedData_;
+  ULONG reportLength_;
+  bool useReportIDs_;
+  std::vector<ExtractionStep> plan_;
+  /* Axes that could not be located in the report; decoded with HidP_GetUsageValue() */
+  std::vector<AxisCaps> caps_;
+  std::array<std::atomic<float>, AxisID::num> sharedAxes_;
+  std::array<float, AxisID::num> axes_;
+};
+
+/* Relative mouse movement integrated into rx (x movement) and ry (y movement).
+ * Deltas are summed into atomics on the raw input thread, so update() only takes the sums: axis += sum * sensitivity, clamped to [-1, 1].
+ * Raw input registration is per process and usage, so this conflicts with a game that reads raw mouse input itself.
+ */
+class RawMouseJoystick : public Joystick, public Updated
+{
+public:
+  virtual float get_axis_value(AxisID::type axisID) const override;
+  virtual void update() override;
+  void recenter();
+
+  /* Reads all mice if nameSubstr is empty, otherwise the first mouse whose device name contains it */
+  RawMouseJoystick(std::shared_ptr<RawInputThread> const & spThread, std::string const & nameSubstr, float sensitivityX, float sensitivityY);
+  RawMouseJoystick(RawMouseJoystick const &) =delete;
+  RawMouseJoystick & operator=(RawMouseJoystick const &) =delete;
+  ~RawMouseJoystick();
+
+private:
+  void on_input_(DWORD type, BYTE const * data);
+
+  std::shared_ptr<RawInputThread> spThread_;
+  float sensitivityX_;
+  float sensitivityY_;
+  std::atomic<std::int32_t> dx_;
+  std::atomic<std::int32_t> dy_;
+  std::array<float, AxisID::num> axes_;
+};
+
+#endif
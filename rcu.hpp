@@ -0,0 +1,96 @@
+#ifndef RCU_HPP
+#define RCU_HPP
+
+#include "thread.hpp"
+
+#include <atomic>
+#include <memory>
+
+/* Read-copy-update slot for an object the sampling path uses without locks.
+ * Any thread may offer() a replacement. The sampling thread (one at a time) installs it with swap() between frames,
+ * and the object it replaces is destroyed later by collect() on another thread, so the sampling path never waits for a destructor.
+ * Other threads using get() hold get_reader_cs() meanwhile; collect() takes it, so it waits for them to be done.
+ */
+template <class T>
+class RcuSlot
+{
+public:
+  /* Before any other thread uses the slot */
+  void reset(std::unique_ptr<T> spInitial)
+  {
+    delete pCurrent_.exchange(spInitial.release());
+  }
+
+  /* Once no other thread uses the slot; destroys the current, offered and replaced objects on the calling thread */
+  void clear()
+  {
+    delete pOffered_.exchange(nullptr);
+    delete pRetired_.exchange(nullptr);
+    delete pCurrent_.exchange(nullptr);
+  }
+
+  /* Sampling thread, or another thread holding get_reader_cs() */
+  T * get() const { return pCurrent_.load(std::memory_order_acquire); }
+  CriticalSection & get_reader_cs() const { return readerCS_; }
+
+  /* Any thread; drops an earlier offer that has not been installed yet */
+  void offer(std::unique_ptr<T> sp)
+  {
+    delete pOffered_.exchange(sp.release(), std::memory_order_acq_rel);
+  }
+
+  /* Sampling thread only. Installs the offered object after carry(next, current) has copied state over.
+   * Returns false if nothing was offered, or if the object replaced last time has not been collected yet (the offer then waits).
+   */
+  template <class F>
+  bool swap(F carry)
+  {
+    if (pRetired_.load(std::memory_order_acquire) != nullptr)
+      return false;
+    auto const pNext = pOffered_.exchange(nullptr, std::memory_order_acq_rel);
+    if (pNext == nullptr)
+      return false;
+    auto const pPrevious = pCurrent_.load(std::memory_order_relaxed);
+    if (pPrevious != nullptr)
+      carry(*pNext, *pPrevious);
+    pCurrent_.store(pNext, std::memory_order_release);
+    pRetired_.store(pPrevious, std::memory_order_release);
+    retired_.set();
+    return true;
+  }
+
+  /* Not the sampling thread. Destroys the replaced object once no reader can hold it; call when get_retired_handle() is signaled. */
+  void collect()
+  {
+    T * pRetired;
+    {
+      ScopedLock<CriticalSection> lock (readerCS_);
+      pRetired = pRetired_.load(std::memory_order_acquire);
+    }
+    delete pRetired;
+    pRetired_.store(nullptr, std::memory_order_release);
+  }
+
+  /* Auto-reset event, signaled by swap() */
+  HANDLE get_retired_handle() const { return retired_.get_handle(); }
+
+  RcuSlot() : pCurrent_(nullptr), pOffered_(nullptr), pRetired_(nullptr), readerCS_(), retired_(false, false) {}
+  RcuSlot(RcuSlot const &) =delete;
+  RcuSlot & operator=(RcuSlot const &) =delete;
+  ~RcuSlot()
+  {
+    delete pRetired_.load();
+    delete pOffered_.load();
+    delete pCurrent_.load();
+  }
+
+private:
+  std::atomic<T *> pCurrent_;
+  std::atomic<T *> pOffered_;
+  /* Replaced by swap(), not yet destroyed by collect() */
+  std::atomic<T *> pRetired_;
+  mutable CriticalSection readerCS_;
+  Event retired_;
+};
+
+#endif
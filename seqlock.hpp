@@ -0,0 +1,69 @@
+#ifndef SEQLOCK_HPP
+#define SEQLOCK_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+/* Single-writer sequence lock over a trivially copyable value.
+ * The writer makes the sequence odd, copies the value and makes it even again; a reader retries if the sequence was odd or changed during its copy.
+ * Readers never block the writer and take no locks, so any number of them (also in other processes, the layout has no pointers) may read concurrently.
+ */
+template <class T>
+class Seqlock
+{
+public:
+  static_assert(std::is_trivially_copyable<T>::value, "Seqlock value must be trivially copyable");
+
+  /* Only one thread may write */
+  void write(T const & value)
+  {
+    auto const seq = seq_.load(std::memory_order_relaxed);
+    seq_.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(const_cast<T *>(&value_), &value, sizeof(T));
+    std::atomic_thread_fence(std::memory_order_release);
+    seq_.store(seq + 2, std::memory_order_relaxed);
+  }
+
+  /* Returns false if the copy may be torn */
+  bool try_read(T & value, std::uint32_t & seq) const
+  {
+    seq = seq_.load(std::memory_order_acquire);
+    if (seq & 1)
+      return false;
+    std::memcpy(&value, const_cast<T const *>(&value_), sizeof(T));
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return seq_.load(std::memory_order_relaxed) == seq;
+  }
+
+  /* Bounded-time read: gives up after maxAttempts torn copies and leaves value unchanged */
+  bool read(T & value, unsigned maxAttempts = 16) const
+  {
+    T copy;
+    std::uint32_t seq;
+    for (unsigned i = 0; i < maxAttempts; ++i)
+    {
+      if (try_read(copy, seq))
+      {
+        value = copy;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /* Even and incremented by 2 on each write; 0 until the first write */
+  std::uint32_t get_sequence() const { return seq_.load(std::memory_order_acquire); }
+
+  Seqlock() : seq_(0) { std::memset(const_cast<T *>(&value_), 0, sizeof(T)); }
+  Seqlock(Seqlock const &) =delete;
+  Seqlock & operator=(Seqlock const &) =delete;
+
+private:
+  std::atomic<std::uint32_t> seq_;
+  T volatile value_;
+};
+
+#endif
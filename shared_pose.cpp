@@ -0,0 +1,134 @@
+#include "shared_pose.hpp"
+#include "logging.hpp"
+#include "util.hpp"
+#include "clock.hpp"
+
+#include <new>
+#include <stdexcept>
+
+/* SharedPoseWriter */
+void SharedPoseWriter::publish(Pose const & pose)
+{
+  SharedPoseSample sample;
+  sample.pose = pose;
+  sample.frame = ++frame_;
+  sample.ticks = get_qpc_ticks();
+  pBlock_->sample.write(sample);
+}
+
+SharedPoseWriter::SharedPoseWriter() : hMapping_(NULL), pBlock_(NULL), frame_(0)
+{
+  hMapping_ = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, sizeof(SharedPoseBlock), sharedPoseName);
+  if (hMapping_ == NULL)
+    throw std::runtime_error(stream_to_str("Failed to create ", sharedPoseName, ", error = ", GetLastError()));
+  auto const existed = GetLastError() == ERROR_ALREADY_EXISTS;
+  pBlock_ = static_cast<SharedPoseBlock *>(MapViewOfFile(hMapping_, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(SharedPoseBlock)));
+  if (pBlock_ == NULL)
+  {
+    auto const error = GetLastError();
+    CloseHandle(hMapping_);
+    throw std::runtime_error(stream_to_str("Failed to map ", sharedPoseName, ", error = ", error));
+  }
+  /* The block outlives a server while clients keep it open */
+  if (existed && pBlock_->magic == sharedPoseMagic)
+  {
+    SharedPoseSample sample;
+    auto const live = pBlock_->sample.read(sample) && qpc_ticks_to_ms(get_qpc_ticks() - sample.ticks) < 1000.0;
+    if (live)
+    {
+      auto const pid = pBlock_->serverPid;
+      UnmapViewOfFile(pBlock_);
+      CloseHandle(hMapping_);
+      throw std::runtime_error(stream_to_str("Another pose server is running (pid: ", pid, ")"));
+    }
+  }
+  pBlock_->magic = 0;
+  new (&pBlock_->sample) Seqlock<SharedPoseSample>();
+  pBlock_->version = sharedPoseVersion;
+  pBlock_->serverPid = GetCurrentProcessId();
+  std::atomic_thread_fence(std::memory_order_release);
+  pBlock_->magic = sharedPoseMagic;
+}
+
+SharedPoseWriter::~SharedPoseWriter()
+{
+  pBlock_->magic = 0;
+  UnmapViewOfFile(pBlock_);
+  CloseHandle(hMapping_);
+}
+
+/* SharedPoseReader */
+bool SharedPoseReader::read(Pose & pose)
+{
+  if (pBlock_ == NULL && !open_())
+    return false;
+  if (pBlock_->magic != sharedPoseMagic)
+  {
+    /* Server exited */
+    set_live_(false);
+    close_();
+    return false;
+  }
+  SharedPoseSample sample;
+  if (!pBlock_->sample.read(sample, maxAttempts_))
+    return false;
+  auto const live = get_qpc_ticks() - sample.ticks <= timeout_;
+  set_live_(live);
+  if (live)
+    pose = sample.pose;
+  return live;
+}
+
+SharedPoseReader::SharedPoseReader(double timeoutMs)
+  : hMapping_(NULL), pBlock_(NULL), timeout_(static_cast<std::int64_t>(timeoutMs * get_qpc_frequency() / 1000.0)), nextOpen_(0), live_(false)
+{
+  open_();
+}
+
+SharedPoseReader::~SharedPoseReader()
+{
+  close_();
+}
+
+bool SharedPoseReader::open_()
+{
+  auto const now = get_qpc_ticks();
+  if (now < nextOpen_)
+    return false;
+  nextOpen_ = now + static_cast<std::int64_t>(reopenPeriodMs_ * get_qpc_frequency() / 1000.0);
+  hMapping_ = OpenFileMappingA(FILE_MAP_READ, FALSE, sharedPoseName);
+  if (hMapping_ == NULL)
+    return false;
+  pBlock_ = static_cast<SharedPoseBlock const *>(MapViewOfFile(hMapping_, FILE_MAP_READ, 0, 0, sizeof(SharedPoseBlock)));
+  if (pBlock_ == NULL)
+  {
+    logging::log("main", logging::LogLevel::error, "Failed to map ", sharedPoseName, ", error = ", GetLastError());
+    close_();
+    return false;
+  }
+  if (pBlock_->magic != sharedPoseMagic || pBlock_->version != sharedPoseVersion)
+  {
+    close_();
+    return false;
+  }
+  logging::log("main", logging::LogLevel::info, "Opened pose server shared memory (server pid: ", pBlock_->serverPid, ")");
+  return true;
+}
+
+void SharedPoseReader::close_()
+{
+  if (pBlock_ != NULL)
+    UnmapViewOfFile(pBlock_);
+  pBlock_ = NULL;
+  if (hMapping_ != NULL)
+    CloseHandle(hMapping_);
+  hMapping_ = NULL;
+}
+
+void SharedPoseReader::set_live_(bool live)
+{
+  if (live == live_)
+    return;
+  live_ = live;
+  logging::log("main", logging::LogLevel::info, live ? "Pose server is publishing" : "Pose server stopped publishing");
+}
@@ -0,0 +1,81 @@
+#ifndef SHARED_POSE_HPP
+#define SHARED_POSE_HPP
+
+#include "pose.hpp"
+#include "seqlock.hpp"
+
+#include <cstdint>
+
+#include <windows.h>
+
+/* Pose published by the pose server in named shared memory */
+char const * const sharedPoseName = "Local\\joy2tir_pose";
+std::uint32_t const sharedPoseMagic = 0x504A324A; //"J2JP"
+std::uint32_t const sharedPoseVersion = 1;
+
+struct SharedPoseSample
+{
+  Pose pose;
+  /* Incremented on each publish */
+  std::uint32_t frame;
+  /* QPC ticks at publish; QPC is system-wide, so readers can compute the age */
+  std::int64_t ticks;
+};
+
+struct SharedPoseBlock
+{
+  /* sharedPoseMagic while a server is running, 0 after it exits */
+  std::uint32_t magic;
+  std::uint32_t version;
+  std::uint32_t serverPid;
+  std::uint32_t reserved;
+  Seqlock<SharedPoseSample> sample;
+};
+
+/* Server side. Only one server may publish; the constructor throws if another live server owns the block. */
+class SharedPoseWriter
+{
+public:
+  void publish(Pose const & pose);
+
+  SharedPoseWriter();
+  SharedPoseWriter(SharedPoseWriter const &) =delete;
+  SharedPoseWriter & operator=(SharedPoseWriter const &) =delete;
+  ~SharedPoseWriter();
+
+private:
+  HANDLE hMapping_;
+  SharedPoseBlock * pBlock_;
+  std::uint32_t frame_;
+};
+
+/* Client side. read() takes no locks and a bounded time: a seqlock copy with a fixed number of retries.
+ * If no server is running, the block is looked for again once a second.
+ */
+class SharedPoseReader
+{
+public:
+  /* Returns false, leaving pose unchanged, if there is no server, its pose is older than timeout or the copy kept being torn */
+  bool read(Pose & pose);
+  bool is_open() const { return pBlock_ != NULL; }
+
+  SharedPoseReader(double timeoutMs = 500.0);
+  SharedPoseReader(SharedPoseReader const &) =delete;
+  SharedPoseReader & operator=(SharedPoseReader const &) =delete;
+  ~SharedPoseReader();
+
+private:
+  bool open_();
+  void close_();
+  void set_live_(bool live);
+
+  static double constexpr reopenPeriodMs_ = 1000.0;
+  static unsigned const maxAttempts_ = 16;
+  HANDLE hMapping_;
+  SharedPoseBlock const * pBlock_;
+  std::int64_t timeout_;
+  std::int64_t nextOpen_;
+  bool live_;
+};
+
+#endif
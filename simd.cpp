@@ -0,0 +1,168 @@
+#include "simd.hpp"
+
+#include <cstring>
+#include <cstdlib>
+
+#include <emmintrin.h>
+#include <immintrin.h>
+
+namespace simd
+{
+
+decltype(Level::names_) Level::names_ = {"scalar", "sse2", "avx"};
+
+char const * Level::to_cstr(Level::type id)
+{
+  return (id < first || id >= num) ? "unknown" : names_.at(id);
+}
+
+Level::type Level::from_cstr(char const * name)
+{
+  for (decltype(names_)::size_type i = 0; i < names_.size(); ++i)
+  {
+    if (strcmp(names_.at(i), name) == 0)
+      return static_cast<type>(i);
+  }
+  return num;
+}
+
+/* Scalar */
+static void scale_bias_f32_scalar(float const * in, float const * scale, float const * bias, float * out, std::size_t n)
+{
+  for (std::size_t i = 0; i < n; ++i)
+    out[i] = in[i] * scale[i] + bias[i];
+}
+
+static void scale_bias_i32_scalar(std::int32_t const * in, float const * scale, float const * bias, float * out, std::size_t n)
+{
+  for (std::size_t i = 0; i < n; ++i)
+    out[i] = static_cast<float>(in[i]) * scale[i] + bias[i];
+}
+
+/* SSE2 */
+__attribute__((target("sse2")))
+static void scale_bias_f32_sse2(float const * in, float const * scale, float const * bias, float * out, std::size_t n)
+{
+  std::size_t i = 0;
+  for (; i + 4 <= n; i += 4)
+  {
+    auto const v = _mm_mul_ps(_mm_loadu_ps(in + i), _mm_loadu_ps(scale + i));
+    _mm_storeu_ps(out + i, _mm_add_ps(v, _mm_loadu_ps(bias + i)));
+  }
+  for (; i < n; ++i)
+    out[i] = in[i] * scale[i] + bias[i];
+}
+
+__attribute__((target("sse2")))
+static void scale_bias_i32_sse2(std::int32_t const * in, float const * scale, float const * bias, float * out, std::size_t n)
+{
+  std::size_t i = 0;
+  for (; i + 4 <= n; i += 4)
+  {
+    auto const f = _mm_cvtepi32_ps(_mm_loadu_si128(reinterpret_cast<__m128i const *>(in + i)));
+    auto const v = _mm_mul_ps(f, _mm_loadu_ps(scale + i));
+    _mm_storeu_ps(out + i, _mm_add_ps(v, _mm_loadu_ps(bias + i)));
+  }
+  for (; i < n; ++i)
+    out[i] = static_cast<float>(in[i]) * scale[i] + bias[i];
+}
+
+/* AVX */
+__attribute__((target("avx")))
+static void scale_bias_f32_avx(float const * in, float const * scale, float const * bias, float * out, std::size_t n)
+{
+  std::size_t i = 0;
+  for (; i + 8 <= n; i += 8)
+  {
+    auto const v = _mm256_mul_ps(_mm256_loadu_ps(in + i), _mm256_loadu_ps(scale + i));
+    _mm256_storeu_ps(out + i, _mm256_add_ps(v, _mm256_loadu_ps(bias + i)));
+  }
+  for (; i + 4 <= n; i += 4)
+  {
+    auto const v = _mm_mul_ps(_mm_loadu_ps(in + i), _mm_loadu_ps(scale + i));
+    _mm_storeu_ps(out + i, _mm_add_ps(v, _mm_loadu_ps(bias + i)));
+  }
+  for (; i < n; ++i)
+    out[i] = in[i] * scale[i] + bias[i];
+}
+
+__attribute__((target("avx")))
+static void scale_bias_i32_avx(std::int32_t const * in, float const * scale, float const * bias, float * out, std::size_t n)
+{
+  std::size_t i = 0;
+  for (; i + 8 <= n; i += 8)
+  {
+    auto const f = _mm256_cvtepi32_ps(_mm256_loadu_si256(reinterpret_cast<__m256i const *>(in + i)));
+    auto const v = _mm256_mul_ps(f, _mm256_loadu_ps(scale + i));
+    _mm256_storeu_ps(out + i, _mm256_add_ps(v, _mm256_loadu_ps(bias + i)));
+  }
+  for (; i + 4 <= n; i += 4)
+  {
+    auto const f = _mm_cvtepi32_ps(_mm_loadu_si128(reinterpret_cast<__m128i const *>(in + i)));
+    auto const v = _mm_mul_ps(f, _mm_loadu_ps(scale + i));
+    _mm_storeu_ps(out + i, _mm_add_ps(v, _mm_loadu_ps(bias + i)));
+  }
+  for (; i < n; ++i)
+    out[i] = static_cast<float>(in[i]) * scale[i] + bias[i];
+}
+
+/* Dispatch */
+struct Kernels
+{
+  Level::type level;
+  void (*scaleBiasF32)(float const *, float const *, float const *, float *, std::size_t);
+  void (*scaleBiasI32)(std::int32_t const *, float const *, float const *, float *, std::size_t);
+};
+
+Level::type get_supported_level()
+{
+  __builtin_cpu_init();
+  /* Also checks that the OS saves AVX state (OSXSAVE and XCR0) */
+  if (__builtin_cpu_supports("avx"))
+    return Level::avx;
+#if defined(__SSE2__)
+  return Level::sse2;
+#else
+  return __builtin_cpu_supports("sse2") ? Level::sse2 : Level::scalar;
+#endif
+}
+
+static Kernels select_kernels()
+{
+  auto level = get_supported_level();
+  if (auto const envLevel = std::getenv("JOY2TIR_SIMD"))
+  {
+    auto const cap = Level::from_cstr(envLevel);
+    if (cap != Level::num && cap < level)
+      level = cap;
+  }
+  switch (level)
+  {
+    case Level::avx: return Kernels{ level, scale_bias_f32_avx, scale_bias_i32_avx };
+    case Level::sse2: return Kernels{ level, scale_bias_f32_sse2, scale_bias_i32_sse2 };
+    default: return Kernels{ Level::scalar, scale_bias_f32_scalar, scale_bias_i32_scalar };
+  }
+}
+
+static Kernels const & get_kernels()
+{
+  static Kernels const kernels = select_kernels();
+  return kernels;
+}
+
+Level::type get_level()
+{
+  return get_kernels().level;
+}
+
+void scale_bias(float const * in, float const * scale, float const * bias, float * out, std::size_t n)
+{
+  get_kernels().scaleBiasF32(in, scale, bias, out, n);
+}
+
+void scale_bias(std::int32_t const * in, float const * scale, float const * bias, float * out, std::size_t n)
+{
+  get_kernels().scaleBiasI32(in, scale, bias, out, n);
+}
+
+}
@@ -0,0 +1,37 @@
+#ifndef SIMD_HPP
+#define SIMD_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+/* Vectorized kernels for the per-frame float math (axis scaling, pose mapping, TrackIR conversion).
+ * The 32-bit build can not assume SSE2 (its float math is x87), so the instruction set is chosen at run time from AVX, SSE2 and scalar;
+ * the 64-bit build always has at least SSE2. JOY2TIR_SIMD=scalar|sse2|avx caps the level, e.g. to compare results.
+ */
+namespace simd
+{
+
+struct Level
+{
+  enum type { scalar = 0, first = scalar, sse2, avx, num };
+
+  static char const * to_cstr(type id);
+  static type from_cstr(char const * name);
+
+private:
+  static std::array<char const *, num> names_;
+};
+
+/* Level of the kernels in use, selected on first use */
+Level::type get_level();
+/* Best level the CPU and OS support */
+Level::type get_supported_level();
+
+/* out[i] = in[i] * scale[i] + bias[i] */
+void scale_bias(float const * in, float const * scale, float const * bias, float * out, std::size_t n);
+void scale_bias(std::int32_t const * in, float const * scale, float const * bias, float * out, std::size_t n);
+
+}
+
+#endif
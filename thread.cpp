@@ -0,0 +1,83 @@
+#include "thread.hpp"
+#include "util.hpp"
+#include "logging.hpp"
+
+#include <stdexcept>
+#include <atomic>
+
+namespace
+{
+
+std::atomic<bool> g_processDetaching (false);
+
+} //anonymous
+
+Event::Event(bool manualReset, bool initialState) : h_(CreateEvent(NULL, manualReset, initialState, NULL))
+{
+  if (h_ == NULL)
+    throw std::runtime_error(stream_to_str("Failed to create event, error = ", GetLastError()));
+}
+
+Event::~Event()
+{
+  CloseHandle(h_);
+}
+
+void Thread::join()
+{
+  if (h_ == NULL)
+    return;
+  if (!g_processDetaching.load() && id_ != GetCurrentThreadId())
+    WaitForSingleObject(h_, INFINITE);
+  CloseHandle(h_);
+  h_ = NULL;
+}
+
+void Thread::set_priority(int priority)
+{
+  if (!SetThreadPriority(h_, priority))
+    logging::log("thread", logging::LogLevel::error, "Failed to set thread ", id_, " priority to ", priority, ", error = ", GetLastError());
+}
+
+void Thread::set_process_detaching()
+{
+  g_processDetaching.store(true);
+}
+
+bool Thread::is_process_detaching()
+{
+  return g_processDetaching.load();
+}
+
+Thread::Thread(function_t const & f) : f_(f), h_(NULL), id_(0), hModule_(NULL)
+{
+  if (!GetModuleHandleEx(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS, reinterpret_cast<LPCSTR>(run_), &hModule_))
+    throw std::runtime_error(stream_to_str("Failed to reference module for thread, error = ", GetLastError()));
+  h_ = CreateThread(NULL, 0, run_, this, 0, &id_);
+  if (h_ == NULL)
+  {
+    auto const error = GetLastError();
+    FreeLibrary(hModule_);
+    throw std::runtime_error(stream_to_str("Failed to create thread, error = ", error));
+  }
+}
+
+Thread::~Thread()
+{
+  join();
+}
+
+DWORD WINAPI Thread::run_(LPVOID pv)
+{
+  auto * that = static_cast<Thread*>(pv);
+  /* The module may be unloaded by this call, so the thread must not return into it */
+  auto const hModule = that->hModule_;
+  try {
+    that->f_();
+  } catch (std::exception & e)
+  {
+    logging::log("thread", logging::LogLevel::error, "Exception in thread ", GetCurrentThreadId(), ": ", e.what());
+  }
+  FreeLibraryAndExitThread(hModule, 0);
+  return 0;
+}
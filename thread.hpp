@@ -0,0 +1,112 @@
+#ifndef THREAD_HPP
+#define THREAD_HPP
+
+#include <functional>
+
+#include <windows.h>
+
+/* Synchronization helpers (std::mutex is not available with the win32 thread model) */
+class CriticalSection
+{
+public:
+  void lock() { EnterCriticalSection(&cs_); }
+  /* Returns false instead of waiting if another thread holds it */
+  bool try_lock() { return TryEnterCriticalSection(&cs_) != FALSE; }
+  void unlock() { LeaveCriticalSection(&cs_); }
+
+  CriticalSection() { InitializeCriticalSection(&cs_); }
+  CriticalSection(CriticalSection const &) =delete;
+  CriticalSection & operator=(CriticalSection const &) =delete;
+  ~CriticalSection() { DeleteCriticalSection(&cs_); }
+
+private:
+  CRITICAL_SECTION cs_;
+};
+
+template <class L>
+class ScopedLock
+{
+public:
+  ScopedLock(L & l) : l_(l) { l_.lock(); }
+  ScopedLock(ScopedLock const &) =delete;
+  ScopedLock & operator=(ScopedLock const &) =delete;
+  ~ScopedLock() { l_.unlock(); }
+
+private:
+  L & l_;
+};
+
+/* Holds the lock only if it was free */
+template <class L>
+class ScopedTryLock
+{
+public:
+  bool owns_lock() const { return owns_; }
+
+  ScopedTryLock(L & l) : l_(l), owns_(l_.try_lock()) {}
+  ScopedTryLock(ScopedTryLock const &) =delete;
+  ScopedTryLock & operator=(ScopedTryLock const &) =delete;
+  ~ScopedTryLock() { if (owns_) l_.unlock(); }
+
+private:
+  L & l_;
+  bool owns_;
+};
+
+/* Win32 event */
+class Event
+{
+public:
+  void set() { SetEvent(h_); }
+  void reset() { ResetEvent(h_); }
+  /* Returns true if signaled */
+  bool wait(DWORD ms = INFINITE) const { return WaitForSingleObject(h_, ms) == WAIT_OBJECT_0; }
+  HANDLE get_handle() const { return h_; }
+
+  Event(bool manualReset = true, bool initialState = false);
+  Event(Event const &) =delete;
+  Event & operator=(Event const &) =delete;
+  ~Event();
+
+private:
+  HANDLE h_;
+};
+
+/* Thread (std::thread is not available with the win32 thread model).
+ * Destructor waits for the thread function to return, so stop it beforehand.
+ * The thread holds a reference to the module it runs in and exits with FreeLibraryAndExitThread(),
+ * so a DLL stays loaded while its threads run, instead of being unmapped under them by FreeLibrary().
+ */
+class Thread
+{
+public:
+  using function_t = std::function<void()>;
+
+  /* Does not wait after set_process_detaching(), or on the thread itself */
+  void join();
+  DWORD get_id() const { return id_; }
+  HANDLE get_handle() const { return h_; }
+  void set_priority(int priority);
+
+  /* Called by DllMain() on DLL_PROCESS_DETACH, before static destructors run.
+   * The loader lock is held then and exiting threads need it, so owners destroyed from then on only signal their threads to stop.
+   * Threads still running at that point are being terminated with the process; others have to be stopped by an explicit shutdown.
+   */
+  static void set_process_detaching();
+  static bool is_process_detaching();
+
+  Thread(function_t const & f);
+  Thread(Thread const &) =delete;
+  Thread & operator=(Thread const &) =delete;
+  ~Thread();
+
+private:
+  static DWORD WINAPI run_(LPVOID pv);
+
+  function_t f_;
+  HANDLE h_;
+  DWORD id_;
+  HMODULE hModule_;
+};
+
+#endif
@@ -0,0 +1,56 @@
+#include "timing.hpp"
+
+void PhaseTimer::start()
+{
+  start_ = get_qpc_ticks();
+  phases_.clear();
+}
+
+void PhaseTimer::add(std::string const & name, std::int64_t beginTicks, std::int64_t endTicks)
+{
+  if (!enabled_)
+    return;
+  phases_.push_back(Phase{ name, qpc_ticks_to_ms(endTicks - beginTicks) });
+}
+
+double PhaseTimer::get_total_ms() const
+{
+  return qpc_ticks_to_ms(get_qpc_ticks() - start_);
+}
+
+std::vector<PhaseTimer::Phase> const & PhaseTimer::get_phases() const
+{
+  return phases_;
+}
+
+void PhaseTimer::set_enabled(bool enabled)
+{
+  enabled_ = enabled;
+}
+
+bool PhaseTimer::is_enabled() const
+{
+  return enabled_;
+}
+
+PhaseTimer::PhaseTimer() : enabled_(true), start_(get_qpc_ticks()), phases_()
+{}
+
+ScopedPhase::ScopedPhase(PhaseTimer & timer, char const * name)
+  : timer_(timer), name_(timer.is_enabled() ? name : ""), begin_(get_qpc_ticks())
+{}
+
+ScopedPhase::ScopedPhase(PhaseTimer & timer, std::string const & prefix, char const * name)
+  : timer_(timer), name_(timer.is_enabled() ? prefix + "/" + name : ""), begin_(get_qpc_ticks())
+{}
+
+ScopedPhase::~ScopedPhase()
+{
+  timer_.add(name_, begin_, get_qpc_ticks());
+}
+
+PhaseTimer & startup_timer()
+{
+  static PhaseTimer timer;
+  return timer;
+}
@@ -0,0 +1,54 @@
+#ifndef TIMING_HPP
+#define TIMING_HPP
+
+#include "clock.hpp"
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+/* Named phase durations (startup timing report) */
+class PhaseTimer
+{
+public:
+  struct Phase
+  {
+    std::string name;
+    double ms;
+  };
+
+  void start();
+  void add(std::string const & name, std::int64_t beginTicks, std::int64_t endTicks);
+  double get_total_ms() const;
+  std::vector<Phase> const & get_phases() const;
+
+  /* Disabled timer records nothing (e.g. device re-initialization after startup). */
+  void set_enabled(bool enabled);
+  bool is_enabled() const;
+
+  PhaseTimer();
+
+private:
+  bool enabled_;
+  std::int64_t start_;
+  std::vector<Phase> phases_;
+};
+
+class ScopedPhase
+{
+public:
+  ScopedPhase(PhaseTimer & timer, char const * name);
+  ScopedPhase(PhaseTimer & timer, std::string const & prefix, char const * name);
+  ScopedPhase(ScopedPhase const &) =delete;
+  ScopedPhase & operator=(ScopedPhase const &) =delete;
+  ~ScopedPhase();
+
+private:
+  PhaseTimer & timer_;
+  std::string name_;
+  std::int64_t begin_;
+};
+
+PhaseTimer & startup_timer();
+
+#endif
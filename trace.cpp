@@ -0,0 +1,455 @@
+#include "trace.hpp"
+#include "util.hpp"
+#include "logging.hpp"
+#include "profiler.hpp"
+#include "clock.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+#include <cmath>
+
+namespace trace
+{
+
+FileHeader make_header(Kind kind, std::int64_t startTicks)
+{
+  FileHeader header;
+  std::memcpy(header.magic, magic, sizeof(header.magic));
+  header.version = version;
+  header.kind = kind;
+  header.qpcFrequency = get_qpc_frequency();
+  header.startTicks = startTicks;
+  return header;
+}
+
+void check_header(FileHeader const & header, Kind kind, std::string const & path)
+{
+  if (std::memcmp(header.magic, magic, sizeof(header.magic)) != 0)
+    throw std::runtime_error(stream_to_str("Not a trace file: ", path));
+  if (header.version != version || header.kind != kind)
+    throw std::runtime_error(stream_to_str("Unsupported trace ", path, " (version: ", header.version, "; kind: ", header.kind, ")"));
+}
+
+/* MappedFile */
+std::uint8_t const * MappedFile::get(std::uint64_t offset, std::size_t size, std::size_t & available)
+{
+  if (offset >= size_)
+  {
+    available = 0;
+    return NULL;
+  }
+  auto const wanted = std::min<std::uint64_t>(size, size_ - offset);
+  if (pView_ == NULL || offset < viewOffset_ || offset + wanted > viewOffset_ + viewSize_)
+  {
+    PROFILE_ZONE("MappedFile::remap");
+    unmap_();
+    viewOffset_ = offset - offset % granularity_;
+    viewSize_ = static_cast<std::size_t>(std::min<std::uint64_t>(windowSize_, size_ - viewOffset_));
+    pView_ = static_cast<std::uint8_t const *>(MapViewOfFile(hMapping_, FILE_MAP_READ, static_cast<DWORD>(viewOffset_ >> 32), static_cast<DWORD>(viewOffset_), viewSize_));
+    if (pView_ == NULL)
+      throw std::runtime_error(stream_to_str("Failed to map view at ", viewOffset_, ", error = ", GetLastError()));
+  }
+  available = static_cast<std::size_t>(viewOffset_ + viewSize_ - offset);
+  return pView_ + (offset - viewOffset_);
+}
+
+MappedFile::MappedFile(std::string const & path, std::size_t windowSize)
+  : hFile_(INVALID_HANDLE_VALUE), hMapping_(NULL), size_(0), windowSize_(windowSize), granularity_(0), pView_(NULL), viewOffset_(0), viewSize_(0)
+{
+  SYSTEM_INFO si;
+  GetSystemInfo(&si);
+  granularity_ = si.dwAllocationGranularity;
+  /* A window must hold a whole record wherever the aligned view starts */
+  windowSize_ = std::max<std::size_t>(windowSize_, 2 * granularity_);
+  hFile_ = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (hFile_ == INVALID_HANDLE_VALUE)
+    throw std::runtime_error(stream_to_str("Failed to open ", path, ", error = ", GetLastError()));
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(hFile_, &size) || size.QuadPart == 0)
+  {
+    CloseHandle(hFile_);
+    throw std::runtime_error(stream_to_str("Failed to get size of ", path, " or file is empty"));
+  }
+  size_ = size.QuadPart;
+  hMapping_ = CreateFileMappingA(hFile_, NULL, PAGE_READONLY, 0, 0, NULL);
+  if (hMapping_ == NULL)
+  {
+    auto const error = GetLastError();
+    CloseHandle(hFile_);
+    throw std::runtime_error(stream_to_str("Failed to create mapping of ", path, ", error = ", error));
+  }
+}
+
+MappedFile::~MappedFile()
+{
+  unmap_();
+  CloseHandle(hMapping_);
+  CloseHandle(hFile_);
+}
+
+void MappedFile::unmap_()
+{
+  if (pView_ != NULL)
+    UnmapViewOfFile(pView_);
+  pView_ = NULL;
+}
+
+/* AxisTraceWriter */
+void AxisTraceWriter::add(std::int64_t ticks, axes_t const & axes)
+{
+  std::uint8_t buffer[maxAxisRecordSize];
+  std::uint8_t * p = buffer;
+  std::array<std::int64_t, AxisID::num> deltas;
+  AxisID::mask_t mask = 0;
+  for (int i = AxisID::first; i < AxisID::num; ++i)
+  {
+    auto const v = static_cast<std::int32_t>(std::lround(axes[i] * quantum));
+    deltas[i] = static_cast<std::int64_t>(v) - last_[i];
+    if (deltas[i] != 0)
+      mask |= AxisID::to_mask(static_cast<AxisID::type>(i));
+    last_[i] = v;
+  }
+  if (mask == 0)
+    return;
+  auto const us = static_cast<std::int64_t>(qpc_ticks_to_us(ticks - startTicks_));
+  p = put_varint(p, static_cast<std::uint64_t>(std::max<std::int64_t>(us - lastUs_, 0)));
+  p = put_varint(p, mask);
+  for (int i = AxisID::first; i < AxisID::num; ++i)
+    if (deltas[i] != 0)
+      p = put_varint(p, zigzag(deltas[i]));
+  stream_.write(reinterpret_cast<char const *>(buffer), p - buffer);
+  lastUs_ = std::max(us, lastUs_);
+  ++records_;
+}
+
+AxisTraceWriter::AxisTraceWriter(std::string const & path)
+  : stream_(path, std::ios::out | std::ios::binary | std::ios::trunc), startTicks_(get_qpc_ticks()), lastUs_(0), last_(), records_(0)
+{
+  if (!stream_.is_open())
+    throw std::runtime_error(stream_to_str("Failed to open ", path, " for writing"));
+  last_.fill(0);
+  auto const header = make_header(axisSamples, startTicks_);
+  stream_.write(reinterpret_cast<char const *>(&header), sizeof(header));
+}
+
+/* AxisTraceReader */
+bool AxisTraceReader::next(std::int64_t & us, axes_t & axes)
+{
+  std::size_t available = 0;
+  auto const begin = file_.get(offset_, maxAxisRecordSize, available);
+  if (begin == NULL)
+    return false;
+  auto p = begin;
+  auto const end = begin + available;
+  std::uint64_t dt, mask;
+  if (!get_varint(p, end, dt) || !get_varint(p, end, mask))
+    return false;
+  for (int i = AxisID::first; i < AxisID::num; ++i)
+  {
+    if ((mask & AxisID::to_mask(static_cast<AxisID::type>(i))) == 0)
+      continue;
+    std::uint64_t delta;
+    if (!get_varint(p, end, delta))
+      return false;
+    values_[i] += static_cast<std::int32_t>(unzigzag(delta));
+    axes[i] = values_[i] / quantum;
+  }
+  offset_ += p - begin;
+  us_ += dt;
+  us = us_;
+  return true;
+}
+
+void AxisTraceReader::rewind()
+{
+  offset_ = sizeof(FileHeader);
+  us_ = 0;
+  values_.fill(0);
+}
+
+AxisTraceReader::AxisTraceReader(std::string const & path) : file_(path), offset_(0), us_(0), values_()
+{
+  std::size_t available = 0;
+  auto const p = file_.get(0, sizeof(FileHeader), available);
+  if (p == NULL || available < sizeof(FileHeader))
+    throw std::runtime_error(stream_to_str("Trace ", path, " is too short"));
+  FileHeader header;
+  std::memcpy(&header, p, sizeof(header));
+  check_header(header, axisSamples, path);
+  rewind();
+}
+
+/* EventRing */
+bool EventRing::push(DeviceEvent const & e)
+{
+  auto const head = head_.load(std::memory_order_relaxed);
+  if (head - tail_.load(std::memory_order_acquire) > mask_)
+  {
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  events_[head & mask_] = e;
+  head_.store(head + 1, std::memory_order_release);
+  return true;
+}
+
+std::size_t EventRing::pop(DeviceEvent * out, std::size_t maxCount)
+{
+  auto const tail = tail_.load(std::memory_order_relaxed);
+  auto const count = std::min(head_.load(std::memory_order_acquire) - tail, maxCount);
+  for (std::size_t i = 0; i < count; ++i)
+    out[i] = events_[(tail + i) & mask_];
+  tail_.store(tail + count, std::memory_order_release);
+  return count;
+}
+
+EventRing::EventRing(std::uint32_t device, std::size_t capacity) : device_(device), events_(), mask_(0), pad0_(), head_(0), dropped_(0), pad1_(), tail_(0)
+{
+  std::size_t size = 1;
+  while (size < capacity)
+    size <<= 1;
+  events_.resize(size);
+  mask_ = size - 1;
+}
+
+/* EventTraceWriter */
+EventRing * EventTraceWriter::add_device(std::string const & name)
+{
+  ScopedLock<CriticalSection> lock (cs_);
+  auto const device = static_cast<std::uint32_t>(rings_.size());
+  rings_.emplace_back(new EventRing(device, ringCapacity_));
+  pendingNames_.push_back(name);
+  return rings_.back().get();
+}
+
+std::uint64_t EventTraceWriter::get_dropped() const
+{
+  std::uint64_t dropped = 0;
+  ScopedLock<CriticalSection> lock (cs_);
+  for (auto const & spRing : rings_)
+    dropped += spRing->get_dropped();
+  return dropped;
+}
+
+void EventTraceWriter::run_()
+{
+  while (!stop_.wait(flushPeriod_))
+  {
+    if (drain_())
+      stream_.flush();
+  }
+  drain_();
+  stream_.flush();
+}
+
+bool EventTraceWriter::drain_()
+{
+  PROFILE_ZONE("EventTraceWriter::drain");
+  std::vector<EventRing *> rings;
+  {
+    ScopedLock<CriticalSection> lock (cs_);
+    /* Declarations precede the first event of their device */
+    for (auto const & name : pendingNames_)
+    {
+      auto const device = static_cast<std::uint32_t>(states_.size());
+      states_.emplace_back();
+      std::uint8_t header[2 * maxVarintSize];
+      auto p = put_varint(header, (static_cast<std::uint64_t>(device) << 1) | 1);
+      p = put_varint(p, name.size());
+      stream_.write(reinterpret_cast<char const *>(header), p - header);
+      stream_.write(name.data(), name.size());
+    }
+    pendingNames_.clear();
+    for (auto const & spRing : rings_)
+      rings.push_back(spRing.get());
+  }
+  bool written = false;
+  for (auto const pRing : rings)
+  {
+    std::size_t count;
+    while ((count = pRing->pop(batch_.data(), batch_.size())) > 0)
+    {
+      buffer_.clear();
+      for (std::size_t i = 0; i < count; ++i)
+        write_event_(batch_[i]);
+      stream_.write(reinterpret_cast<char const *>(buffer_.data()), buffer_.size());
+      events_.fetch_add(count, std::memory_order_relaxed);
+      written = true;
+    }
+  }
+  return written;
+}
+
+void EventTraceWriter::write_event_(DeviceEvent const & e)
+{
+  auto & state = states_.at(e.device);
+  auto & lastData = state.data[e.ofs];
+  auto const size = buffer_.size();
+  buffer_.resize(size + maxEventRecordSize);
+  auto const begin = buffer_.data() + size;
+  auto p = put_varint(begin, static_cast<std::uint64_t>(e.device) << 1);
+  p = put_varint(p, e.ofs);
+  /* Differences of 32-bit fields wrap, so they stay small across timestamp and sequence wraparound */
+  p = put_varint(p, zigzag(static_cast<std::int32_t>(e.data - lastData)));
+  p = put_varint(p, zigzag(static_cast<std::int32_t>(e.timeStamp - state.timeStamp)));
+  p = put_varint(p, zigzag(static_cast<std::int32_t>(e.sequence - state.sequence)));
+  p = put_varint(p, zigzag(e.ticks - lastTicks_));
+  buffer_.resize(size + (p - begin));
+  lastData = e.data;
+  state.timeStamp = e.timeStamp;
+  state.sequence = e.sequence;
+  lastTicks_ = e.ticks;
+}
+
+EventTraceWriter::EventTraceWriter(std::string const & path, std::size_t ringCapacity, DWORD flushPeriod)
+  : stream_(path, std::ios::out | std::ios::binary | std::ios::trunc), ringCapacity_(ringCapacity), flushPeriod_(flushPeriod),
+  cs_(), rings_(), pendingNames_(), states_(), lastTicks_(get_qpc_ticks()), batch_(256), buffer_(), events_(0), stop_(), spThread_()
+{
+  if (!stream_.is_open())
+    throw std::runtime_error(stream_to_str("Failed to open ", path, " for writing"));
+  auto const header = make_header(deviceEvents, lastTicks_);
+  stream_.write(reinterpret_cast<char const *>(&header), sizeof(header));
+  buffer_.reserve(batch_.size() * maxEventRecordSize);
+  spThread_.reset(new Thread([this]() { run_(); }));
+  spThread_->set_priority(THREAD_PRIORITY_BELOW_NORMAL);
+}
+
+EventTraceWriter::~EventTraceWriter()
+{
+  stop_.set();
+  spThread_.reset();
+  logging::log("trace", logging::LogLevel::info, "Captured ", get_events(), " device events, dropped ", get_dropped());
+}
+
+/* EventTraceReader */
+bool EventTraceReader::next(DeviceEvent & e)
+{
+  while (true)
+  {
+    std::size_t available = 0;
+    auto const begin = file_.get(offset_, maxEventRecordSize, available);
+    if (begin == NULL)
+      return false;
+    auto p = begin;
+    auto const end = begin + available;
+    std::uint64_t tag;
+    if (!get_varint(p, end, tag))
+      return false;
+    auto const device = tag >> 1;
+    if (tag & 1)
+    {
+      std::uint64_t length;
+      if (!get_varint(p, end, length) || device != names_.size())
+        return false;
+      offset_ += p - begin;
+      auto const pName = file_.get(offset_, static_cast<std::size_t>(length), available);
+      if (pName == NULL || available < length)
+        return false;
+      names_.emplace_back(reinterpret_cast<char const *>(pName), static_cast<std::size_t>(length));
+      states_.emplace_back();
+      offset_ += length;
+      continue;
+    }
+    if (device >= states_.size())
+      return false;
+    std::uint64_t ofs, data, timeStamp, sequence, ticks;
+    if (!get_varint(p, end, ofs) || !get_varint(p, end, data) || !get_varint(p, end, timeStamp) || !get_varint(p, end, sequence) || !get_varint(p, end, ticks))
+      return false;
+    auto & state = states_[device];
+    auto & lastData = state.data[static_cast<std::uint32_t>(ofs)];
+    lastData += static_cast<std::uint32_t>(unzigzag(data));
+    state.timeStamp += static_cast<std::uint32_t>(unzigzag(timeStamp));
+    state.sequence += static_cast<std::uint32_t>(unzigzag(sequence));
+    lastTicks_ += unzigzag(ticks);
+    e.device = static_cast<std::uint32_t>(device);
+    e.ofs = static_cast<std::uint32_t>(ofs);
+    e.data = lastData;
+    e.timeStamp = state.timeStamp;
+    e.sequence = state.sequence;
+    e.ticks = lastTicks_;
+    offset_ += p - begin;
+    return true;
+  }
+}
+
+void EventTraceReader::rewind()
+{
+  offset_ = sizeof(FileHeader);
+  lastTicks_ = startTicks_;
+  names_.clear();
+  states_.clear();
+}
+
+std::string EventTraceReader::get_device_name(std::uint32_t device) const
+{
+  return (device < names_.size()) ? names_[device] : std::string();
+}
+
+EventTraceReader::EventTraceReader(std::string const & path) : file_(path), qpcFrequency_(0), startTicks_(0), offset_(0), lastTicks_(0), names_(), states_()
+{
+  std::size_t available = 0;
+  auto const p = file_.get(0, sizeof(FileHeader), available);
+  if (p == NULL || available < sizeof(FileHeader))
+    throw std::runtime_error(stream_to_str("Trace ", path, " is too short"));
+  FileHeader header;
+  std::memcpy(&header, p, sizeof(header));
+  check_header(header, deviceEvents, path);
+  qpcFrequency_ = header.qpcFrequency;
+  startTicks_ = header.startTicks;
+  rewind();
+}
+
+}
+
+/* ReplayJoystick */
+float ReplayJoystick::get_axis_value(AxisID::type axisID) const
+{
+  return axes_.at(axisID);
+}
+
+void ReplayJoystick::update()
+{
+  PROFILE_ZONE("ReplayJoystick::update");
+  if (finished_)
+    return;
+  auto const now = get_qpc_ticks();
+  if (startTicks_ == 0)
+    startTicks_ = now;
+  auto const elapsedUs = (speed_ > 0.0) ? static_cast<std::int64_t>(qpc_ticks_to_us(now - startTicks_) * speed_) : nextUs_;
+  while (nextUs_ <= elapsedUs)
+  {
+    axes_ = next_;
+    if (reader_.next(nextUs_, next_))
+    {
+      if (speed_ <= 0.0)
+        break;
+      continue;
+    }
+    if (!loop_)
+    {
+      finished_ = true;
+      logging::log("joystick", logging::LogLevel::info, "Replay finished");
+      break;
+    }
+    /* Start over from the first sample */
+    reader_.rewind();
+    next_.fill(0.0f);
+    if (!reader_.next(nextUs_, next_))
+    {
+      finished_ = true;
+      break;
+    }
+    startTicks_ = now;
+    break;
+  }
+}
+
+ReplayJoystick::ReplayJoystick(std::string const & path, double speed, bool loop)
+  : reader_(path), speed_(speed), loop_(loop), finished_(false), startTicks_(0), nextUs_(0), next_(), axes_()
+{
+  next_.fill(0.0f);
+  axes_.fill(0.0f);
+  if (!reader_.next(nextUs_, next_))
+    throw std::runtime_error(stream_to_str("Trace ", path, " has no samples"));
+}
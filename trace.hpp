@@ -0,0 +1,288 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include "joystick.hpp"
+#include "thread.hpp"
+
+#include <array>
+#include <vector>
+#include <map>
+#include <memory>
+#include <atomic>
+#include <string>
+#include <fstream>
+#include <cstdint>
+#include <cstddef>
+
+#include <windows.h>
+
+/* Binary traces: a FileHeader followed by variable-length records of LEB128 varints (signed values zigzag-encoded). */
+namespace trace
+{
+
+enum Kind : std::uint32_t { axisSamples = 1, deviceEvents = 2 };
+
+struct FileHeader
+{
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t kind;
+  std::uint64_t qpcFrequency;
+  std::int64_t startTicks;
+};
+
+char const * const magic = "J2TTRACE";
+std::uint32_t const version = 1;
+
+/* Longest encoding of a 64-bit value */
+std::size_t const maxVarintSize = 10;
+
+inline std::uint64_t zigzag(std::int64_t v)
+{
+  return (static_cast<std::uint64_t>(v) << 1) ^ static_cast<std::uint64_t>(v >> 63);
+}
+
+inline std::int64_t unzigzag(std::uint64_t v)
+{
+  return static_cast<std::int64_t>(v >> 1) ^ -static_cast<std::int64_t>(v & 1);
+}
+
+/* Returns pointer past the written bytes */
+inline std::uint8_t * put_varint(std::uint8_t * p, std::uint64_t v)
+{
+  while (v >= 0x80)
+  {
+    *p++ = static_cast<std::uint8_t>(v) | 0x80;
+    v >>= 7;
+  }
+  *p++ = static_cast<std::uint8_t>(v);
+  return p;
+}
+
+/* Returns false on truncated or malformed input */
+inline bool get_varint(std::uint8_t const * & p, std::uint8_t const * end, std::uint64_t & v)
+{
+  v = 0;
+  for (unsigned shift = 0; p < end && shift < 64; shift += 7)
+  {
+    auto const b = *p++;
+    v |= static_cast<std::uint64_t>(b & 0x7F) << shift;
+    if ((b & 0x80) == 0)
+      return true;
+  }
+  return false;
+}
+
+FileHeader make_header(Kind kind, std::int64_t startTicks);
+/* Throws if the header is not a trace of the given kind */
+void check_header(FileHeader const & header, Kind kind, std::string const & path);
+
+/* Read-only view of a file that maps only a window around the current position, so memory use does not grow with the file size */
+class MappedFile
+{
+public:
+  /* Returns a pointer to at least min(size, remaining) bytes at offset, valid until the next call; NULL at the end of the file */
+  std::uint8_t const * get(std::uint64_t offset, std::size_t size, std::size_t & available);
+  std::uint64_t get_size() const { return size_; }
+
+  MappedFile(std::string const & path, std::size_t windowSize = 1 << 20);
+  MappedFile(MappedFile const &) =delete;
+  MappedFile & operator=(MappedFile const &) =delete;
+  ~MappedFile();
+
+private:
+  void unmap_();
+
+  HANDLE hFile_;
+  HANDLE hMapping_;
+  std::uint64_t size_;
+  std::size_t windowSize_;
+  std::uint64_t granularity_;
+  std::uint8_t const * pView_;
+  std::uint64_t viewOffset_;
+  std::size_t viewSize_;
+};
+
+/* Axis sample record: varint time since previous record (us), varint mask of changed axes,
+ * then for each changed axis in AxisID order the zigzag varint difference of the value quantized to 1/quantum.
+ */
+typedef std::array<float, AxisID::num> axes_t;
+float const quantum = 32768.0f;
+std::size_t const maxAxisRecordSize = maxVarintSize * (2 + AxisID::num);
+
+class AxisTraceWriter
+{
+public:
+  /* Writes a record only if some axis changed */
+  void add(std::int64_t ticks, axes_t const & axes);
+  std::uint64_t get_records() const { return records_; }
+
+  AxisTraceWriter(std::string const & path);
+
+private:
+  std::ofstream stream_;
+  std::int64_t startTicks_;
+  std::int64_t lastUs_;
+  std::array<std::int32_t, AxisID::num> last_;
+  std::uint64_t records_;
+};
+
+class AxisTraceReader
+{
+public:
+  /* Applies the next record to axes and sets its time since the start of the trace; returns false at the end */
+  bool next(std::int64_t & us, axes_t & axes);
+  void rewind();
+
+  AxisTraceReader(std::string const & path);
+
+private:
+  MappedFile file_;
+  std::uint64_t offset_;
+  std::int64_t us_;
+  std::array<std::int32_t, AxisID::num> values_;
+};
+
+/* One buffered DirectInput event as delivered by GetDeviceData(), stamped with the QPC time it was read at */
+struct DeviceEvent
+{
+  std::uint32_t device;
+  std::uint32_t ofs;
+  std::uint32_t data;
+  std::uint32_t timeStamp;
+  std::uint32_t sequence;
+  std::int64_t ticks;
+};
+
+/* Single-producer single-consumer ring of events; push() never blocks and drops the event if the ring is full */
+class EventRing
+{
+public:
+  bool push(DeviceEvent const & e);
+  /* Consumer side; returns number of events copied to out */
+  std::size_t pop(DeviceEvent * out, std::size_t maxCount);
+  std::uint32_t get_device() const { return device_; }
+  std::uint64_t get_dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+  /* capacity is rounded up to a power of 2 */
+  EventRing(std::uint32_t device, std::size_t capacity);
+  EventRing(EventRing const &) =delete;
+  EventRing & operator=(EventRing const &) =delete;
+
+private:
+  std::uint32_t device_;
+  std::vector<DeviceEvent> events_;
+  std::size_t mask_;
+  /* Head and tail on separate cache lines (padding, as operator new ignores alignas before C++17) */
+  char pad0_[64];
+  /* Written by the producer only */
+  std::atomic<std::size_t> head_;
+  std::atomic<std::uint64_t> dropped_;
+  char pad1_[64];
+  /* Written by the consumer only */
+  std::atomic<std::size_t> tail_;
+};
+
+/* Device event record: varint (device << 1 | 1) for a declaration, followed by varint name length and the name bytes;
+ * varint (device << 1) for an event, followed by varint dwOfs and zigzag varint differences of
+ * dwData (to the previous event of the same device and offset), dwTimeStamp, dwSequence (to the previous event of the same device)
+ * and QPC ticks (to the previous event in the file).
+ */
+std::size_t const maxEventRecordSize = maxVarintSize * 6;
+
+/* Rings are drained and encoded by a background thread, so producers only pay for a copy into the ring */
+class EventTraceWriter
+{
+public:
+  /* Thread-safe; the returned ring is owned by the writer and lives as long as it */
+  EventRing * add_device(std::string const & name);
+  std::uint64_t get_events() const { return events_.load(std::memory_order_relaxed); }
+  std::uint64_t get_dropped() const;
+
+  EventTraceWriter(std::string const & path, std::size_t ringCapacity = 4096, DWORD flushPeriod = 100);
+  EventTraceWriter(EventTraceWriter const &) =delete;
+  EventTraceWriter & operator=(EventTraceWriter const &) =delete;
+  /* Writes out the events still in the rings */
+  ~EventTraceWriter();
+
+private:
+  struct DeviceState
+  {
+    std::map<std::uint32_t, std::uint32_t> data;
+    std::uint32_t timeStamp = 0;
+    std::uint32_t sequence = 0;
+  };
+
+  void run_();
+  /* Returns true if any event was written */
+  bool drain_();
+  void write_event_(DeviceEvent const & e);
+
+  std::ofstream stream_;
+  std::size_t ringCapacity_;
+  DWORD flushPeriod_;
+  mutable CriticalSection cs_;
+  std::vector<std::unique_ptr<EventRing> > rings_;
+  std::vector<std::string> pendingNames_;
+  /* Encoder state, used by the writer thread only */
+  std::vector<DeviceState> states_;
+  std::int64_t lastTicks_;
+  std::vector<DeviceEvent> batch_;
+  std::vector<std::uint8_t> buffer_;
+  std::atomic<std::uint64_t> events_;
+  Event stop_;
+  std::unique_ptr<Thread> spThread_;
+};
+
+class EventTraceReader
+{
+public:
+  /* Reads the next event, collecting device declarations on the way; returns false at the end */
+  bool next(DeviceEvent & e);
+  void rewind();
+  std::string get_device_name(std::uint32_t device) const;
+  std::uint64_t get_qpc_frequency() const { return qpcFrequency_; }
+  std::int64_t get_start_ticks() const { return startTicks_; }
+
+  EventTraceReader(std::string const & path);
+
+private:
+  struct DeviceState
+  {
+    std::map<std::uint32_t, std::uint32_t> data;
+    std::uint32_t timeStamp = 0;
+    std::uint32_t sequence = 0;
+  };
+
+  MappedFile file_;
+  std::uint64_t qpcFrequency_;
+  std::int64_t startTicks_;
+  std::uint64_t offset_;
+  std::int64_t lastTicks_;
+  std::vector<std::string> names_;
+  std::vector<DeviceState> states_;
+};
+
+}
+
+/* Replays an axis trace. With speed > 0 samples follow the recorded timing scaled by speed; with speed 0 each update advances one sample. */
+class ReplayJoystick : public Joystick, public Updated
+{
+public:
+  virtual float get_axis_value(AxisID::type axisID) const override;
+  virtual void update() override;
+
+  ReplayJoystick(std::string const & path, double speed = 1.0, bool loop = true);
+
+private:
+  trace::AxisTraceReader reader_;
+  double speed_;
+  bool loop_;
+  bool finished_;
+  std::int64_t startTicks_;
+  std::int64_t nextUs_;
+  trace::axes_t next_;
+  trace::axes_t axes_;
+};
+
+#endif
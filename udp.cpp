@@ -0,0 +1,272 @@
+/* winsock2.h must come before windows.h */
+#include <winsock2.h>
+
+#include "udp.hpp"
+#include "util.hpp"
+#include "logging.hpp"
+#include "profiler.hpp"
+
+#include <stdexcept>
+#include <cstring>
+
+static void start_winsock()
+{
+  WSADATA wsaData;
+  auto const result = WSAStartup(MAKEWORD(2, 2), &wsaData);
+  if (result != 0)
+    throw std::runtime_error(stream_to_str("Failed to start Winsock, error = ", result));
+}
+
+static sockaddr_in make_sockaddr(char const * address, unsigned short port)
+{
+  sockaddr_in sa;
+  std::memset(&sa, 0, sizeof(sa));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons(port);
+  sa.sin_addr.s_addr = inet_addr(address);
+  if (sa.sin_addr.s_addr == INADDR_NONE && std::strcmp(address, "255.255.255.255") != 0)
+    throw std::runtime_error(stream_to_str("Invalid IPv4 address: '", address, "'"));
+  return sa;
+}
+
+/* UdpJoystick */
+float UdpJoystick::get_axis_value(AxisID::type axisID) const
+{
+  return axes_.at(axisID);
+}
+
+void UdpJoystick::update()
+{
+  PROFILE_ZONE("UdpJoystick::update");
+  udp_pose_t pose;
+  if (spThread_)
+  {
+    {
+      ScopedLock<CriticalSection> lock (cs_);
+      if (!sharedFresh_)
+        return;
+      pose = shared_;
+      sharedFresh_ = false;
+    }
+    set_axes_(pose);
+  }
+  else if (drain_(pose))
+    set_axes_(pose);
+}
+
+std::uint64_t UdpJoystick::get_packets() const
+{
+  return packets_.load(std::memory_order_relaxed);
+}
+
+std::uint64_t UdpJoystick::get_dropped() const
+{
+  return dropped_.load(std::memory_order_relaxed);
+}
+
+UdpJoystick::UdpJoystick(char const * address, unsigned short port, bool useThread, double translationRange, double rotationRange)
+  : socket_(INVALID_SOCKET), hSocketEvent_(NULL), translationScale_(0.0), rotationScale_(0.0),
+    cs_(), shared_(), sharedFresh_(false), packets_(0), dropped_(0), axes_(), stop_(), spThread_()
+{
+  if (translationRange <= 0.0 || rotationRange <= 0.0)
+    throw std::runtime_error(stream_to_str("Invalid UDP pose ranges: translation: ", translationRange, "; rotation: ", rotationRange));
+  translationScale_ = 1.0 / translationRange;
+  rotationScale_ = 1.0 / rotationRange;
+  axes_.fill(0.0f);
+  auto const sa = make_sockaddr(address, port);
+  start_winsock();
+  socket_ = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  if (socket_ == INVALID_SOCKET)
+  {
+    auto const error = WSAGetLastError();
+    WSACleanup();
+    throw std::runtime_error(stream_to_str("Failed to create UDP socket, error = ", error));
+  }
+  try {
+    if (bind(socket_, reinterpret_cast<sockaddr const *>(&sa), sizeof(sa)) == SOCKET_ERROR)
+      throw std::runtime_error(stream_to_str("Failed to bind UDP socket to ", address, ":", port, ", error = ", WSAGetLastError()));
+    if (useThread)
+    {
+      /* WSAEventSelect() also makes the socket non-blocking */
+      hSocketEvent_ = WSACreateEvent();
+      if (hSocketEvent_ == NULL || WSAEventSelect(socket_, hSocketEvent_, FD_READ) == SOCKET_ERROR)
+        throw std::runtime_error(stream_to_str("Failed to set up UDP socket event, error = ", WSAGetLastError()));
+      spThread_.reset(new Thread([this]() { run_(); }));
+      spThread_->set_priority(THREAD_PRIORITY_ABOVE_NORMAL);
+    }
+    else
+    {
+      ULONG nonBlocking = 1;
+      if (ioctlsocket(socket_, FIONBIO, &nonBlocking) == SOCKET_ERROR)
+        throw std::runtime_error(stream_to_str("Failed to make UDP socket non-blocking, error = ", WSAGetLastError()));
+    }
+  } catch (std::runtime_error &)
+  {
+    if (hSocketEvent_ != NULL)
+      WSACloseEvent(hSocketEvent_);
+    closesocket(socket_);
+    WSACleanup();
+    throw;
+  }
+  logging::log("joystick", logging::LogLevel::debug, "Listening for UDP poses on ", address, ":", port, (useThread ? " (thread)" : ""));
+}
+
+UdpJoystick::~UdpJoystick()
+{
+  if (spThread_)
+  {
+    stop_.set();
+    spThread_->join();
+  }
+  if (hSocketEvent_ != NULL)
+    WSACloseEvent(hSocketEvent_);
+  closesocket(socket_);
+  WSACleanup();
+  logging::log("joystick", logging::LogLevel::debug, "UDP poses received: ", get_packets(), "; dropped: ", get_dropped());
+}
+
+bool UdpJoystick::drain_(udp_pose_t & newest)
+{
+  /* Larger than a pose, so oversized datagrams are detected instead of truncated */
+  char buffer[sizeof(udp_pose_t) + 8];
+  bool received = false;
+  while (true)
+  {
+    auto const n = recv(socket_, buffer, sizeof(buffer), 0);
+    if (n == SOCKET_ERROR)
+    {
+      auto const error = WSAGetLastError();
+      if (error == WSAEWOULDBLOCK)
+        break;
+      /* ICMP port unreachable from an earlier send, or a datagram that did not fit */
+      if (error == WSAECONNRESET || error == WSAEMSGSIZE)
+        continue;
+      throw std::runtime_error(stream_to_str("Failed to receive UDP pose, error = ", error));
+    }
+    if (n != static_cast<int>(sizeof(udp_pose_t)))
+      continue;
+    if (received)
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+    std::memcpy(newest.data(), buffer, sizeof(udp_pose_t));
+    received = true;
+    packets_.fetch_add(1, std::memory_order_relaxed);
+  }
+  return received;
+}
+
+void UdpJoystick::run_()
+{
+  HANDLE const handles[] = { stop_.get_handle(), hSocketEvent_ };
+  while (WaitForMultipleObjects(2, handles, FALSE, INFINITE) == WAIT_OBJECT_0 + 1)
+  {
+    /* Reset before draining, so that a datagram arriving meanwhile signals again */
+    WSAResetEvent(hSocketEvent_);
+    udp_pose_t pose;
+    if (!drain_(pose))
+      continue;
+    ScopedLock<CriticalSection> lock (cs_);
+    if (sharedFresh_)
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+    shared_ = pose;
+    sharedFresh_ = true;
+  }
+}
+
+void UdpJoystick::set_axes_(udp_pose_t const & pose)
+{
+  axes_[AxisID::x] = static_cast<float>(pose[0] * translationScale_);
+  axes_[AxisID::y] = static_cast<float>(pose[1] * translationScale_);
+  axes_[AxisID::z] = static_cast<float>(pose[2] * translationScale_);
+  axes_[AxisID::rx] = static_cast<float>(pose[3] * rotationScale_);
+  axes_[AxisID::ry] = static_cast<float>(pose[4] * rotationScale_);
+  axes_[AxisID::rz] = static_cast<float>(pose[5] * rotationScale_);
+}
+
+/* UdpPoseSender */
+int UdpPoseSender::send(udp_pose_t const & pose)
+{
+  auto const result = sendto(socket_, reinterpret_cast<char const *>(pose.data()), sizeof(udp_pose_t), 0, reinterpret_cast<sockaddr const *>(to_.data()), sizeof(sockaddr_in));
+  return result == SOCKET_ERROR ? WSAGetLastError() : 0;
+}
+
+UdpPoseSender::UdpPoseSender(char const * address, unsigned short port, bool nonBlocking) : socket_(INVALID_SOCKET), to_()
+{
+  static_assert(sizeof(sockaddr_in) <= sizeof(to_), "to_ is too small for sockaddr_in");
+  auto const sa = make_sockaddr(address, port);
+  std::memcpy(to_.data(), &sa, sizeof(sa));
+  start_winsock();
+  socket_ = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  if (socket_ == INVALID_SOCKET)
+  {
+    auto const error = WSAGetLastError();
+    WSACleanup();
+    throw std::runtime_error(stream_to_str("Failed to create UDP socket, error = ", error));
+  }
+  ULONG nonBlockingArg = nonBlocking ? 1 : 0;
+  if (nonBlocking && ioctlsocket(socket_, FIONBIO, &nonBlockingArg) == SOCKET_ERROR)
+  {
+    auto const error = WSAGetLastError();
+    closesocket(socket_);
+    WSACleanup();
+    throw std::runtime_error(stream_to_str("Failed to make UDP socket non-blocking, error = ", error));
+  }
+}
+
+UdpPoseSender::~UdpPoseSender()
+{
+  closesocket(socket_);
+  WSACleanup();
+}
+
+/* UdpPoseSink */
+void UdpPoseSink::put_pose(Pose const & pose)
+{
+  PROFILE_ZONE("UdpPoseSink::put_pose");
+  udp_pose_t const packet = {{ pose.x, pose.y, pose.z, pose.yaw, pose.pitch, pose.roll }};
+  if (sentAny_ && packet == packet_)
+    return;
+  packet_ = packet;
+  sentAny_ = true;
+  for (auto const & spSender : senders_)
+  {
+    auto const error = spSender->send(packet_);
+    if (error == 0)
+    {
+      sent_.fetch_add(1, std::memory_order_relaxed);
+      continue;
+    }
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+    /* E.g. WSAECONNRESET after ICMP port unreachable; logged once, the output keeps trying */
+    if (error != WSAEWOULDBLOCK && !errorLogged_)
+    {
+      errorLogged_ = true;
+      logging::log("output", logging::LogLevel::error, "Failed to send UDP pose, error = ", error);
+    }
+  }
+}
+
+std::uint64_t UdpPoseSink::get_sent() const
+{
+  return sent_.load(std::memory_order_relaxed);
+}
+
+std::uint64_t UdpPoseSink::get_dropped() const
+{
+  return dropped_.load(std::memory_order_relaxed);
+}
+
+UdpPoseSink::UdpPoseSink(std::vector<endpoint_t> const & endpoints) : senders_(), packet_(), sentAny_(false), errorLogged_(false), sent_(0), dropped_(0)
+{
+  if (endpoints.empty())
+    throw std::runtime_error("UDP output needs at least one endpoint");
+  for (auto const & e : endpoints)
+  {
+    senders_.emplace_back(new UdpPoseSender(e.first.c_str(), e.second, true));
+    logging::log("output", logging::LogLevel::info, "Sending poses to ", e.first, ":", e.second);
+  }
+}
+
+UdpPoseSink::~UdpPoseSink()
+{
+  logging::log("output", logging::LogLevel::info, "UDP output sent ", get_sent(), " datagrams, dropped ", get_dropped());
+}
@@ -0,0 +1,105 @@
+#ifndef UDP_HPP
+#define UDP_HPP
+
+#include "joystick.hpp"
+#include "pose.hpp"
+#include "thread.hpp"
+
+#include <array>
+#include <vector>
+#include <string>
+#include <memory>
+#include <atomic>
+#include <cstdint>
+
+#include <windows.h>
+
+/* OpenTrack "UDP over network" protocol: each datagram holds 6 doubles, x, y, z (cm) and yaw, pitch, roll (degrees). */
+typedef std::array<double, 6> udp_pose_t;
+
+/* Pose received over UDP, exposed as axes: x, y, z are translation / translationRange, rx, ry, rz are yaw, pitch, roll / rotationRange.
+ * Only the newest datagram matters; older pending ones are dropped.
+ * Without a thread, update() drains the non-blocking socket; with a thread, datagrams are received as they arrive and update() takes the newest.
+ */
+class UdpJoystick : public Joystick, public Updated
+{
+public:
+  virtual float get_axis_value(AxisID::type axisID) const override;
+  virtual void update() override;
+  /* Thread-safe */
+  std::uint64_t get_packets() const;
+  std::uint64_t get_dropped() const;
+
+  UdpJoystick(char const * address, unsigned short port, bool useThread, double translationRange = 50.0, double rotationRange = 180.0);
+  UdpJoystick(UdpJoystick const &) =delete;
+  UdpJoystick & operator=(UdpJoystick const &) =delete;
+  ~UdpJoystick();
+
+private:
+  /* Returns true if at least one pose was received */
+  bool drain_(udp_pose_t & newest);
+  void run_();
+  void set_axes_(udp_pose_t const & pose);
+
+  /* SOCKET, kept as UINT_PTR so that winsock2.h is only needed in udp.cpp */
+  UINT_PTR socket_;
+  HANDLE hSocketEvent_;
+  double translationScale_;
+  double rotationScale_;
+  CriticalSection cs_;
+  udp_pose_t shared_;
+  bool sharedFresh_;
+  /* Written by the receive thread if there is one, read by any thread */
+  std::atomic<std::uint64_t> packets_;
+  std::atomic<std::uint64_t> dropped_;
+  std::array<float, AxisID::num> axes_;
+  Event stop_;
+  std::unique_ptr<Thread> spThread_;
+};
+
+/* Sends poses in the same format, e.g. to stand in for a tracker when testing */
+class UdpPoseSender
+{
+public:
+  /* Returns 0, or the Winsock error (WSAEWOULDBLOCK if a non-blocking send would block); does not throw, so it can be used on the sampling path */
+  int send(udp_pose_t const & pose);
+
+  UdpPoseSender(char const * address, unsigned short port, bool nonBlocking = false);
+  UdpPoseSender(UdpPoseSender const &) =delete;
+  UdpPoseSender & operator=(UdpPoseSender const &) =delete;
+  ~UdpPoseSender();
+
+private:
+  UINT_PTR socket_;
+  std::array<std::uint32_t, 4> to_;
+};
+
+/* Pose output in the same format to one or more endpoints (config output type "udp"), sent only when the pose changes.
+ * The packet is preallocated and sockets are non-blocking, so put_pose() never waits; datagrams that would block or fail are counted as dropped.
+ * The first send error other than WSAEWOULDBLOCK is logged.
+ */
+class UdpPoseSink : public PoseSink
+{
+public:
+  typedef std::pair<std::string, unsigned short> endpoint_t;
+
+  virtual void put_pose(Pose const & pose) override;
+  std::uint64_t get_sent() const;
+  std::uint64_t get_dropped() const;
+
+  UdpPoseSink(std::vector<endpoint_t> const & endpoints);
+  UdpPoseSink(UdpPoseSink const &) =delete;
+  UdpPoseSink & operator=(UdpPoseSink const &) =delete;
+  ~UdpPoseSink();
+
+private:
+  std::vector<std::unique_ptr<UdpPoseSender> > senders_;
+  udp_pose_t packet_;
+  bool sentAny_;
+  bool errorLogged_;
+  /* Written by put_pose(), read by any thread */
+  std::atomic<std::uint64_t> sent_;
+  std::atomic<std::uint64_t> dropped_;
+};
+
+#endif
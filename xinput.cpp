@@ -0,0 +1,132 @@
+#include "xinput.hpp"
+#include "util.hpp"
+#include "logging.hpp"
+#include "profiler.hpp"
+#include "clock.hpp"
+
+#include <stdexcept>
+
+/* XInputManager */
+void XInputManager::update()
+{
+  PROFILE_ZONE("XInputManager::update");
+  auto const now = get_qpc_ticks();
+  for (DWORD i = 0; i < numSlots; ++i)
+  {
+    auto & slot = slots_[i];
+    if (!slot.used)
+      continue;
+    /* XInputGetState() on an empty slot is slow, so hot-plug probing is rate-limited */
+    if (!slot.connected && now < slot.nextProbe)
+      continue;
+    read_slot_(i, slot, now);
+  }
+}
+
+void XInputManager::use_slot(DWORD slot)
+{
+  if (slot >= numSlots)
+    throw std::runtime_error(stream_to_str("Invalid XInput slot: ", slot, " (must be less than ", numSlots, ")"));
+  auto & s = slots_.at(slot);
+  if (s.used)
+    return;
+  s.used = true;
+  read_slot_(slot, s, get_qpc_ticks());
+  if (!s.connected)
+    logging::log("joystick", logging::LogLevel::info, "XInput slot ", slot, " is not connected yet");
+}
+
+bool XInputManager::is_connected(DWORD slot) const
+{
+  return slot < numSlots && slots_[slot].connected;
+}
+
+float XInputManager::get_axis_value(DWORD slot, AxisID::type axisID) const
+{
+  return slots_.at(slot).axes.at(axisID);
+}
+
+char const * XInputManager::get_library_name() const
+{
+  return libraryName_;
+}
+
+XInputManager::XInputManager() : hm_(NULL), libraryName_(""), getState_(NULL), slots_()
+{
+  static char const * const libraryNames[] = { "xinput1_4.dll", "xinput1_3.dll", "xinput9_1_0.dll" };
+  for (auto const name : libraryNames)
+  {
+    hm_ = LoadLibraryA(name);
+    if (hm_ != NULL)
+    {
+      libraryName_ = name;
+      break;
+    }
+  }
+  if (hm_ == NULL)
+    throw std::runtime_error("Failed to load XInput");
+  getState_ = reinterpret_cast<XInputGetState_t>(GetProcAddress(hm_, "XInputGetState"));
+  if (getState_ == NULL)
+  {
+    FreeLibrary(hm_);
+    throw std::runtime_error(stream_to_str("Failed to get address of XInputGetState in ", libraryName_));
+  }
+  for (auto & s : slots_)
+  {
+    s.used = false;
+    s.connected = false;
+    s.packetNumber = 0;
+    s.nextProbe = 0;
+    s.axes.fill(0.0f);
+  }
+  logging::log("joystick", logging::LogLevel::debug, "Loaded ", libraryName_);
+}
+
+XInputManager::~XInputManager()
+{
+  FreeLibrary(hm_);
+}
+
+void XInputManager::read_slot_(DWORD index, Slot & slot, std::int64_t now)
+{
+  XINPUT_STATE state;
+  auto const result = getState_(index, &state);
+  if (result != ERROR_SUCCESS)
+  {
+    if (slot.connected)
+    {
+      logging::log("joystick", logging::LogLevel::info, "XInput slot ", index, " disconnected");
+      slot.axes.fill(0.0f);
+    }
+    slot.connected = false;
+    slot.nextProbe = now + static_cast<std::int64_t>(probePeriodMs_ * get_qpc_frequency() / 1000.0);
+    return;
+  }
+  if (!slot.connected)
+    logging::log("joystick", logging::LogLevel::info, "XInput slot ", index, " connected");
+  else if (state.dwPacketNumber == slot.packetNumber)
+    return;
+  slot.connected = true;
+  slot.packetNumber = state.dwPacketNumber;
+  auto const & g = state.Gamepad;
+  auto & axes = slot.axes;
+  axes[AxisID::x] = lerp<float, float>(g.sThumbLX, -32768.0f, 32767.0f, -1.0f, 1.0f);
+  axes[AxisID::y] = lerp<float, float>(g.sThumbLY, -32768.0f, 32767.0f, -1.0f, 1.0f);
+  axes[AxisID::rx] = lerp<float, float>(g.sThumbRX, -32768.0f, 32767.0f, -1.0f, 1.0f);
+  axes[AxisID::ry] = lerp<float, float>(g.sThumbRY, -32768.0f, 32767.0f, -1.0f, 1.0f);
+  axes[AxisID::z] = lerp<float, float>(g.bLeftTrigger, 0.0f, 255.0f, -1.0f, 1.0f);
+  axes[AxisID::rz] = lerp<float, float>(g.bRightTrigger, 0.0f, 255.0f, -1.0f, 1.0f);
+}
+
+/* XInputJoystick */
+float XInputJoystick::get_axis_value(AxisID::type axisID) const
+{
+  return spManager_->get_axis_value(slot_, axisID);
+}
+
+XInputJoystick::XInputJoystick(std::shared_ptr<XInputManager> const & spManager, DWORD slot) : spManager_(spManager), slot_(slot)
+{
+  if (!spManager_)
+    throw std::runtime_error("XInput manager is NULL");
+  spManager_->use_slot(slot_);
+}
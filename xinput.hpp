@@ -0,0 +1,68 @@
+#ifndef XINPUT_HPP
+#define XINPUT_HPP
+
+#include "joystick.hpp"
+
+#include <string>
+#include <array>
+#include <memory>
+#include <cstdint>
+
+#include <windows.h>
+#include <xinput.h>
+
+/* XInput gamepads.
+ * The library is loaded at runtime (xinput1_4, xinput1_3 or xinput9_1_0), so a missing XInput only disables this backend.
+ * Axes: left stick x/y, right stick rx/ry, left trigger z, right trigger rz, each in [-1, 1].
+ */
+class XInputManager : public Updated
+{
+public:
+  static std::size_t const numSlots = XUSER_MAX_COUNT;
+
+  /* Reads all slots in use; disconnected slots are probed at most once per probePeriod_ */
+  virtual void update() override;
+  void use_slot(DWORD slot);
+  bool is_connected(DWORD slot) const;
+  float get_axis_value(DWORD slot, AxisID::type axisID) const;
+  char const * get_library_name() const;
+
+  XInputManager();
+  XInputManager(XInputManager const &) =delete;
+  XInputManager & operator=(XInputManager const &) =delete;
+  ~XInputManager();
+
+private:
+  typedef DWORD (WINAPI *XInputGetState_t)(DWORD, XINPUT_STATE*);
+
+  struct Slot
+  {
+    bool used;
+    bool connected;
+    DWORD packetNumber;
+    std::int64_t nextProbe;
+    std::array<float, AxisID::num> axes;
+  };
+
+  void read_slot_(DWORD index, Slot & slot, std::int64_t now);
+
+  static double constexpr probePeriodMs_ = 1000.0;
+  HMODULE hm_;
+  char const * libraryName_;
+  XInputGetState_t getState_;
+  std::array<Slot, numSlots> slots_;
+};
+
+class XInputJoystick : public Joystick
+{
+public:
+  virtual float get_axis_value(AxisID::type axisID) const override;
+
+  XInputJoystick(std::shared_ptr<XInputManager> const & spManager, DWORD slot);
+
+private:
+  std::shared_ptr<XInputManager> spManager_;
+  DWORD slot_;
+};
+
+#endif